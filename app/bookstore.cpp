@@ -0,0 +1,135 @@
+/** bookstore.cpp
+ * Author: StarryPurple
+ * Date: Since 2026.10.19
+ *
+ * The bookstore system with all its modes. Data files are "Test_*" in the current directory.
+ *
+ * usage: bookstore [--trace FILE] [--ship FILE] [--batch SCRIPT | --server SOCKET | --standby FILE SOCKET]
+ *        bookstore --client SOCKET
+ *   (nothing)             commands from stdin, answers to stdout.
+ *   --batch SCRIPT        replay a recorded script in pipelined batch mode. Same output as from stdin.
+ *   --server SOCKET       serve checkout terminals over a Unix domain socket till SIGINT / SIGTERM.
+ *   --standby FILE SOCKET follow a primary started with "--ship FILE", in a directory with a copy of
+ *                         its files, and answer read-only commands over SOCKET.
+ *   --trace FILE          record a span trace (Chrome trace-event JSON) into FILE,
+ *                         and print the latency table of every command type to stderr at the end.
+ *   --ship FILE           ship every change of the data files to a standby (a file or a named pipe).
+ *   --client SOCKET       a checkout terminal: commands from stdin go to the server at SOCKET,
+ *                         and its answers to stdout. Ends when the server has answered them all.
+ */
+#include "command_manager.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+// write all of @size bytes, or return false.
+bool write_all(int fd, const char *data, size_t size) {
+  while(size > 0) {
+    const ssize_t res = ::write(fd, data, size);
+    if(res < 0 && errno == EINTR) continue;
+    if(res <= 0) return false;
+    data += res;
+    size -= res;
+  }
+  return true;
+}
+
+int run_client(const std::string &socket_path) {
+  sockaddr_un address{};
+  if(socket_path.size() >= sizeof(address.sun_path)) {
+    std::cerr << "socket path too long: " << socket_path << '\n';
+    return 1;
+  }
+  address.sun_family = AF_UNIX;
+  std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+    std::cerr << "cannot connect to " << socket_path << '\n';
+    if(fd >= 0) ::close(fd);
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN); // the server gone is seen from read() instead
+  // both ways at once, so a long script never waits on answers nobody reads.
+  // When stdin ends the server is told so, and answers what's left before hanging up.
+  char buffer[1 << 12];
+  bool is_input_open = true;
+  while(true) {
+    pollfd poll_fds[2]{{fd, POLLIN, 0}, {STDIN_FILENO, POLLIN, 0}};
+    if(poll(poll_fds, is_input_open ? 2 : 1, -1) < 0) {
+      if(errno == EINTR) continue;
+      break;
+    }
+    if(poll_fds[0].revents) {
+      const ssize_t res = ::read(fd, buffer, sizeof(buffer));
+      if(res < 0 && errno == EINTR) continue;
+      if(res <= 0) break; // hung up: everything's answered
+      if(!write_all(STDOUT_FILENO, buffer, res)) break;
+    }
+    if(is_input_open && poll_fds[1].revents) {
+      const ssize_t res = ::read(STDIN_FILENO, buffer, sizeof(buffer));
+      if(res < 0 && errno == EINTR) continue;
+      if(res <= 0 || !write_all(fd, buffer, res)) {
+        is_input_open = false;
+        shutdown(fd, SHUT_WR);
+      }
+    }
+  }
+  ::close(fd);
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  if(argc == 3 && std::strcmp(argv[1], "--client") == 0)
+    return run_client(argv[2]);
+  BookStore::CommandManager command_manager;
+  const bool is_tracing = argc >= 3 && std::strcmp(argv[1], "--trace") == 0;
+  if(is_tracing) {
+    if(!StarryPurple::tracer.start(argv[2])) {
+      std::cerr << "cannot write the trace to " << argv[2] << '\n';
+      return 1;
+    }
+    argc -= 2; argv += 2;
+  }
+  if(argc >= 3 && std::strcmp(argv[1], "--ship") == 0) {
+    if(!StarryPurple::change_log.start(argv[2])) {
+      std::cerr << "cannot ship to " << argv[2] << '\n';
+      return 1;
+    }
+    argc -= 2; argv += 2;
+  }
+  try {
+    if(argc == 3 && std::strcmp(argv[1], "--batch") == 0)
+      command_manager.command_batch_reader(argv[2], "Test", "./");
+    else if(argc == 3 && std::strcmp(argv[1], "--server") == 0)
+      command_manager.command_server(argv[2], "Test", "./");
+    else if(argc == 4 && std::strcmp(argv[1], "--standby") == 0)
+      command_manager.command_standby(argv[2], argv[3], "Test", "./");
+    else if(argc == 1)
+      command_manager.command_list_reader("Test", "./");
+    else {
+      std::cerr << "usage: bookstore [--trace FILE] [--ship FILE]"
+        " [--batch SCRIPT | --server SOCKET | --standby FILE SOCKET]\n"
+        "       bookstore --client SOCKET\n";
+      return 1;
+    }
+  } catch(const StarryPurple::FileExceptions &error) {
+    std::cerr << error.what() << '\n';
+    return 1;
+  }
+  if(is_tracing) {
+    StarryPurple::tracer.stop();
+    command_manager.write_stats(std::cerr);
+  }
+  return 0;
+}
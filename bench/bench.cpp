@@ -0,0 +1,280 @@
+/** bench.cpp
+ * Author: StarryPurple
+ * Date: Since 2026.10.19
+ *
+ * End-to-end benchmark of the bookstore system.
+ *
+ * A deterministic workload (fixed seed) is generated first:
+ *   a catalog of books built by select + modify + import,
+ *   then a mix of skewed "buy" (Zipfian over ISBNs), "show" by every field,
+ *   select + import, su / logout stacks, modify and show finance.
+ * It's run line by line against a fresh data directory through CommandManager::console_run,
+ * and every line is timed.
+ * Reported per command type: count, throughput, p50 / p99 / p999 latency,
+ * then the system's own table (accepted / rejected counts, latency histograms).
+ * Startup is timed too: opening the fresh directory, and restarting on the data the run left
+ * (open, then the first "su" and "show", as a kiosk does after a restart).
+ * With --trace, a span trace of the run is written to FILE in Chrome trace-event JSON.
+ *
+ * usage: bench [--ops N] [--books N] [--seed N] [--zipf S] [--dir DIR] [--trace FILE]
+ */
+#include "command_manager.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <random>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct BenchConfig {
+  size_t ops = 20000; // lines of the mixed workload, after the catalog is built
+  size_t books = 500;
+  unsigned long long seed = 20261019;
+  double zipf = 0.99; // skew of "buy" and the other per-book commands
+  std::string directory = "./bench_data/";
+  std::string trace; // no trace if empty
+};
+
+// P(rank k) proportional to 1 / k^s, for k in [1, n]. Returns rank - 1.
+class ZipfSampler {
+public:
+  ZipfSampler(size_t n, double s) : cdf_(n) {
+    double sum = 0;
+    for(size_t k = 0; k < n; ++k) {
+      sum += 1.0 / std::pow(static_cast<double>(k + 1), s);
+      cdf_[k] = sum;
+    }
+    for(auto &val: cdf_) val /= sum;
+  }
+  template<class Rng>
+  size_t operator()(Rng &rng) {
+    const double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+    return std::min<size_t>(
+      std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin(), cdf_.size() - 1);
+  }
+private:
+  std::vector<double> cdf_;
+};
+
+struct WorkloadLine {
+  std::string label; // the command type it's reported under
+  std::string line;
+};
+
+std::string isbn_of(size_t book) {
+  return "978-" + std::to_string(7000000 + book);
+}
+
+class WorkloadGenerator {
+public:
+  explicit WorkloadGenerator(const BenchConfig &config)
+    : config_(config), rng_(config.seed), zipf_(config.books, config.zipf) {}
+
+  std::vector<WorkloadLine> generate() {
+    std::vector<WorkloadLine> res;
+    emit(res, "su", "su root sjtu");
+    emit(res, "useradd", "useradd clerk clerkpw 3 Clerk");
+    for(size_t i = 0; i < cCustomerCount; ++i)
+      emit(res, "useradd", "useradd customer" + std::to_string(i) + " pw 1 Customer");
+    // the catalog. Names, authors and keywords are shared by many books, as in a real store.
+    for(size_t book = 0; book < config_.books; ++book) {
+      emit(res, "select", "select " + isbn_of(book));
+      emit(res, "modify", "modify -name=\"Book_" + std::to_string(book % 97)
+        + "\" -author=\"Author_" + std::to_string(book % 31)
+        + "\" -keyword=\"" + keyword_of(book) + "\" -price=" + price_of(book));
+      emit(res, "import", "import " + std::to_string(1000 + uniform(1000)) + " " + price_of(book));
+    }
+    while(res.size() < catalog_lines() + config_.ops)
+      mixed_step(res);
+    emit(res, "quit", "quit");
+    return res;
+  }
+
+private:
+  static constexpr size_t cCustomerCount = 8;
+  size_t catalog_lines() const { return 2 + cCustomerCount + config_.books * 3; }
+
+  size_t uniform(size_t n) {
+    return std::uniform_int_distribution<size_t>(0, n - 1)(rng_);
+  }
+  size_t skewed_book() {
+    return zipf_(rng_);
+  }
+  std::string keyword_of(size_t book) const {
+    return "kw" + std::to_string(book % 13) + "|kw" + std::to_string(13 + book % 7);
+  }
+  std::string price_of(size_t book) const {
+    return std::to_string(10 + book % 90) + "." + std::to_string(book % 10) + "0";
+  }
+  static void emit(std::vector<WorkloadLine> &res, const char *label, std::string line) {
+    res.push_back({label, std::move(line)});
+  }
+
+  void mixed_step(std::vector<WorkloadLine> &res) {
+    const size_t dice = uniform(100);
+    if(dice < 35) {
+      emit(res, "buy", "buy " + isbn_of(skewed_book()) + " 1");
+    } else if(dice < 45) {
+      emit(res, "show -ISBN", "show -ISBN=" + isbn_of(skewed_book()));
+    } else if(dice < 50) {
+      emit(res, "show -name", "show -name=\"Book_" + std::to_string(skewed_book() % 97) + "\"");
+    } else if(dice < 55) {
+      emit(res, "show -author", "show -author=\"Author_" + std::to_string(skewed_book() % 31) + "\"");
+    } else if(dice < 60) {
+      emit(res, "show -keyword", "show -keyword=\"kw" + std::to_string(skewed_book() % 13) + "\"");
+    } else if(dice < 61) {
+      emit(res, "show", "show");
+    } else if(dice < 75) {
+      emit(res, "select", "select " + isbn_of(skewed_book()));
+      emit(res, "import", "import " + std::to_string(1 + uniform(50)) + " " + std::to_string(1 + uniform(500)));
+    } else if(dice < 87) {
+      // a customer steps up to the counter, looks, buys and leaves.
+      emit(res, "su", "su customer" + std::to_string(uniform(cCustomerCount)) + " pw");
+      emit(res, "show -ISBN", "show -ISBN=" + isbn_of(skewed_book()));
+      emit(res, "buy", "buy " + isbn_of(skewed_book()) + " 1");
+      emit(res, "logout", "logout");
+    } else if(dice < 92) {
+      // root is higher than clerk, so no password.
+      emit(res, "su", "su clerk");
+      emit(res, "select", "select " + isbn_of(skewed_book()));
+      emit(res, "import", "import " + std::to_string(1 + uniform(50)) + " " + std::to_string(1 + uniform(500)));
+      emit(res, "logout", "logout");
+    } else if(dice < 97) {
+      const size_t book = skewed_book();
+      emit(res, "select", "select " + isbn_of(book));
+      emit(res, "modify", "modify -price=" + std::to_string(10 + uniform(90)) + ".00");
+    } else {
+      emit(res, "show finance", "show finance");
+    }
+  }
+
+  const BenchConfig &config_;
+  std::mt19937_64 rng_;
+  ZipfSampler zipf_;
+};
+
+// swallows what the system prints, counting the "Invalid" lines.
+// The workload is meant to be all valid, so any of them is a bug of the generator.
+class CountingBuffer : public std::streambuf {
+public:
+  size_t invalid_count = 0;
+protected:
+  int overflow(int ch) override { return ch; }
+  std::streamsize xsputn(const char *str, std::streamsize n) override {
+    // output is flushed between commands, so no line is split across two calls.
+    const std::string_view chunk(str, n);
+    for(size_t pos = chunk.find("Invalid\n"); pos != std::string_view::npos;
+      pos = chunk.find("Invalid\n", pos + 1))
+      if(pos == 0 || chunk[pos - 1] == '\n')
+        ++invalid_count;
+    return n;
+  }
+};
+
+long long elapsed_ns(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start).count();
+}
+
+// the q-quantile of sorted latencies, in microseconds.
+double percentile_us(const std::vector<long long> &sorted_ns, double q) {
+  if(sorted_ns.empty()) return 0;
+  size_t rank = static_cast<size_t>(std::ceil(q * sorted_ns.size()));
+  if(rank > 0) --rank;
+  return sorted_ns[std::min(rank, sorted_ns.size() - 1)] / 1000.0;
+}
+
+bool parse_args(int argc, char *argv[], BenchConfig &config) {
+  for(int i = 1; i < argc; ++i) {
+    if(i + 1 >= argc) return false;
+    const std::string key = argv[i], value = argv[++i];
+    if(key == "--ops") config.ops = std::stoull(value);
+    else if(key == "--books") config.books = std::stoull(value);
+    else if(key == "--seed") config.seed = std::stoull(value);
+    else if(key == "--zipf") config.zipf = std::stod(value);
+    else if(key == "--dir") config.directory = value;
+    else if(key == "--trace") config.trace = value;
+    else return false;
+  }
+  if(config.books == 0) return false;
+  if(config.directory.back() != '/') config.directory += '/';
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  BenchConfig config;
+  if(!parse_args(argc, argv, config)) {
+    std::fprintf(stderr, "usage: bench [--ops N] [--books N] [--seed N] [--zipf S] [--dir DIR] [--trace FILE]\n");
+    return 1;
+  }
+  const std::vector<WorkloadLine> workload = WorkloadGenerator(config).generate();
+
+  std::filesystem::remove_all(config.directory);
+  std::filesystem::create_directories(config.directory);
+
+  if(!config.trace.empty() && !StarryPurple::tracer.start(config.trace)) {
+    std::fprintf(stderr, "bench: cannot write trace to %s\n", config.trace.c_str());
+    return 1;
+  }
+  CountingBuffer sink;
+  std::streambuf *const cout_buffer = std::cout.rdbuf(&sink);
+  std::map<std::string, std::vector<long long>> latencies;
+  long long total_ns = 0;
+  BookStore::CommandManager command_manager;
+  auto start = std::chrono::steady_clock::now();
+  command_manager.console_open("Bench", config.directory);
+  const long long fresh_open_ns = elapsed_ns(start);
+  for(const auto &[label, line]: workload) {
+    start = std::chrono::steady_clock::now();
+    command_manager.console_run(line);
+    const long long ns = elapsed_ns(start);
+    latencies[label].push_back(ns);
+    total_ns += ns;
+  }
+  command_manager.console_close();
+  // restart on what's just been written. The page cache is warm, so it's the system's own cost.
+  long long restart_open_ns, restart_first_ns;
+  {
+    BookStore::CommandManager restarted;
+    start = std::chrono::steady_clock::now();
+    restarted.console_open("Bench", config.directory);
+    restart_open_ns = elapsed_ns(start);
+    start = std::chrono::steady_clock::now();
+    restarted.console_run("su root sjtu");
+    restarted.console_run("show -ISBN=" + isbn_of(0));
+    restart_first_ns = elapsed_ns(start);
+    restarted.console_run("logout");
+    restarted.console_close();
+  }
+  std::cout.rdbuf(cout_buffer);
+  StarryPurple::tracer.stop();
+
+  std::printf("workload: %zu lines (%zu books, %zu mixed ops), seed %llu, zipf %.2f\n",
+    workload.size(), config.books, config.ops, config.seed, config.zipf);
+  std::printf("%-14s %9s %12s %10s %10s %10s\n", "command", "count", "ops/s", "p50(us)", "p99(us)", "p999(us)");
+  for(auto &[label, ns]: latencies) {
+    long long sum = 0;
+    for(const long long val: ns) sum += val;
+    std::sort(ns.begin(), ns.end());
+    std::printf("%-14s %9zu %12.0f %10.1f %10.1f %10.1f\n", label.c_str(), ns.size(),
+      sum > 0 ? ns.size() * 1e9 / sum : 0.0,
+      percentile_us(ns, 0.50), percentile_us(ns, 0.99), percentile_us(ns, 0.999));
+  }
+  std::printf("%-14s %9zu %12.0f\n", "total", workload.size(),
+    total_ns > 0 ? workload.size() * 1e9 / total_ns : 0.0);
+  std::printf("invalid lines: %zu\n", sink.invalid_count);
+  std::printf("startup: fresh open %.1f us, restart open %.1f us, then first su + show %.1f us\n\n",
+    fresh_open_ns / 1000.0, restart_open_ns / 1000.0, restart_first_ns / 1000.0);
+  std::fflush(stdout);
+  command_manager.write_stats(std::cout);
+  return sink.invalid_count == 0 ? 0 : 2;
+}
@@ -0,0 +1,351 @@
+/** storage_bench.cpp
+ * Author: StarryPurple
+ * Date: Since 2026.10.19
+ *
+ * Microbenchmarks of the storage layer, each on fresh files:
+ *   Fstream: allocate, sequential / random write, sequential / random read, on two block sizes.
+ *   Fmultimap, Insomnia::BlinkTree, BlockList: insert, lookup and erase of n pairs,
+ *     for every key type the bookstore uses (ConstStr<20 / 30 / 60>, size_t),
+ *     int and BookType values, two degrees each (Fmultimap: the one fitted to the page),
+ *     and keys drawn sequentially, uniformly (a shuffle) or Zipfian (with repeats).
+ * For every case the time per op and the blocks / bytes read and written per op are reported,
+ * from the global Fstream counters. Output is a JSON array, one object per (case, op).
+ *
+ * usage: storage_bench [--n N] [--seed N] [--zipf S] [--dir DIR] [--filter SUBSTR] [--out FILE]
+ *   --filter keeps only the cases whose name (e.g. "BlinkTree/ConstStr<20>/int/32/zipf") contains SUBSTR.
+ */
+#include "blocklist.h"
+#include "infotypes.h"
+#include "insomnia_multimap.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr size_t cBenchCapacity = 1 << 14; // vlist / node capacity of the multimaps
+
+struct BenchConfig {
+  size_t n = 2000; // pairs per case
+  unsigned long long seed = 20261019;
+  double zipf = 0.99;
+  std::string directory = "./storage_bench_data/";
+  std::string filter;
+  std::string out; // stdout if empty
+};
+
+// P(rank k) proportional to 1 / k^s, for k in [1, n]. Returns rank - 1.
+class ZipfSampler {
+public:
+  ZipfSampler(size_t n, double s) : cdf_(n) {
+    double sum = 0;
+    for(size_t k = 0; k < n; ++k) {
+      sum += 1.0 / std::pow(static_cast<double>(k + 1), s);
+      cdf_[k] = sum;
+    }
+    for(auto &val: cdf_) val /= sum;
+  }
+  template<class Rng>
+  size_t operator()(Rng &rng) {
+    const double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+    return std::min<size_t>(
+      std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin(), cdf_.size() - 1);
+  }
+private:
+  std::vector<double> cdf_;
+};
+
+// what the counters and the clock say about one phase.
+struct Sample {
+  std::string name, op;
+  size_t ops = 0;
+  long long ns = 0;
+  size_t read_count = 0, read_bytes = 0, write_count = 0, write_bytes = 0;
+  size_t found = 0; // values returned by lookups, to keep them from being optimized out
+  bool failed = false;
+};
+
+class Phase {
+public:
+  Phase(std::vector<Sample> &samples, std::string name, std::string op, size_t ops) : samples_(samples) {
+    sample_.name = std::move(name);
+    sample_.op = std::move(op);
+    sample_.ops = ops;
+    auto &counters = StarryPurple::fstream_counters;
+    read_count_ = counters.read_count.load();
+    read_bytes_ = counters.read_bytes.load();
+    write_count_ = counters.write_count.load();
+    write_bytes_ = counters.write_bytes.load();
+    start_ = std::chrono::steady_clock::now();
+  }
+  ~Phase() {
+    sample_.ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start_).count();
+    auto &counters = StarryPurple::fstream_counters;
+    sample_.read_count = counters.read_count.load() - read_count_;
+    sample_.read_bytes = counters.read_bytes.load() - read_bytes_;
+    sample_.write_count = counters.write_count.load() - write_count_;
+    sample_.write_bytes = counters.write_bytes.load() - write_bytes_;
+    samples_.push_back(std::move(sample_));
+  }
+  void found(size_t count) { sample_.found += count; }
+private:
+  std::vector<Sample> &samples_;
+  Sample sample_;
+  size_t read_count_, read_bytes_, write_count_, write_bytes_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+template<class T> const char *type_name();
+template<> const char *type_name<StarryPurple::ConstStr<20>>() { return "ConstStr<20>"; }
+template<> const char *type_name<StarryPurple::ConstStr<30>>() { return "ConstStr<30>"; }
+template<> const char *type_name<StarryPurple::ConstStr<60>>() { return "ConstStr<60>"; }
+template<> const char *type_name<size_t>() { return "size_t"; }
+template<> const char *type_name<int>() { return "int"; }
+template<> const char *type_name<BookStore::BookType>() { return "BookType"; }
+
+// keys keep the order of their ids: string keys are zero-padded.
+template<class Key>
+Key make_key(size_t id) {
+  char str[24];
+  const int len = std::snprintf(str, sizeof(str), "key%012zu", id);
+  return Key(str, len);
+}
+template<>
+size_t make_key<size_t>(size_t id) { return id; }
+
+template<class Value>
+Value make_value(size_t id) { return static_cast<Value>(id); }
+template<>
+BookStore::BookType make_value<BookStore::BookType>(size_t id) {
+  return BookStore::BookType(BookStore::ISBNType("978-" + std::to_string(id)));
+}
+
+// the key ids of the n inserts (and of the n lookups) under a distribution.
+std::vector<size_t> key_ids(const std::string &dist, const BenchConfig &config, std::mt19937_64 &rng) {
+  std::vector<size_t> ids(config.n);
+  std::iota(ids.begin(), ids.end(), 0);
+  if(dist == "uniform") {
+    std::shuffle(ids.begin(), ids.end(), rng);
+  } else if(dist == "zipf") {
+    // hot ranks are scattered over the key space, not the smallest keys.
+    std::vector<size_t> scatter = ids;
+    std::shuffle(scatter.begin(), scatter.end(), rng);
+    ZipfSampler zipf(config.n, config.zipf);
+    for(auto &id: ids) id = scatter[zipf(rng)];
+  }
+  return ids;
+}
+
+bool selected(const std::string &name, const BenchConfig &config) {
+  return config.filter.empty() || name.find(config.filter) != std::string::npos;
+}
+
+void fresh_directory(const BenchConfig &config) {
+  std::filesystem::remove_all(config.directory);
+  std::filesystem::create_directories(config.directory);
+}
+
+// ---------- Fstream ----------
+
+template<size_t size>
+struct Block {
+  char data[size];
+};
+
+template<size_t size>
+void run_fstream(const BenchConfig &config, std::vector<Sample> &samples) {
+  const std::string name = "Fstream/" + std::to_string(size);
+  if(!selected(name, config)) return;
+  fresh_directory(config);
+  using BlockFstream = StarryPurple::Fstream<Block<size>, size_t, cBenchCapacity>;
+  using BlockPtr = typename BlockFstream::fpointer;
+  const size_t n = std::min(config.n, cBenchCapacity);
+  std::mt19937_64 rng(config.seed);
+  std::vector<size_t> order(n);
+  std::iota(order.begin(), order.end(), 0);
+  std::shuffle(order.begin(), order.end(), rng);
+
+  BlockFstream fstream;
+  fstream.open(config.directory + "fstream.bsdat");
+  Block<size> block{};
+  std::vector<BlockPtr> ptrs;
+  ptrs.reserve(n);
+  {
+    Phase phase(samples, name, "allocate", n);
+    for(size_t i = 0; i < n; ++i) {
+      block.data[0] = static_cast<char>(i);
+      ptrs.push_back(fstream.allocate(block));
+    }
+  }
+  {
+    Phase phase(samples, name, "write_seq", n);
+    for(size_t i = 0; i < n; ++i) {
+      block.data[0] = static_cast<char>(i + 1);
+      fstream.write(block, ptrs[i]);
+    }
+  }
+  {
+    Phase phase(samples, name, "write_random", n);
+    for(const size_t i: order) {
+      block.data[0] = static_cast<char>(i + 2);
+      fstream.write(block, ptrs[i]);
+    }
+  }
+  {
+    Phase phase(samples, name, "read_seq", n);
+    for(size_t i = 0; i < n; ++i) {
+      fstream.read(block, ptrs[i]);
+      phase.found(block.data[0] != 0);
+    }
+  }
+  {
+    Phase phase(samples, name, "read_random", n);
+    for(const size_t i: order) {
+      fstream.read(block, ptrs[i]);
+      phase.found(block.data[0] != 0);
+    }
+  }
+  fstream.close();
+}
+
+// ---------- multimaps ----------
+
+// insert n pairs, look up n keys, then erase every pair, all in the order of the distribution.
+template<class Map, class Key, class Value>
+void run_map(const char *engine, size_t degree, const BenchConfig &config, std::vector<Sample> &samples) {
+  for(const std::string dist: {"seq", "uniform", "zipf"}) {
+    const std::string name = std::string(engine) + "/" + type_name<Key>() + "/" + type_name<Value>()
+      + "/" + std::to_string(degree) + "/" + dist;
+    if(!selected(name, config)) continue;
+    fresh_directory(config);
+    std::mt19937_64 rng(config.seed);
+    const std::vector<size_t> insert_ids = key_ids(dist, config, rng);
+    const std::vector<size_t> lookup_ids = key_ids(dist, config, rng);
+    std::vector<Key> keys;
+    std::vector<Value> values;
+    for(size_t i = 0; i < config.n; ++i) {
+      keys.push_back(make_key<Key>(insert_ids[i]));
+      values.push_back(make_value<Value>(i)); // unique, so repeated keys are still distinct pairs
+    }
+
+    Map map;
+    map.open(config.directory + "map");
+    // a failing engine (the old BlockList can't take everything) fails its case, not the whole run.
+    // The phase it failed in is still recorded, marked failed.
+    try {
+      {
+        Phase phase(samples, name, "insert", config.n);
+        for(size_t i = 0; i < config.n; ++i)
+          map.insert(keys[i], values[i]);
+      }
+      {
+        Phase phase(samples, name, "lookup", config.n);
+        for(const size_t id: lookup_ids)
+          phase.found(map[make_key<Key>(id)].size());
+      }
+      {
+        Phase phase(samples, name, "erase", config.n);
+        for(size_t i = 0; i < config.n; ++i)
+          map.erase(keys[i], values[i]);
+      }
+    } catch(const StarryPurple::FileExceptions &e) {
+      samples.back().failed = true;
+      std::fprintf(stderr, "storage_bench: %s: %s\n", name.c_str(), e.what());
+    }
+  }
+}
+
+template<class Key, class Value>
+void run_key_value(const BenchConfig &config, std::vector<Sample> &samples) {
+  // Fmultimap sizes its nodes by the page. Its inner degree goes in the name.
+  using Multimap = StarryPurple::Fmultimap<Key, Value, cBenchCapacity>;
+  run_map<Multimap, Key, Value>("Fmultimap", Multimap::cInnerDegree, config, samples);
+  run_map<Insomnia::BlinkTree<Key, Value, 16, cBenchCapacity>, Key, Value>("BlinkTree", 16, config, samples);
+  run_map<Insomnia::BlinkTree<Key, Value, 32, cBenchCapacity>, Key, Value>("BlinkTree", 32, config, samples);
+  // BlockList holds about degree^2 pairs, so its degrees are larger.
+  run_map<StarryPurple::BlockList<Key, Value, 64>, Key, Value>("BlockList", 64, config, samples);
+  run_map<StarryPurple::BlockList<Key, Value, 128>, Key, Value>("BlockList", 128, config, samples);
+}
+
+// ---------- output ----------
+
+void write_json(std::FILE *file, const std::vector<Sample> &samples) {
+  std::fprintf(file, "[\n");
+  for(size_t i = 0; i < samples.size(); ++i) {
+    const Sample &sample = samples[i];
+    const double ops = sample.ops > 0 ? static_cast<double>(sample.ops) : 1.0;
+    std::fprintf(file,
+      "  {\"name\": \"%s\", \"op\": \"%s\", \"ops\": %zu, \"ns_per_op\": %.1f,"
+      " \"reads_per_op\": %.3f, \"read_bytes_per_op\": %.1f,"
+      " \"writes_per_op\": %.3f, \"write_bytes_per_op\": %.1f, \"found\": %zu, \"failed\": %s}%s\n",
+      sample.name.c_str(), sample.op.c_str(), sample.ops, sample.ns / ops,
+      sample.read_count / ops, sample.read_bytes / ops,
+      sample.write_count / ops, sample.write_bytes / ops, sample.found, sample.failed ? "true" : "false",
+      i + 1 < samples.size() ? "," : "");
+  }
+  std::fprintf(file, "]\n");
+}
+
+bool parse_args(int argc, char *argv[], BenchConfig &config) {
+  for(int i = 1; i < argc; ++i) {
+    if(i + 1 >= argc) return false;
+    const std::string key = argv[i], value = argv[++i];
+    if(key == "--n") config.n = std::stoull(value);
+    else if(key == "--seed") config.seed = std::stoull(value);
+    else if(key == "--zipf") config.zipf = std::stod(value);
+    else if(key == "--dir") config.directory = value;
+    else if(key == "--filter") config.filter = value;
+    else if(key == "--out") config.out = value;
+    else return false;
+  }
+  if(config.n == 0) return false;
+  if(config.directory.back() != '/') config.directory += '/';
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  BenchConfig config;
+  if(!parse_args(argc, argv, config)) {
+    std::fprintf(stderr,
+      "usage: storage_bench [--n N] [--seed N] [--zipf S] [--dir DIR] [--filter SUBSTR] [--out FILE]\n");
+    return 1;
+  }
+  using StarryPurple::ConstStr;
+  using BookStore::BookType;
+  std::vector<Sample> samples;
+  try {
+    run_fstream<64>(config, samples);
+    run_fstream<4096>(config, samples);
+    run_key_value<ConstStr<20>, int>(config, samples);
+    run_key_value<ConstStr<30>, int>(config, samples);
+    run_key_value<ConstStr<60>, int>(config, samples);
+    run_key_value<size_t, int>(config, samples);
+    run_key_value<ConstStr<20>, BookType>(config, samples);
+    run_key_value<ConstStr<30>, BookType>(config, samples);
+    run_key_value<ConstStr<60>, BookType>(config, samples);
+    run_key_value<size_t, BookType>(config, samples);
+  } catch(...) {
+    std::fprintf(stderr, "storage_bench: a storage engine failed\n");
+    return 2;
+  }
+  std::filesystem::remove_all(config.directory);
+
+  std::FILE *file = config.out.empty() ? stdout : std::fopen(config.out.c_str(), "w");
+  if(file == nullptr) {
+    std::fprintf(stderr, "storage_bench: cannot open %s\n", config.out.c_str());
+    return 1;
+  }
+  write_json(file, samples);
+  if(file != stdout) std::fclose(file);
+  return 0;
+}
@@ -0,0 +1,127 @@
+/** change_log.h
+ * Author: StarryPurple
+ * Date: Since 2026.10.19
+ *
+ * Log shipping for a hot standby.
+ *
+ * ChangeLog (global object change_log): every write the data files get, in order, for a standby to follow.
+ *   A record is "these bytes at this offset of this file", the file given by its name without directory.
+ *   Records are kept in memory till commit(), which appends them and a commit mark to the ship file
+ *   (a regular file or a named pipe) in one go.
+ *   A block written again in the same batch only ships its last version: the earlier record is dropped,
+ *   as the later one, coming after everything in between, covers it anyway.
+ *   The primary only commits when the data files are consistent on their own (headers written),
+ *   so the writes between two marks take the files from one consistent state to the next.
+ *   While it's off, record() costs one relaxed atomic load.
+ *
+ * ChangeLogReader: the standby side. It tails the ship file and hands out whole batches only,
+ *   and applies a batch to the files in its own data directory.
+ *
+ * CommitJournal: makes a commit that writes many files all-or-nothing ("commit" of a transaction).
+ *   What the commit is going to write is recorded first, and written to the journal file
+ *   with a commit mark and fsynced: from then on the commit holds.
+ *   Then the data files are written and fsynced, and the journal is removed.
+ *   A whole journal found at startup is a commit cut short after that point. recover() writes it
+ *   into the files again before they're opened (writing the same bytes twice is harmless).
+ *   One without its mark was cut short before, with the files untouched, and is just dropped.
+ *
+ * format of a record (the journal has the same):
+ *   name length (uint32_t), name, offset (uint64_t), size (uint32_t), bytes.
+ *   A commit mark is a record with name length 0 and nothing after it.
+ */
+#ifndef CHANGE_LOG_H
+#define CHANGE_LOG_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace StarryPurple {
+
+class ChangeLog {
+public:
+  ~ChangeLog();
+  // ship to @path from now on, appending to it. A named pipe waits here for its reader.
+  // return false if it can't be opened.
+  bool start(const std::string &path);
+  void stop();
+  bool is_enabled() const {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+  // @filename may have a directory. Only its name is shipped.
+  void record(const std::string &filename, uint64_t offset, const void *data, size_t size);
+  // whether anything is recorded since the last commit().
+  bool has_pending() const;
+  // write out what's recorded, then a commit mark.
+  // If the ship file can't be written (the standby is gone), shipping stops; the primary goes on.
+  void commit();
+
+private:
+  struct EntryType {
+    size_t begin, end; // in buffer_
+    bool is_live;
+  };
+  std::atomic<bool> enabled_{false};
+  mutable std::mutex latch_; // guards all below
+  std::string buffer_;
+  std::vector<EntryType> entries_;
+  // {file, offset, size} -> the last record of it in entries_
+  std::map<std::tuple<std::string, uint64_t, uint32_t>, size_t> latest_;
+  int fd_ = -1;
+};
+
+inline ChangeLog change_log;
+
+class ChangeLogReader {
+public:
+  struct RecordType {
+    std::string filename;
+    uint64_t offset;
+    std::string data;
+  };
+  ~ChangeLogReader();
+  // start reading @path at byte @position (where an earlier run stopped).
+  bool open(const std::string &path, uint64_t position);
+  void close();
+  bool is_open() const {
+    return fd_ >= 0;
+  }
+  // read what's there now. If a whole batch has come, move it into @batch and return true.
+  bool read_batch(std::vector<RecordType> &batch);
+  // how far the batches handed out reach in the ship file.
+  uint64_t position() const {
+    return position_;
+  }
+  // write the batch into the files of the same names in @directory (ending with '/'), and fsync them.
+  static void apply(const std::string &directory, const std::vector<RecordType> &batch);
+
+private:
+  int fd_ = -1;
+  std::string buffer_; // read but not handed out yet
+  uint64_t position_ = 0; // of the beginning of buffer_
+};
+
+class CommitJournal {
+public:
+  // @filename may have a directory. Only its name is kept: the journal lies beside the files.
+  void record(const std::string &filename, uint64_t offset, const void *data, size_t size);
+  // write what's recorded and a commit mark to @path, and fsync it (and its directory).
+  // return false if that fails. Then the files are untouched, and the commit should be dropped.
+  bool write(const std::string &path) const;
+  // the commit is all in the files, synced. Remove the journal, for good before anything else is written:
+  // replayed later, it would write old bytes over newer ones.
+  static void remove(const std::string &path);
+  // finish the commit of the journal at @path, if it's whole, into the files beside it. Then remove it.
+  static void recover(const std::string &path);
+
+private:
+  std::string buffer_;
+};
+
+} // namespace StarryPurple
+
+#endif // CHANGE_LOG_H
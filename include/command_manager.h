@@ -1,18 +1,45 @@
 #ifndef COMMAND_MANAGER_H
 #define COMMAND_MANAGER_H
 
+#include "change_log.h"
 #include "info_manager.h"
+#include "profiler.h"
+#include "ring_buffer.h"
 
-#include <regex>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
 
 namespace BookStore {
 
 class CommandManager;
 
+// when stdin isn't a terminal, output is flushed once it grows past this, not per command.
+constexpr size_t cOutputFlushSize = 1 << 16;
+// the longest command ("modify" with all five keys) has 6 words.
+constexpr size_t cMaxArgc = 8;
+constexpr size_t cBatchQueueCapacity = 1 << 12;
+constexpr size_t cServerWorkerCount = 8; // connections served at the same time
+constexpr size_t cServerReadSize = 1 << 12;
+constexpr int cServerBacklog = 64;
+constexpr int cServerPollInterval = 200; // ms between checks for a stop signal
+constexpr int cTransactionIdleTimeout = 5000; // ms a server client may sit in a transaction without a command
+constexpr int cShipInterval = 100; // ms between batches of the change log, if anything's changed
+constexpr int cStandbyPollInterval = 100; // ms between looks at the ship file by a standby
+constexpr size_t cBestsellerCount = 10; // "report bestsellers" with no count
+
 class CommandManager {
-  using ArglistType = std::vector<std::string>;
+  // tokens are views into the command line, valid until the next line is read.
+  using ArglistType = std::vector<std::string_view>;
 private:
-  const std::string
+  const StarryPurple::Charset
     ascii_no_double_quotaton_alphabet =
       "!#$%&'()*+,-./"
        "0123456789:;<=>?"
@@ -36,38 +63,116 @@ private:
     user_priviledge_alphabet = "137", // [Privilege]
     digit_alphabet = "0123456789", // [Quantity], [Count]
     digit_with_dot_alphabet = ".0123456789"; // [Price] [TotalCost]
-  const std::regex
-    ISBN_aug_regex{"^-ISBN=([\\x20-\\x7E]+)$"},
-    bookname_aug_regex{"^-name=\"([\\x20-\\x7E]+)\"$"}, // '\"' should be excluded before it is used
-    author_aug_regex{"^-author=\"([\\x20-\\x7E]+)\"$"},
-    keyword_aug_regex{"^-keyword=\"([\\x20-\\x7E]+)\"$"},
-    price_aug_regex{"^-price=([\\x20-\\x7E]+)$"};
+  // the key of "-[Key]=[Value]" arguments.
+  enum class AugKeyType {
+    ISBN, bookname, author, keyword, price, since, until
+  };
+  // which command a line names, told from its first one or two words alone.
+  enum class CommandType : unsigned char {
+    invalid, quit, login, logout, user_register, change_password, user_add, user_unregister,
+    list_book, show_finance, show_history, sellout, select_book, modify_book, restock, import_catalog,
+    show_log, show_report, backup, transaction_begin, transaction_commit, transaction_abort
+  };
+  static constexpr size_t cCommandTypeCount = static_cast<size_t>(CommandType::transaction_abort) + 1;
+  // a split and classified line, handed from the batch parser thread to the executor.
+  struct CommandRecord {
+    CommandType type = CommandType::invalid;
+    bool is_end = false; // no more lines after this
+    size_t argc = 0;
+    std::string_view argv[cMaxArgc];
+  };
   UserManager user_manager;
   BookManager book_manager;
   LogManager log_manager;
+  // the session of std::cin / std::cout (or the batch file).
+  SessionType console_session{std::cout};
+  // every live session, the console included. Changed with database_mutex held exclusively.
+  std::set<SessionType *> sessions;
+  // "show", "buy" and "import" hold it shared, so they run side by side:
+  // the latter two change a single book, under the latch of its shard in BookDatabase.
+  // The others hold it exclusively.
+  std::shared_mutex database_mutex;
+  ArglistType console_argv; // for console_run
+  std::atomic<bool> is_backing_up{false}; // one "backup" at a time
+  // Log shipping (see change_log.h).
+  // On the primary (change_log on), the shipper commits a batch every cShipInterval if anything's written,
+  // with database_mutex held exclusively and every header written, so that the batch ends consistent.
+  // A standby follows the ship file instead: it closes its databases, applies the whole batches come,
+  // and opens them again, all under database_mutex. It answers only the commands that read.
+  std::thread shipper, standby_follower;
+  std::mutex background_mutex;
+  std::condition_variable background_cv;
+  bool is_background_stopping = false;
+  bool is_standby = false;
+  std::string standby_ship_path, standby_directory, standby_prefix;
+  // "commit" writes the user and book files all-or-nothing through it (see CommitJournal).
+  std::string journal_path;
+  // in server mode, the data directory. The files clients name are taken inside it (see client_path).
+  std::string client_directory;
+  // per command type: latency through the executor (waiting for the lock included),
+  // and how many ran fine / were answered "Invalid".
+  StarryPurple::LatencyHistogram command_latency[cCommandTypeCount];
+  std::atomic<uint64_t> accepted_count[cCommandTypeCount]{}, rejected_count[cCommandTypeCount]{};
 
   void open(const std::string &prefix);
   void close();
+  void shipper_loop();
+  void ship_checkpoint();
+  void standby_loop();
+  // the commands a standby answers. None of them changes the data or adds a log.
+  static bool is_standby_command(CommandType type);
 
-  ArglistType command_splitter(const std::string &command);
+  // split the command by blanks in one pass, into argv.
+  void command_splitter(std::string_view command, ArglistType &argv);
+  // parse "-[Key]=[Value]", or "-[Key]="[Value]"" for bookname, author and keyword.
+  // value is set to the non-empty printable [Value] without quotes.
+  // return false if it's not well-formed.
+  bool aug_parser(std::string_view arg, AugKeyType &key, std::string_view &value);
+  bool timestamp_parser(std::string_view str, TimestampType &timestamp);
+  // quit / exit with extra words is already invalid here.
+  CommandType command_classifier(const ArglistType &argv);
+  // whether the command runs with database_mutex shared, side by side with others.
+  static bool is_lock_shared(CommandType type);
+  static const char *command_name(CommandType type);
+  // the file a command names ("import-catalog", "backup"). A server client can't reach out of the data directory:
+  // the path must be relative, with no "..", and is taken from client_directory. Otherwise it's as given.
+  // return false if it's refused.
+  bool client_path(std::string_view path, std::string &resolved) const;
+  // run a classified command for the session, and print "Invalid" if it fails.
+  void command_executor(SessionType &session, CommandType type, const ArglistType &argv);
+  // serve one client connection of the server until it quits or hangs up.
+  void command_session_reader(int fd);
 
   // Only checks if command is grammatically correct.
   // Whether the params fits other requirements are confirmed by other managers.
+  // Return false if the command is invalid. Nothing throws for an invalid command.
 
-  void command_login(const ArglistType &argv); // command "su"
-  void command_logout(const ArglistType &argv); // command "logout"
-  void command_user_register(const ArglistType &argv); // command "register"
-  void command_change_password(const ArglistType &argv); // command "passwd"
-  void command_user_add(const ArglistType &argv); // command "useradd"
-  void command_user_unregister(const ArglistType &argv); // command "delete"
-  void command_list_book(const ArglistType &argv); // command "show", not "show finance"
-  void command_show_finance(const ArglistType &argv); // command "show finance"
-  void command_sellout(const ArglistType &argv); // command "buy"
-  void command_select_book(const ArglistType &argv); // command "select"
-  void command_modify_book(const ArglistType &argv); // command "modify"
-  void command_restock(const ArglistType &argv); // command "import"
-  void command_show_log(const ArglistType &argv); // command "log"
-  void command_show_report(const ArglistType &argv); // command "report finance" "report employee"
+  bool command_login(SessionType &session, const ArglistType &argv); // command "su"
+  bool command_logout(SessionType &session, const ArglistType &argv); // command "logout"
+  bool command_user_register(SessionType &session, const ArglistType &argv); // command "register"
+  bool command_change_password(SessionType &session, const ArglistType &argv); // command "passwd"
+  bool command_user_add(SessionType &session, const ArglistType &argv); // command "useradd"
+  bool command_user_unregister(SessionType &session, const ArglistType &argv); // command "delete"
+  bool command_list_book(SessionType &session, const ArglistType &argv); // command "show", not "show finance"
+  bool command_show_finance(SessionType &session, const ArglistType &argv); // command "show finance", also with -since / -until
+  bool command_sellout(SessionType &session, const ArglistType &argv); // command "buy"
+  bool command_select_book(SessionType &session, const ArglistType &argv); // command "select"
+  bool command_modify_book(SessionType &session, const ArglistType &argv); // command "modify"
+  bool command_restock(SessionType &session, const ArglistType &argv); // command "import"
+  bool command_import_catalog(SessionType &session, const ArglistType &argv); // command "import-catalog"
+  bool command_show_log(SessionType &session, const ArglistType &argv); // command "log"
+  bool command_show_report(SessionType &session, const ArglistType &argv); // command "report finance" "report employee" "report bestsellers" "report sales"
+  bool command_show_history(SessionType &session, const ArglistType &argv); // command "show history"
+  bool command_backup(SessionType &session, const ArglistType &argv); // command "backup"
+  bool command_begin(SessionType &session, const ArglistType &argv); // command "begin"
+  bool command_commit(SessionType &session, const ArglistType &argv); // command "commit"
+  bool command_abort(SessionType &session, const ArglistType &argv); // command "abort"
+  // drop everything the session's transaction has done.
+  void transaction_abort(SessionType &session);
+  // add the log now, or at commit if the session is in a transaction.
+  void add_log(SessionType &session, const LogType &log, int log_level);
+  // startup and shutdown logs. Like every log, added under the database lock, so a checkpoint never races it.
+  void add_system_log(LogOpcode opcode);
   bool is_running = false;
 public:
   CommandManager() = default;
@@ -76,6 +181,37 @@ public:
   // @directory should end with '/', for example "./data/".
   // if not assigned, directory = "./", means the data will be stored in you current directory.
   void command_list_reader(const std::string &prefix, const std::string &directory = "./");
+  // same as command_list_reader, with commands from the file @input_path instead of std::cin.
+  // A parser thread splits and classifies lines ahead while this thread executes them in order.
+  // The output is exactly what command_list_reader prints for the same input.
+  void command_batch_reader(const std::string &input_path,
+    const std::string &prefix, const std::string &directory = "./");
+  // Line by line use of the console session, for embedding and benchmarks.
+  // console_open() starts the system like command_list_reader does, and console_close() stops it.
+  void console_open(const std::string &prefix, const std::string &directory = "./");
+  // run one command line. Return false if it's "quit" / "exit".
+  // Output is buffered and goes to std::cout once it's large, or at console_close().
+  bool console_run(std::string_view line);
+  void console_close();
+  // serve clients over the Unix domain socket @socket_path until SIGINT / SIGTERM.
+  // Each connection is a session of its own (login stack, selected books, output),
+  // served by one of @worker_count workers over the shared databases.
+  // Clients send command lines and get back what command_list_reader would print.
+  // A transaction left without a command for cTransactionIdleTimeout is aborted, releasing the database.
+  void command_server(const std::string &socket_path,
+    const std::string &prefix, const std::string &directory = "./",
+    size_t worker_count = cServerWorkerCount);
+  // a hot standby of a primary started with log shipping to @ship_path (see StarryPurple::change_log).
+  // It starts from a copy of the primary's files (e.g. by "backup") taken when shipping started,
+  // in its own @directory with the same @prefix, follows the shipped changes,
+  // and serves "su", "logout", "show", "show finance", "show history", "report" and "log" like command_server.
+  // Where it is in the ship file is kept in "${prefix}_standby_position", so it picks up from there.
+  void command_standby(const std::string &ship_path, const std::string &socket_path,
+    const std::string &prefix, const std::string &directory = "./",
+    size_t worker_count = cServerWorkerCount);
+  // a table of every command type run so far: accepted / rejected counts, latency percentiles in us.
+  // Spans for the trace are recorded separately, by StarryPurple::tracer.
+  void write_stats(std::ostream &os) const;
 };
 }
 
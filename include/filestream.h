@@ -16,26 +16,62 @@
  * structure of Fstream-related files:
  * 1. Reserved information space: InfoType
  *        Store some extra information that may be needed. Exactly one InfoType object.
- * 1. Last recently used sign: size_t
+ * 1. Last recently used sign: offsetType
  *        the last visited storage location.
  * 2. A bitmap for storage usage: bool [cCapacity]
  *        A boolean sign is true if and only if correlated storage has been occupied.
+ *        Read by open() and written by close() in one piece.
  * 3. The storage body: StorageType [cCapacity]
- *        Where these data are stored.
+ *        Where these data are stored. It begins on a page boundary (cPageSize), and every block
+ *        takes cBlockSize bytes: whole pages, or a power-of-two part of a page for a small StorageType.
+ *        So a block never straddles two pages, and reading one reads exactly the pages it's in.
  *
  * The whole size of the file is determined since its creation by StorageType and cElementCount.
  * as we'll initialize it with empty StorageTypes.
+ *
+ * Between begin() and commit() / abort(), writes (and allocation) only happen in memory.
+ * commit() writes all the changed blocks in one pass in offset order, with the header,
+ * and abort() drops them and restores the bitmap. commit() fsyncs, and prepare_commit() records the same
+ * writes into a CommitJournal first (change_log.h), for commits over many files.
+ *
+ * Between snapshot_begin() and snapshot_end(), a block is copied into memory the first time
+ * it's written over in the file (copy-on-write), so snapshot_write() can still write the file out
+ * as it was at snapshot_begin(), while the Fstream goes on being used.
+ *
+ * Every write to the file goes through put(), which also records it into change_log (change_log.h)
+ * when log shipping is on. Outside transactions the header is only written by close(),
+ * so checkpoint() writes what's changed of it, to leave the file consistent on its own.
+ *
+ * Chains of blocks (the value lists of Fmultimap) are read one block at a time, each read waiting
+ * for the pointer to the next. prefetch() asks the kernel to read a run of blocks in the background
+ * (posix_fadvise WILLNEED), and allocate() with a hint puts the new block right after its predecessor
+ * when there's room, so that the run prefetched is mostly the chain itself.
+ *
+ * Every operation holds a latch of the Fstream, so that threads can share one.
+ * It keeps the seek-then-read pairs whole. It's not a transaction:
+ * callers still need their own lock to keep a multi-block structure consistent.
  */
 #ifndef FILE_STREAM_H
 #define FILE_STREAM_H
 
 #include "bookstore_exceptions.h"
+#include "change_log.h"
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <fstream>
 #include <cassert>
 #include <cstring>
+#include <filesystem>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 namespace StarryPurple {
 
@@ -43,6 +79,27 @@ using offsetType = int;
 using filenameType = std::string;
 constexpr size_t cMaxFileSize = 1 << 22; // 32 MB
 constexpr size_t cCapacity = 1 << 14; // 16384, > 10000
+constexpr size_t cSnapshotChunkSize = 1 << 20; // bytes read and written at a time by snapshot_write
+constexpr size_t cAllocateNearDistance = 64; // how far after the hint allocate() looks for a free block
+constexpr size_t cPageSize = 4096; // what the disk and the page cache read and write by
+
+// the bytes a block of @size bytes takes in a file:
+// whole pages, or the power-of-two part of a page that holds it, so that it never straddles a page.
+constexpr size_t block_size_of(size_t size, size_t page_size = cPageSize) {
+  return size > page_size ? (size + page_size - 1) / page_size * page_size : std::bit_ceil(size);
+}
+
+// where the snapshot of a file goes: a file of the same name in @directory.
+inline std::string snapshot_filename(const std::string &directory, const std::string &filename) {
+  return (std::filesystem::path(directory) / std::filesystem::path(filename).filename()).string();
+}
+
+// I/O of all Fstreams together, for benchmarks.
+// Only the blocks that really go to / come from the file are counted.
+struct FstreamCounters {
+  std::atomic<size_t> read_count{0}, read_bytes{0}, write_count{0}, write_bytes{0};
+};
+inline FstreamCounters fstream_counters;
 
 template<class StorageType, class InfoType, size_t capacity>
 class Fstream;
@@ -78,6 +135,8 @@ class Fstream {
 public:
 
   using fpointer = Fpointer<capacity>;
+  static constexpr size_t cStorageSize = sizeof(StorageType);
+  static constexpr size_t cBlockSize = block_size_of(cStorageSize); // a block in the file, see above
 
   Fstream() = default;
   ~Fstream();
@@ -92,6 +151,9 @@ public:
   fpointer allocate();
   // allocate a storage block and initial it with an empty one.
   fpointer allocate(const StorageType &data);
+  // allocate a block for data that comes after @hint in a chain:
+  // the first free one in the next cAllocateNearDistance blocks, or anywhere as the above.
+  fpointer allocate(const StorageType &data, const fpointer &hint);
   // free the storage block.
   void free(const fpointer &ptr);
 
@@ -99,21 +161,80 @@ public:
   void write(const StorageType &data, const fpointer &ptr);
   // read an object from the assigned location.
   void read(StorageType &data, const fpointer &ptr);
+  // start reading blocks [ptr, ptr + count) into the page cache in the background. Never waits.
+  void prefetch(const fpointer &ptr, size_t count);
 
   // write the info.
   void write_info(const InfoType &info);
   // read the info.
   void read_info(InfoType &info);
 
+  // start keeping writes in memory.
+  void begin();
+  // record what commit() is going to write into @journal. In a transaction.
+  void prepare_commit(CommitJournal &journal);
+  // write what's kept since begin() into the file, and sync it if anything changed.
+  void commit();
+  // forget what's done since begin().
+  void abort();
+
+  // keep the file as it is now for snapshot_write(). Not in a transaction.
+  void snapshot_begin();
+  // write the snapshot into @directory, front to back.
+  // The latch is only held to patch in the blocks written over since, so others go on meanwhile.
+  void snapshot_write(const std::string &directory);
+  // drop the copied blocks.
+  void snapshot_end();
+
+  // write the header changed since it was last written. Not in a transaction.
+  void checkpoint();
+
 private:
-  const size_t cStorageSize = sizeof(StorageType);
-  const size_t cExtraInfoSize = sizeof(InfoType);
-  const size_t cInfoSize = cExtraInfoSize + sizeof(size_t) + sizeof(bool) * capacity;
-  const size_t cFileSize = cInfoSize + cStorageSize * capacity;
+  // the header as written: extra_info_, lru_loc_, then bitmap_.
+  static constexpr size_t cExtraInfoSize = sizeof(InfoType);
+  static constexpr size_t cLruOffset = cExtraInfoSize;
+  static constexpr size_t cBitmapOffset = cLruOffset + sizeof(offsetType);
+  static constexpr size_t cInfoSize = cBitmapOffset + sizeof(bool) * capacity;
+  static constexpr size_t cBodyOffset = (cInfoSize + cPageSize - 1) / cPageSize * cPageSize;
+  static_assert(cBodyOffset % alignof(StorageType) == 0 && cBlockSize % alignof(StorageType) == 0,
+    "every block must be aligned for StorageType");
+  static_assert(cBlockSize % cPageSize == 0 || cPageSize % cBlockSize == 0, "a block must not straddle pages");
+  // where the block at @offset begins in the file.
+  static constexpr size_t block_pos(offsetType offset) {
+    return cBodyOffset + cBlockSize * offset;
+  }
+  // whether the block at @offset is used in the snapshot.
+  bool is_snapshot_used(offsetType offset) const {
+    return snapshot_header_[cBitmapOffset + offset] != 0;
+  }
+  // find a free block from lru_loc_ on, wrapping around. With the latch held.
+  offsetType find_free();
+  // write a block with the latch already held.
+  void write_block(const StorageType &data, offsetType offset);
+  // write into the file at @pos, and into change_log. With the latch held.
+  void put(size_t pos, const void *data, size_t size);
+  // a bit of the bitmap changed outside transactions.
+  void mark_unsaved(offsetType offset);
+  // whether the transaction wrote anything. With the latch held.
+  bool is_changed() const;
+
+  std::mutex latch_;
+  bool in_transaction_ = false;
+  std::map<offsetType, StorageType> dirty_; // blocks written in the transaction
+  std::vector<offsetType> bitmap_changed_; // blocks allocated or freed in the transaction
+  bool in_snapshot_ = false;
+  std::vector<char> snapshot_header_; // the header at snapshot_begin() as it goes into the file, padding included
+  std::map<offsetType, StorageType> snapshot_blocks_; // what was in the blocks written over since
+  bool is_header_unsaved_ = false; // the header changed outside transactions since it was written
+  std::vector<offsetType> unsaved_bitmap_; // and these bits of the bitmap
+  bool is_bitmap_unsaved_ = false; // or too many bits for the list: the whole bitmap
+  InfoType saved_extra_info_;
+  offsetType saved_lru_loc_ = 0;
   InfoType extra_info_;
   offsetType lru_loc_ = 0;
   bool bitmap_[capacity]{};
   std::fstream file_{};
+  int advise_fd_ = -1; // the same file, for posix_fadvise and fdatasync
   std::string filename_;
 
 };
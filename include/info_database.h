@@ -2,8 +2,16 @@
 #define INFO_DATABASE_H
 
 #include "infotypes.h"
+#include "logstream.h"
+#include "thread_pool.h"
 
+#include <array>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <set>
+#include <shared_mutex>
 #include <string>
 
 namespace BookStore {
@@ -27,14 +35,16 @@ class LogDatabase;
 class LoggedUserType {
   friend UserStack;
   friend BookManager;
+  friend LogManager; // for "show history"
+  friend UserManager; // for "logout"
 private:
   UserInfoType user_id, username;
   UserPrivilege privilege;
   ISBNType ISBN_selected{};
   bool has_selected_book = false;
 public:
-  // "Client/Staff/Keeper ${usernane} (user id: ${user_id})"
-  std::string user_identity_str() const;
+  // who the user is, to be recorded in logs.
+  LogUserType log_identity() const;
   LoggedUserType() = default;
   LoggedUserType(const UserType &user);
 };
@@ -50,7 +60,6 @@ private:
   // In fact, it's a std::vector.
   // Uh, so that we don't need a file to store information.
   std::vector<LoggedUserType> u_stack;
-  std::set<UserInfoType> logged_set;
   LoggedUserType &active_user();
   const UserPrivilege active_privilege();
   void open(const std::string &prefix);
@@ -70,51 +79,213 @@ class UserDatabase {
   friend UserManager; // command "useradd" "register" "delete"
 private:
   bool is_open = false;
-  StarryPurple::Fmultimap<UserInfoType, UserType, 30, cMaxFlowSize> user_id_map;
+  StarryPurple::Fmultimap<UserInfoType, UserType, cMaxFlowSize> user_id_map;
   void open(const std::string &prefix);
   void close();
   void user_register(const UserType &user);
   void user_unregister(const UserType &user); // command "delete [userID]"
+  // transaction of "begin" ... "commit" / "abort".
+  void begin();
+  void prepare_commit(StarryPurple::CommitJournal &journal);
+  void commit();
+  void abort();
+  // command "backup". See Fstream for the snapshots.
+  void snapshot_begin();
+  void snapshot_write(const std::string &directory);
+  void snapshot_end();
+  // log shipping: leave the files consistent on their own.
+  void checkpoint();
 public:
   UserDatabase() = default;
   ~UserDatabase();
 };
 
+constexpr size_t cIndexWorkerCount = 4; // with the calling thread, one per book index
+constexpr size_t cBookShardCount = 8; // 200k books keep each shard's ISBN index well within cMaxFlowSize
+constexpr size_t cSalesDayCount = 30; // "report sales" shows the sales of this many latest days
+
 // book id is the order it's added.
+// Books are split into cBookShardCount shards by a hash of the ISBN, each with its own index files.
+// A shard has its own latch, so "buy" / "import" on books of different shards don't wait for each other.
+// Queries over every shard ("show" by name, author, keyword, or all) merge the sorted results of each.
+// Sales of every book ever sold are counted on "buy", in the files of its shard,
+// keyed by ISBN and again by units sold, so that "report bestsellers" reads just the top of each shard.
 class BookDatabase {
   friend BookManager; // command "select"
+  // what a book has sold in all. Ordered by ISBN alone: there's one for a book.
+  struct SalesType {
+    ISBNType isbn;
+    QuantityType quantity = 0;
+    PriceType income = 0;
+    TimestampType day = 0; // of the last sale, as the local midnight beginning it
+    QuantityType day_quantity = 0; // sold in that day
+    bool operator==(const SalesType &other) const { return isbn == other.isbn; }
+    bool operator!=(const SalesType &other) const { return isbn != other.isbn; }
+    bool operator<(const SalesType &other) const { return isbn < other.isbn; }
+    bool operator>(const SalesType &other) const { return isbn > other.isbn; }
+    bool operator<=(const SalesType &other) const { return isbn <= other.isbn; }
+    bool operator>=(const SalesType &other) const { return isbn >= other.isbn; }
+  };
+  // what a book has sold in one day. Ordered by day alone.
+  struct DaySalesType {
+    TimestampType day = 0;
+    QuantityType quantity = 0;
+    bool operator==(const DaySalesType &other) const { return day == other.day; }
+    bool operator!=(const DaySalesType &other) const { return day != other.day; }
+    bool operator<(const DaySalesType &other) const { return day < other.day; }
+    bool operator>(const DaySalesType &other) const { return day > other.day; }
+    bool operator<=(const DaySalesType &other) const { return day <= other.day; }
+    bool operator>=(const DaySalesType &other) const { return day >= other.day; }
+  };
+  // where a book stands among the bestsellers: the more sold the earlier, ties by ISBN.
+  struct BestsellerKeyType {
+    QuantityType neg_quantity = 0; // -quantity, so that the best come first
+    ISBNType isbn;
+    bool operator==(const BestsellerKeyType &other) const {
+      return neg_quantity == other.neg_quantity && isbn == other.isbn;
+    }
+    bool operator!=(const BestsellerKeyType &other) const { return !(*this == other); }
+    bool operator<(const BestsellerKeyType &other) const {
+      return neg_quantity != other.neg_quantity ? neg_quantity < other.neg_quantity : isbn < other.isbn;
+    }
+    bool operator>(const BestsellerKeyType &other) const { return other < *this; }
+    bool operator<=(const BestsellerKeyType &other) const { return !(other < *this); }
+    bool operator>=(const BestsellerKeyType &other) const { return !(*this < other); }
+  };
+  static BestsellerKeyType bestseller_key(const SalesType &book_sales) {
+    return BestsellerKeyType{-book_sales.quantity, book_sales.isbn};
+  }
+  struct BookShardType {
+    StarryPurple::Fmultimap<size_t, BookType, cMaxFlowSize> book_map; // maps 0 to all books of the shard
+    StarryPurple::Fmultimap<ISBNType, BookType, cMaxFlowSize> ISBN_map;
+    StarryPurple::Fmultimap<BookInfoType, BookType, cMaxFlowSize>
+      bookname_map, author_map, keyword_map;
+    StarryPurple::Fmultimap<ISBNType, SalesType, cMaxFlowSize> sales_map; // one for each book sold
+    // the same sales, one key each. A sale moves the book to a new key (see Fmultimap::remove).
+    StarryPurple::Fmultimap<BestsellerKeyType, SalesType, cMaxFlowSize> bestseller_map;
+    // the cSalesDayCount latest days each book sold in. Older ones are dropped as new days come.
+    StarryPurple::Fmultimap<ISBNType, DaySalesType, cMaxFlowSize> day_sales_map;
+    std::shared_mutex latch; // shared for reading, exclusive for changing the indexes
+  };
 private:
-  StarryPurple::Fmultimap<size_t, BookType, 30, cMaxFlowSize> book_map; // maps 0 to all books
-  StarryPurple::Fmultimap<ISBNType, BookType, 30, cMaxFlowSize> ISBN_map;
-  StarryPurple::Fmultimap<BookInfoType, BookType, 30, cMaxFlowSize>
-    bookname_map, author_map, keyword_map;
+  // on the heap, as the indexes are large.
+  std::array<std::unique_ptr<BookShardType>, cBookShardCount> shards;
+  // the indexes are separate files, so book_modify_info updates them side by side.
+  StarryPurple::ThreadPool index_pool;
   bool is_open = false;
   void open(const std::string &prefix);
   void close();
-  static std::vector<BookInfoType> keyword_splitter(const BookInfoType &keyword_list);
-  void book_register(const BookType &book);
+  static std::pmr::vector<BookInfoType> keyword_splitter(
+    const BookInfoType &keyword_list, std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+  // no empty keyword, no keyword twice.
+  static bool is_keyword_list_valid(const BookInfoType &keyword_list);
+  static size_t shard_of(const ISBNType &ISBN); // FNV-1a, so that it's the same on every run
+  // merge the per-shard results, each sorted, into one sorted vector.
+  static std::pmr::vector<BookType> merge_shards(std::pmr::vector<std::pmr::vector<BookType>> &results);
+  // these take the shared latch of the shards they read.
+  // What they return, and all they need on the way, is allocated from @resource (the arena of the command).
+  std::pmr::vector<BookType> find_ISBN(const ISBNType &ISBN, std::pmr::memory_resource *resource);
+  std::pmr::vector<BookType> find_all(std::pmr::memory_resource *resource);
+  std::pmr::vector<BookType> find_bookname(const BookInfoType &bookname, std::pmr::memory_resource *resource);
+  std::pmr::vector<BookType> find_author(const BookInfoType &author, std::pmr::memory_resource *resource);
+  std::pmr::vector<BookType> find_keyword(const BookInfoType &keyword, std::pmr::memory_resource *resource);
+  // these return false and change nothing if the book can't be registered / modified.
+  bool book_register(const BookType &book);
   // modify list: [ISBN, bookname, author, keyword_list, price, storage]
-  void book_modify_info(const BookType &old_book, BookType &modified_book, bool is_modified[6]);
-  void book_change_storage(const BookType &book, const QuantityType &quantity); // quantity can be negative
+  // Each index is moved to the modified book by a task of its own, all joined before returning.
+  // If any of them throws, every index is put back to the old book and the exception goes on.
+  // Its temporaries come from @resource.
+  bool book_modify_info(const BookType &old_book, BookType &modified_book, bool is_modified[6],
+    std::pmr::memory_resource *resource);
+  // book_modify_info with the latches of both shards already held.
+  bool book_modify_locked(const BookType &old_book, BookType &modified_book, bool is_modified[6],
+    std::pmr::memory_resource *resource);
+  // look up the book and change its storage under the exclusive latch of its shard,
+  // so that nothing comes in between. quantity can be negative.
+  // @book is set to the book before the change.
+  bool book_change_storage(const ISBNType &ISBN, const QuantityType &quantity, BookType &book,
+    std::pmr::memory_resource *resource);
+  // book_change_storage with the latch of the shard already held.
+  bool book_change_storage_locked(const ISBNType &ISBN, const QuantityType &quantity, BookType &book,
+    std::pmr::memory_resource *resource);
+  // take @quantity of the book out of storage and count it as sold on @day, all under the latch of its shard.
+  // @book is set to the book before the sale.
+  bool book_sellout(const ISBNType &ISBN, const QuantityType &quantity, const TimestampType &day, BookType &book,
+    std::pmr::memory_resource *resource);
+  // the sales go with the book to its new ISBN. Called with the latches of both shards held.
+  void sales_move(const ISBNType &old_ISBN, const ISBNType &modified_ISBN);
+  // the sales of the @count best sold books, best first. Ties go by ISBN.
+  // The top @count of each shard merged, with the shared latches of all of them held.
+  std::pmr::vector<SalesType> find_bestsellers(size_t count, std::pmr::memory_resource *resource);
+  // the sales of the book, and its sales of the cSalesDayCount latest days it sold in, latest first.
+  // return false if it has never been sold.
+  bool find_sales(const ISBNType &ISBN, SalesType &book_sales, std::pmr::vector<DaySalesType> &days);
+  // register all the books at once (command "import-catalog").
+  // Nothing is changed if an ISBN is given twice or is already in, or a keyword list is invalid.
+  // The ISBNs are checked against one scan of each shard, and every index gets one bulk_insert.
+  bool book_import_catalog(std::vector<BookType> &books);
+  // transaction of "begin" ... "commit" / "abort", over all the indexes.
+  void begin();
+  void prepare_commit(StarryPurple::CommitJournal &journal);
+  void commit();
+  void abort();
+  // command "backup", over all the indexes. Called with nothing else going on in the shards.
+  void snapshot_begin();
+  void snapshot_write(const std::string &directory);
+  void snapshot_end();
+  // log shipping: leave the files consistent on their own.
+  void checkpoint();
 public:
   BookDatabase() = default;
   ~BookDatabase();
 };
 
+constexpr size_t cFinanceSegmentLength = 256; // finance index entries per in-memory segment
+
 class LogDatabase {
   friend LogManager;
   struct InfoType;
+  struct FinanceIndexType;
+  struct FinanceSegmentType;
 private:
   struct InfoType {
     LogCountType employee_work_log_count, finance_log_count, all_log_count;
     PriceType total_income, total_expenditure;
+    TimestampType last_timestamp;
+  };
+  // one for every finance log, in the same order as finance_log_id_list.
+  // the totals are the running totals after the log.
+  struct FinanceIndexType {
+    TimestampType timestamp;
+    PriceType total_income, total_expenditure;
+  };
+  // one for every cFinanceSegmentLength finance index entries.
+  // the totals are the prefix sums before the first entry of the segment.
+  struct FinanceSegmentType {
+    TimestampType first_timestamp;
+    PriceType income_before, expenditure_before;
   };
   InfoType info;
   StarryPurple::Fstream<size_t, InfoType, 10> log_info;
-  StarryPurple::Fmultimap<size_t, LogType, 30, cMaxFlowSize> all_log_id_map; // all logs
-  StarryPurple::Fmultimap<size_t, LogType, 30, cMaxFlowSize> finance_log_id_map;
-  StarryPurple::Fmultimap<size_t, LogType, 30, cMaxFlowSize> employee_work_log_id_map;
+  StarryPurple::Flog all_log_stream; // all logs. log id is the order it's added.
+  StarryPurple::Fvector<size_t> finance_log_id_list; // ids in all_log_stream
+  StarryPurple::Fvector<FinanceIndexType> finance_index;
+  std::vector<FinanceSegmentType> finance_segments; // rebuilt from finance_index on opening
+  StarryPurple::Fvector<size_t> employee_work_log_id_list; // ids in all_log_stream
+  // actor user_id -> ids of the actor's logs in the views above, ascending.
+  StarryPurple::Fmultimap<UserInfoType, size_t, cMaxFlowSize> employee_work_log_id_map; // log_level & 1
+  StarryPurple::Fmultimap<UserInfoType, size_t, cMaxFlowSize> deal_log_id_map; // "buy" only
+  // Every user identity ever logged is stored once here,
+  // so that a log only keeps the index (actor id) of it.
+  StarryPurple::Fvector<LogUserType> actor_list;
+  std::vector<LogUserType> actors; // all of actor_list, kept in memory
+  std::map<LogUserType, uint32_t> actor_id_map;
+  std::string record_buffer;
   bool is_open = false;
+  // Reports run beside "buy" and the log writer (see LogManager). They pin info under the latch,
+  // and read the logs up to its counts without it: Flog and Fvector never rewrite what's there.
+  // Guards info, finance_segments, actors and the two maps, which add_log changes.
+  std::shared_mutex latch;
   // Common:
   //   record everyone's call for all commands:
   // Param 0x01:
@@ -126,17 +297,68 @@ private:
   //   record finance change and privileged user's specific actions.
   //
   // So log_level should be among {0, 1, 2, 3}.
-  void add_log(
-    const PriceType &income, const PriceType &expenditure,
-    const LogDescriptionType &description, int log_level);
+  void add_log(const LogType &log, int log_level);
+  LogType read_log(size_t log_id);
+  // info as it is now. What a report reads goes no further.
+  InfoType current_info();
+  // the ids in @map of @user's logs.
+  std::vector<size_t> find_log_ids(
+    StarryPurple::Fmultimap<UserInfoType, size_t, cMaxFlowSize> &map, const UserInfoType &user);
+  // call func(log) for every log in the ascending id list, in one sequential scan.
+  template<class Func>
+  void read_logs(const std::vector<size_t> &log_ids, Func func);
+  // call func(log) for every log with id in [first_id, last_id], in one sequential scan.
+  template<class Func>
+  void read_logs(size_t first_id, size_t last_id, Func func);
+  // A log is encoded into a compact record with only the fields its opcode uses.
+  // Strings are stored with their used length only, users are stored by actor id.
+  void log_encode(const LogType &log, std::string &record);
+  // users are looked up in @actor_table, a copy of actors taken after the log was added.
+  void log_decode(const std::string &record, LogType &log, const std::vector<LogUserType> &actor_table);
+  std::vector<LogUserType> current_actors();
+  uint32_t actor_id(const LogUserType &user);
+  // the income and expenditure summed over finance logs with timestamp in [since, until).
+  // binary search over finance_segments, then over one segment of finance_index.
+  void finance_between(const TimestampType &since, const TimestampType &until,
+    PriceType &income, PriceType &expenditure);
+  // the running totals after the last finance log with timestamp < t.
+  void finance_lower_bound(const TimestampType &t, PriceType &income, PriceType &expenditure);
 
   void open(const std::string &prefix);
   void close();
+  // command "backup". The log writer goes on appending while the snapshot is written.
+  void snapshot_begin();
+  void snapshot_write(const std::string &directory);
+  void snapshot_end();
+  // log shipping: leave the files consistent on their own. Flog and Fvector always are.
+  void checkpoint();
 public:
   LogDatabase() = default;
   ~LogDatabase();
 };
 
+template<class Func>
+void LogDatabase::read_logs(const std::vector<size_t> &log_ids, Func func) {
+  const std::vector<LogUserType> actor_table = current_actors();
+  LogType log;
+  all_log_stream.gather(log_ids, [&](size_t id, const std::string &record) {
+    log_decode(record, log, actor_table);
+    log.id = id;
+    func(log);
+  });
+}
+
+template<class Func>
+void LogDatabase::read_logs(size_t first_id, size_t last_id, Func func) {
+  const std::vector<LogUserType> actor_table = current_actors();
+  LogType log;
+  all_log_stream.scan(first_id, last_id, [&](size_t id, const std::string &record) {
+    log_decode(record, log, actor_table);
+    log.id = id;
+    func(log);
+  });
+}
+
 }
 
 #endif // INFO_DATABASE_H
\ No newline at end of file
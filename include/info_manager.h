@@ -2,6 +2,18 @@
 #define INFO_MANAGER_H
 
 #include "info_database.h"
+#include "ring_buffer.h"
+
+#include <array>
+#include <cstddef>
+#include <map>
+#include <memory_resource>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <thread>
+#include <utility>
+#include <vector>
 
 namespace BookStore {
 
@@ -11,31 +23,78 @@ class CommandManager;
 
 // new classes
 
+struct SessionType;
 class UserManager;
 class BookManager;
 class LogManager;
 
+constexpr size_t cArenaSize = 1 << 16; // 64 KB, enough for all a "buy" or a "show -ISBN" allocates
+
+// what one client owns: its login stack (with the books selected) and its output.
+// The console is one session. In server mode every connection has its own.
+struct SessionType {
+  UserStack user_stack;
+  StarryPurple::OutputBuffer output;
+  // what a command allocates on the way (query results, keyword lists, index tasks) is bumped out of here,
+  // and all dropped at once when the command ends (CommandManager::command_executor).
+  // Only a large result ("show" of many books) goes past the buffer to the heap.
+  alignas(std::max_align_t) std::array<std::byte, cArenaSize> arena_buffer;
+  std::pmr::monotonic_buffer_resource arena{arena_buffer.data(), arena_buffer.size()};
+  // between "begin" and "commit" / "abort":
+  bool in_transaction = false;
+  std::unique_lock<std::shared_mutex> transaction_lock; // the databases, held alone till the end
+  UserStack saved_user_stack; // restored on abort
+  std::vector<std::pair<LogType, int>> pending_logs; // logs and their levels, added at commit
+  std::vector<std::pair<ISBNType, ISBNType>> renamed_ISBNs; // (old, new) by "modify", undone on abort
+  explicit SessionType(std::ostream &sink);
+  explicit SessionType(int fd);
+};
+
 // user information database is managed here.
+// Like BookManager and LogManager, a command returns false if it's invalid,
+// and the log of it is written into the LogType & argument if it's done.
+// Commands act for the session given, and print into its output.
 class UserManager {
   friend CommandManager;
 private:
-  UserStack user_stack;
   UserDatabase user_database;
+  std::string database_prefix;
+  // how many times each user is on some session's login stack.
+  // "delete" refuses a user logged in anywhere.
+  std::map<UserInfoType, size_t> logged_count;
   bool is_running = false;
   void open(const std::string &prefix);
   void close();
-  LogType login(const UserInfoType &userID, const PasswordType &password); // command "su [userID] [password]"
-  LogType login(const UserInfoType &userID); // command "su [userID]"
-  LogType user_register(const UserType &user); // command "register"
-  LogType user_add(const UserType &user); // command "useradd"
-  LogType change_password(
-    const UserInfoType &userID,
-    const PasswordType &cur_pwd, const PasswordType &new_pwd); // command "pwd [userID] [currentPassword] [newPassword]"
-  LogType change_password(
-    const UserInfoType &userID,
-    const PasswordType &new_pwd); // command "pwd [userID] [newPassword]"
-  LogType logout(); // command "logout"
-  LogType user_unregister(const UserInfoType &userID); // command "delete"
+  // log out everyone on the session's stack without logs. For a session that ends.
+  void logout_all(SessionType &session);
+  // whether the active user of the session has @privilege at least.
+  // For commands that must be turned down before they touch anything (a file named by a client, say).
+  bool has_privilege(SessionType &session, const UserPrivilege &privilege);
+  // transaction of "begin" ... "commit" / "abort". abort() also restores the login stack.
+  void begin(SessionType &session);
+  void prepare_commit(StarryPurple::CommitJournal &journal); // see CommandManager::command_commit
+  void commit();
+  void abort(SessionType &session);
+  bool login(SessionType &session, const UserInfoType &userID, const PasswordType &password, LogType &log); // command "su [userID] [password]"
+  bool login(SessionType &session, const UserInfoType &userID, LogType &log); // command "su [userID]"
+  bool user_register(const UserType &user, LogType &log); // command "register"
+  bool user_add(SessionType &session, const UserType &user, LogType &log); // command "useradd"
+  bool change_password(
+    SessionType &session, const UserInfoType &userID,
+    const PasswordType &cur_pwd, const PasswordType &new_pwd, LogType &log); // command "pwd [userID] [currentPassword] [newPassword]"
+  bool change_password(
+    SessionType &session, const UserInfoType &userID,
+    const PasswordType &new_pwd, LogType &log); // command "pwd [userID] [newPassword]"
+  bool logout(SessionType &session, LogType &log); // command "logout"
+  bool user_unregister(SessionType &session, const UserInfoType &userID, LogType &log); // command "delete"
+  // command "backup"
+  void snapshot_begin();
+  void snapshot_write(const std::string &directory);
+  void snapshot_end();
+  // log shipping. A standby closes the database while shipped changes are applied to its files.
+  void checkpoint();
+  void database_close();
+  void database_open();
 public:
   UserManager() = default;
   ~UserManager();
@@ -46,38 +105,75 @@ class BookManager {
   friend CommandManager;
 private:
   BookDatabase book_database;
-  UserStack *user_stack_ptr;
+  std::string database_prefix;
+  // all live sessions. A new ISBN is passed on to every one that has the book selected.
+  std::set<SessionType *> *sessions_ptr;
   bool is_running = false;
   void open(const std::string &prefix);
   void close();
-  void select_book(const ISBNType &ISBN); // command "select"
-  void list_all(); // command "show" with no augments
-  void list_ISBN(const ISBNType &ISBN); // command "show -ISBN=[ISBN]"
-  void list_bookname(const BookInfoType &bookname); // command "show -name="[bookname]""
-  void list_author(const BookInfoType &author); // command "show -author="[author]""
-  void list_keyword(const BookInfoType &keyword); // command "show -keyword="[keyword]""
-  LogType restock(const QuantityType &quantity, const PriceType &total_cost); // command "import"
-  LogType sellout(const ISBNType &ISBN, const QuantityType &quantity); // command "buy"
+  // transaction of "begin" ... "commit" / "abort".
+  // abort() also takes back the new ISBNs passed on to other sessions.
+  void begin(SessionType &session);
+  void prepare_commit(StarryPurple::CommitJournal &journal);
+  void commit(SessionType &session);
+  void abort(SessionType &session);
+  bool select_book(SessionType &session, const ISBNType &ISBN); // command "select"
+  bool list_all(SessionType &session); // command "show" with no augments
+  bool list_ISBN(SessionType &session, const ISBNType &ISBN); // command "show -ISBN=[ISBN]"
+  bool list_bookname(SessionType &session, const BookInfoType &bookname); // command "show -name="[bookname]""
+  bool list_author(SessionType &session, const BookInfoType &author); // command "show -author="[author]""
+  bool list_keyword(SessionType &session, const BookInfoType &keyword); // command "show -keyword="[keyword]""
+  bool restock(SessionType &session, const QuantityType &quantity, const PriceType &total_cost, LogType &log); // command "import"
+  bool sellout(SessionType &session, const ISBNType &ISBN, const QuantityType &quantity, LogType &log); // command "buy"
+  bool import_catalog(SessionType &session, std::vector<BookType> &books, LogType &log); // command "import-catalog"
+  // command "report bestsellers [count]": the best sold books, best first. O(count) on the counters kept by "buy".
+  bool report_bestsellers(SessionType &session, size_t count);
+  // command "report sales -ISBN=[ISBN]": units sold, income, and the sales of the latest days.
+  bool report_sales(SessionType &session, const ISBNType &ISBN);
   // command "modify"
   // whether other augments are given is determined by whether it's an empty ConstString.
-  LogType modify_book(
-    const ISBNType &ISBN, const BookInfoType &bookname, const BookInfoType &author,
-    const BookInfoType &keyword_list, const PriceType &price, bool is_modified[5]);
+  bool modify_book(
+    SessionType &session, const ISBNType &ISBN, const BookInfoType &bookname, const BookInfoType &author,
+    const BookInfoType &keyword_list, const PriceType &price, bool is_modified[5], LogType &log);
+  // command "backup"
+  void snapshot_begin();
+  void snapshot_write(const std::string &directory);
+  void snapshot_end();
+  // log shipping, as in UserManager.
+  void checkpoint();
+  void database_close();
+  void database_open();
 public:
   BookManager() = default;
   ~BookManager();
 };
 
+constexpr size_t cLogQueueCapacity = 1 << 10;
+
 class LogManager {
   friend UserManager; // for log_add
   friend BookManager; // for log_add
   friend CommandManager;
+  struct LogTaskType {
+    LogType log;
+    int log_level = 0; // -1 for the writer to stop
+  };
 private:
   LogDatabase log_database;
-  UserStack *user_stack_ptr;
+  std::string database_prefix;
+  // Logs are handed to a dedicated writer thread through log_queue,
+  // so that commands don't wait for log I/O.
+  StarryPurple::RingBuffer<LogTaskType, cLogQueueCapacity> log_queue;
+  // log_queue takes one producer at a time. "buy" / "import" in server mode may add logs side by side.
+  std::mutex producer_latch;
+  std::thread log_writer;
   bool is_running = false;
   void open(const std::string &prefix);
   void close();
+  void log_writer_loop();
+  // wait until all logs added before are written into log_database.
+  // needed before anything in log_database is read.
+  void flush();
   // Common:
   //   record everyone's call for important commands:
   //   "su" "register" "useradd" "passwd" "logout" "delete" "buy" "import" "modify"
@@ -97,11 +193,23 @@ private:
   void add_log(
     const LogType &log, int log_level);
 
-  void show_deal_history(const LogCountType &count); // command "show finance [count]"
-  void show_deal_history(); // special command "show finance"
-  void report_finance(); // special command "report finance"
-  void report_employee(); // special command "report employee"
-  void report_history(); // special command "log"
+  bool show_deal_history(SessionType &session, const LogCountType &count); // command "show finance [count]"
+  bool show_deal_history(SessionType &session); // special command "show finance"
+  // command "show finance -since=... -until=...", for finance logs with timestamp in [since, until)
+  bool show_deal_history(SessionType &session, const TimestampType &since, const TimestampType &until);
+  bool report_finance(SessionType &session); // special command "report finance"
+  bool report_employee(SessionType &session); // special command "report employee"
+  bool report_employee(SessionType &session, const UserInfoType &userID); // command "report employee [userID]"
+  bool report_deal_history(SessionType &session); // command "show history", the active user's own purchases
+  bool report_history(SessionType &session); // special command "log"
+  // command "backup". Taken first: the keeper only, and with every log added before written.
+  bool snapshot_begin(SessionType &session, LogType &log);
+  void snapshot_write(const std::string &directory);
+  void snapshot_end();
+  // log shipping, as in UserManager. checkpoint() waits for the log writer first.
+  void checkpoint();
+  void database_close();
+  void database_open();
 public:
   LogManager() = default;
   ~LogManager();
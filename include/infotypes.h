@@ -2,11 +2,13 @@
 #define INFO_TYPES_H
 
 #include "utilities.h"
+#include "output_buffer.h"
 
 namespace BookStore {
 
 using StarryPurple::ConstStr;
 using StarryPurple::expect;
+using StarryPurple::check;
 
 // friend classes
 
@@ -25,6 +27,7 @@ class LogManager;
 class UserPrivilege;
 class UserType;
 class BookType;
+class LogUserType;
 class LogType;
 
 using LogCountType = int;
@@ -33,9 +36,9 @@ using ISBNType = ConstStr<20>;
 using BookInfoType = ConstStr<60>;
 using UserInfoType = ConstStr<30>;
 using PasswordType = ConstStr<30>;
-using LogDescriptionType = ConstStr<500>;
 using PriceType = double;
 using QuantityType = long long;
+using TimestampType = long long; // seconds since epoch
 
 using UserPtr = StarryPurple::Fpointer<cMaxFlowSize + 1>; // accord to user database capacity
 using BookPtr = StarryPurple::Fpointer<cMaxFlowSize + 2>; // accord to book database capacity
@@ -44,6 +47,7 @@ using LogPtr = StarryPurple::Fpointer<cMaxFlowSize + 3>; // accord to log databa
 class UserPrivilege {
   friend UserType;
   friend LoggedUserType;
+  friend LogUserType;
 private:
   bool pri_1 = false, pri_2 = false, pri_3 = false;
 public:
@@ -59,6 +63,7 @@ public:
 class BookType {
   friend BookDatabase;
   friend BookManager; // needed?
+  friend LogDatabase; // for log encoding
 private:
   ISBNType isbn{};
   BookInfoType bookname{}, author{}, keyword_list{};
@@ -67,8 +72,10 @@ private:
 public:
   BookType() = default;
   BookType(const ISBNType &ISBN);
+  BookType(const ISBNType &ISBN, const BookInfoType &name, const BookInfoType &book_author,
+    const BookInfoType &keywords, const PriceType &book_price, const QuantityType &book_storage);
   ~BookType() = default;
-  void print() const;
+  void print(StarryPurple::OutputBuffer &output) const;
   std::string book_brief_identity_str() const;
   std::string book_full_identity_str() const;
   bool operator==(const BookType &other) const;
@@ -81,6 +88,7 @@ public:
 
 class UserType {
   friend LoggedUserType;
+  friend LogUserType;
   friend UserStack;
   friend UserDatabase;
   friend UserManager; // needed?
@@ -94,7 +102,6 @@ public:
     const UserInfoType &userID, const PasswordType &password,
     int user_privilege, const UserInfoType &name);
   ~UserType() = default;
-  std::string user_identity_str() const;
   bool operator==(const UserType &other) const;
   bool operator!=(const UserType &other) const;
   bool operator<(const UserType &other) const;
@@ -103,24 +110,60 @@ public:
   bool operator>=(const UserType &other) const;
 };
 
+// what a log is about. Each one has its own set of fields in LogType used.
+enum class LogOpcode : unsigned char {
+  system_startup, system_shutdown, // no field
+  login, user_register, // target
+  logout, // actor
+  user_add, user_unregister, // actor, target
+  change_password, // target, old_password, new_password
+  reset_password, // target, new_password
+  restock, sellout, // actor, book, quantity, amount
+  modify_book, // actor, book, modified_book
+  import_catalog, // actor, quantity (of titles)
+  backup // actor
+};
+
+// who a user was when the log is recorded.
+class LogUserType {
+  friend LogDatabase;
+private:
+  UserInfoType user_id, username;
+  UserPrivilege privilege;
+public:
+  LogUserType() = default;
+  LogUserType(const UserType &user);
+  LogUserType(const UserInfoType &userID, const UserInfoType &name, const UserPrivilege &user_privilege);
+  ~LogUserType() = default;
+  // "Client/Staff/Keeper ${usernane} (user id: ${user_id})"
+  std::string user_identity_str() const;
+  bool operator<(const LogUserType &other) const;
+};
+
+// Logs are kept as typed fields.
+// The human-readable description is only made when it's to be shown.
 class LogType {
   friend LogManager; // used in "show finance"
   friend LogDatabase;
+  friend UserManager;
+  friend BookManager;
 private:
-  size_t id;
-  PriceType total_income, total_expenditure;
-  LogDescriptionType log_description;
+  size_t id = 0; // assigned by LogDatabase as its position in the log stream
+  PriceType total_income = 0, total_expenditure = 0; // assigned by LogDatabase
+  TimestampType timestamp = 0; // assigned by LogManager, kept non-decreasing by LogDatabase
+  LogOpcode opcode = LogOpcode::system_startup;
+  LogUserType actor, target; // the user who did it, and the user it's done to
+  BookType book, modified_book; // the book (before modification), and it after modification
+  QuantityType quantity = 0;
+  PriceType amount = 0; // income of "buy" and expenditure of "import"
+  PasswordType old_password, new_password;
 public:
-  static size_t log_count;
   LogType() = default;
-  LogType(
-    const PriceType &history_income, const PriceType &history_expenditure,
-    const LogDescriptionType &description);
-  // for log count
-  LogType(
-    const PriceType &history_income, const PriceType &history_expenditure,
-    const LogDescriptionType &description, bool to_record);
+  explicit LogType(LogOpcode log_opcode);
   ~LogType() = default;
+  std::string description() const;
+  PriceType income() const;
+  PriceType expenditure() const;
   bool operator==(const LogType &other) const;
   bool operator!=(const LogType &other) const;
   bool operator<(const LogType &other) const;
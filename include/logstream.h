@@ -0,0 +1,171 @@
+/** logstream.h
+ * Author: StarryPurple
+ * Date: Since 2026.10.19
+ *
+ * This file contains two append-only file containers used by the log database.
+ *
+ * Flog: an append-only record log made of fixed-size segment files.
+ *     Records are byte strings of any length (up to a segment).
+ *     Record ids start from 1 and go up 1 by 1 in the order they're appended.
+ *
+ * structure of Flog-related files:
+ * 1. Segment files: "${prefix}_${k}.bslog", k = 0, 1, 2, ...
+ *        Each segment holds at most cSegmentSize bytes of records.
+ *        A record is stored as its length (uint32_t) followed by its bytes.
+ * 2. Sparse index files: "${prefix}_${k}.bsidx"
+ *        The offset (uint32_t) in segment k of every cSegmentIndexInterval-th record of that segment,
+ *        beginning with its first one.
+ *
+ * Record count of a segment is recovered at opening time by the sparse index and the file size,
+ * so there's no extra meta file to be kept in accordance with.
+ *
+ * Fvector: an append-only array of fixed-size elements in one file.
+ *     Used for the compact id lists pointing into a Flog.
+ *
+ * A snapshot of either one is just its length at snapshot_begin(): nothing before that is ever rewritten,
+ * so snapshot_write() copies that much of the files while appending goes on.
+ *
+ * Appends are recorded into change_log too, for log shipping.
+ *
+ * Before a gather, the byte ranges of the ids asked for (known from the sparse index) are handed to the kernel
+ * to read in the background (posix_fadvise WILLNEED), so the reads don't wait one by one.
+ *
+ * Both hold a latch in every operation, so threads can share one.
+ * A scan / gather of a Flog only holds it to find where the records are. Those are never rewritten,
+ * so they're read with a file of its own while appending goes on, and the callbacks run without the latch.
+ */
+#ifndef LOG_STREAM_H
+#define LOG_STREAM_H
+
+#include "bookstore_exceptions.h"
+#include "filestream.h"
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace StarryPurple {
+
+constexpr size_t cSegmentSize = 1 << 20; // 1 MB per segment file
+constexpr size_t cSegmentIndexInterval = 32; // one sparse index entry per 32 records
+constexpr size_t cGatherPrefetchGap = 1 << 16; // ranges to prefetch closer than this are asked for as one
+
+// copy the first @byte_count bytes of file @from into a new file @to.
+void copy_file_prefix(const std::string &from, const std::string &to, size_t byte_count);
+
+class Flog {
+  struct SegmentType {
+    size_t first_id = 1; // id of the first record in this segment
+    size_t record_count = 0;
+    size_t byte_size = 0;
+    std::vector<uint32_t> sparse_offset;
+  };
+  // where reading for a record starts: the first record of its sparse index interval.
+  struct LocationType {
+    size_t segment = 0;
+    size_t id = 0;
+    size_t offset = 0;
+  };
+public:
+  Flog() = default;
+  ~Flog();
+
+  // open the log.
+  // return whether the log exists before.
+  bool open(const std::string &prefix);
+  void close();
+
+  // append a record to the end of the log in one sequential write.
+  // return its id.
+  size_t append(const std::string &record);
+  // number of records in the log, also the id of the last record.
+  size_t size() const;
+  // read the record with the given id.
+  void read(size_t id, std::string &record);
+
+  // call func(id, record) for every record with id in [first_id, last_id], in order.
+  template<class Func>
+  void scan(size_t first_id, size_t last_id, Func func);
+  // call func(id, record) for every id in the ascending id list, in order.
+  // Reading goes forward sequentially and only seeks by the sparse index
+  // when the next id is out of the reach of the current segment or interval.
+  template<class Func>
+  void gather(const std::vector<size_t> &ids, Func func);
+
+  // keep the length of every segment (and its sparse index) as it is now.
+  void snapshot_begin();
+  // copy that much of every segment into @directory.
+  void snapshot_write(const std::string &directory);
+  void snapshot_end();
+
+private:
+  std::string segment_filename(size_t segment) const;
+  std::string index_filename(size_t segment) const;
+  size_t segment_of(size_t id) const;
+  // with the latch held.
+  LocationType locate(size_t id) const;
+  // read the record at the position of @file, and move past it. The latch isn't needed.
+  void read_record(std::ifstream &file, std::string &record) const;
+  void new_segment();
+  // move the reader to the record with the given id.
+  void seek(size_t id);
+  // read the record under the reader, and move the reader to the next one.
+  void read_next(std::string &record);
+  // ask the kernel to read the intervals the ascending ids are in.
+  void prefetch(const std::vector<size_t> &ids);
+
+  // size() without taking the latch.
+  size_t record_count() const;
+
+  mutable std::mutex latch_;
+  std::string prefix_;
+  bool is_open = false;
+  std::vector<SegmentType> segments_;
+  std::fstream append_file_, index_file_; // for the last segment
+  std::ifstream read_file_;
+  size_t read_segment_ = 0, read_id_ = 0; // where the reader stands
+  bool is_read_valid = false;
+  std::vector<std::pair<size_t, size_t>> snapshot_sizes_; // {byte_size, sparse index count} of every segment
+};
+
+template<class T>
+class Fvector {
+public:
+  Fvector() = default;
+  ~Fvector();
+
+  // open a file.
+  // return whether the file exists before.
+  bool open(const std::string &filename);
+  void close();
+
+  void push_back(const T &value);
+  size_t size() const;
+  bool empty() const;
+  // read the element at the given index.
+  T operator[](size_t index);
+  // read the elements at index [first, first + count) at one time.
+  std::vector<T> read_range(size_t first, size_t count);
+
+  // keep the size as it is now.
+  void snapshot_begin();
+  // copy that many elements into @directory.
+  void snapshot_write(const std::string &directory);
+  void snapshot_end();
+
+private:
+  mutable std::mutex latch_;
+  std::fstream file_;
+  std::string filename_;
+  size_t size_ = 0;
+  size_t snapshot_size_ = 0;
+  bool is_open = false;
+};
+
+} // namespace StarryPurple
+
+#include "logstream.tpp"
+
+#endif // LOG_STREAM_H
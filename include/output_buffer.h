@@ -0,0 +1,59 @@
+/** output_buffer.h
+ * Author: StarryPurple
+ * Date: Since 2026.10.19
+ *
+ * OutputBuffer: collects everything a command prints, and writes it out in one call when flushed.
+ * Prices and integers are formatted by std::to_chars straight into the buffer,
+ * with no iostream formatting and no temporary strings.
+ * The sink is either an std::ostream or a file descriptor (a client socket in server mode).
+ * The buffer is reserved up front and kept through flushes, so a command printing a few lines never allocates.
+ */
+#ifndef OUTPUT_BUFFER_H
+#define OUTPUT_BUFFER_H
+
+#include "utilities.h"
+
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace StarryPurple {
+
+constexpr size_t cOutputReserveSize = 1 << 17; // 128 KB, past where the command readers flush
+
+class OutputBuffer {
+public:
+  explicit OutputBuffer(std::ostream &sink);
+  explicit OutputBuffer(int fd);
+  ~OutputBuffer();
+
+  OutputBuffer &operator<<(char ch);
+  OutputBuffer &operator<<(std::string_view str);
+  template<int capacity>
+  OutputBuffer &operator<<(const ConstStr<capacity> &str);
+
+  // fixed-point with the given digits after the dot, same as std::fixed << std::setprecision(digit).
+  OutputBuffer &write_price(double val, int digit = 2);
+  // right-aligned in a field of at least width chars, same as std::setw(width).
+  OutputBuffer &write_int(long long val, int width = 0);
+
+  size_t size() const;
+  // write everything buffered into the sink.
+  // If the descriptor is gone (client hung up), what's buffered is dropped.
+  void flush();
+
+private:
+  std::string buffer_;
+  std::ostream *sink_ = nullptr;
+  int fd_ = -1;
+};
+
+template<int capacity>
+OutputBuffer &OutputBuffer::operator<<(const ConstStr<capacity> &str) {
+  buffer_.append(str.c_str(), str.length());
+  return *this;
+}
+
+} // namespace StarryPurple
+
+#endif // OUTPUT_BUFFER_H
@@ -0,0 +1,101 @@
+/** profiler.h
+ * Author: StarryPurple
+ * Date: Since 2026.10.19
+ *
+ * Lightweight instrumentation.
+ *
+ * LatencyHistogram: HDR-style log-linear histogram of latencies in ns.
+ *   Values below 64 have a bucket each; above that every power of two is cut into 32 buckets,
+ *   so a reported percentile is off by at most 1/32 of itself.
+ *   Buckets are atomics, so any thread records without a lock.
+ *
+ * Tracer / TraceSpan: an optional span trace in Chrome trace-event JSON
+ *   (open it in chrome://tracing or ui.perfetto.dev).
+ *   A TraceSpan on the stack records one complete event ("ph": "X") from its construction to its destruction.
+ *   While the tracer is stopped a span costs one relaxed atomic load and nothing else.
+ */
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace StarryPurple {
+
+class LatencyHistogram {
+public:
+  static constexpr int cSubBucketBits = 5;
+  static constexpr size_t cSubBucketCount = size_t(1) << cSubBucketBits;
+  // 64 exact buckets, then 32 for each power of two from 2^6 to 2^63.
+  static constexpr size_t cBucketCount = 2 * cSubBucketCount + (63 - cSubBucketBits) * cSubBucketCount;
+
+  void record(uint64_t ns);
+  uint64_t count() const;
+  uint64_t max() const;
+  double mean() const;
+  // the smallest value v that at least q of the records are <= v (up to the bucket precision).
+  uint64_t percentile(double q) const;
+
+private:
+  static size_t bucket_of(uint64_t ns);
+  static uint64_t bucket_upper(size_t bucket);
+
+  std::atomic<uint64_t> buckets_[cBucketCount]{};
+  std::atomic<uint64_t> count_{0}, sum_{0}, max_{0};
+};
+
+class Tracer {
+  struct EventType {
+    const char *name, *category; // string literals
+    int64_t start_ns, duration_ns; // since start()
+    uint32_t thread_id;
+  };
+public:
+  // record spans from now on. They're written to @path by stop().
+  // return false if the file can't be created.
+  bool start(const std::string &path);
+  // write everything recorded and stop recording.
+  void stop();
+  bool is_enabled() const {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+  int64_t now_ns() const;
+  void record(const char *name, const char *category, int64_t start_ns, int64_t duration_ns);
+
+private:
+  std::atomic<bool> enabled_{false};
+  std::mutex latch_; // guards events_
+  std::vector<EventType> events_;
+  std::string path_;
+  std::chrono::steady_clock::time_point origin_;
+};
+
+inline Tracer tracer;
+
+// categories used across the system:
+//   "parse" splitting and classifying a line,   "lock" waiting for the database lock,
+//   "command" a whole command,   "manager" / "database" the calls below it,
+//   "index" Fmultimap operations,   "log" adding, flushing and reading logs.
+class TraceSpan {
+public:
+  TraceSpan(const char *name, const char *category)
+    : name_(name), category_(category), start_ns_(tracer.is_enabled() ? tracer.now_ns() : -1) {}
+  ~TraceSpan() {
+    if(start_ns_ >= 0)
+      tracer.record(name_, category_, start_ns_, tracer.now_ns() - start_ns_);
+  }
+  TraceSpan(const TraceSpan &) = delete;
+  TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+  const char *name_, *category_;
+  int64_t start_ns_; // -1 if the tracer was off at the start
+};
+
+} // namespace StarryPurple
+
+#endif // PROFILER_H
@@ -0,0 +1,55 @@
+/** ring_buffer.h
+ * Author: StarryPurple
+ * Date: Since 2026.10.19
+ *
+ * A bounded lock-free single-producer / single-consumer ring buffer.
+ *
+ * The producer blocks in push() while the buffer is full (backpressure),
+ * and the consumer blocks in front() while it's empty.
+ * Blocking is done by C++20 atomic wait / notify, so no mutex is ever taken.
+ *
+ * The consumer should call pop() only after it has done with front(),
+ * so that flush() returns when everything pushed before it has been fully handled.
+ */
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <atomic>
+#include <vector>
+
+namespace StarryPurple {
+
+template<class T, size_t capacity>
+class RingBuffer {
+  static_assert((capacity & (capacity - 1)) == 0, "capacity of RingBuffer should be a power of 2");
+public:
+  RingBuffer();
+  ~RingBuffer() = default;
+
+  // producer side.
+  // wait until there's an empty slot, and push the value into it.
+  void push(const T &value);
+  // wait until everything pushed before has been popped.
+  void flush();
+
+  // consumer side.
+  // wait until there's something in the buffer, and return the oldest one.
+  T &front();
+  // release the slot of front().
+  void pop();
+
+  bool empty() const;
+
+private:
+  std::vector<T> buffer_;
+  // head_: count of popped values. tail_: count of pushed values.
+  // placed in different cache lines to avoid false sharing between producer and consumer.
+  alignas(64) std::atomic<size_t> head_{0};
+  alignas(64) std::atomic<size_t> tail_{0};
+};
+
+} // namespace StarryPurple
+
+#include "ring_buffer.tpp"
+
+#endif // RING_BUFFER_H
@@ -0,0 +1,51 @@
+/** thread_pool.h
+ * Author: StarryPurple
+ * Date: Since 2026.10.19
+ *
+ * ThreadPool: a few persistent worker threads for fork-join work inside one command.
+ *
+ * run_all() hands the tasks to the workers, runs what's left on the calling thread too,
+ * and returns only when every task has finished.
+ * A task that throws doesn't stop the others. The first exception is rethrown once all are done,
+ * so the caller sees every task either finished or failed, never still running.
+ * Without start() (or after stop()), run_all() just runs the tasks one by one.
+ */
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+namespace StarryPurple {
+
+class ThreadPool {
+public:
+  ThreadPool() = default;
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  void start(size_t worker_count);
+  // wait for the queued tasks, then join the workers.
+  void stop();
+  // the tasks may live anywhere (a command's arena, say): they're only run in place.
+  void run_all(std::span<std::function<void()>> tasks);
+
+private:
+  void worker_loop();
+
+  std::mutex latch_; // guards queue_ and is_stopping_
+  std::condition_variable task_ready_;
+  std::deque<std::function<void()>> queue_;
+  std::vector<std::thread> workers_;
+  bool is_stopping_ = false;
+};
+
+} // namespace StarryPurple
+
+#endif // THREAD_POOL_H
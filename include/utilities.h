@@ -4,57 +4,204 @@
 
 #include "filestream.h"
 #include "lrucache.h"
+#include "profiler.h"
 #include "validator.h"
 
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+#include <type_traits>
 #include <vector>
 #include <utility>
 
 namespace StarryPurple {
 
-// degree for the maximum size of a node
-// node_size should be in [degree / 2 - 1, degree - 1]
+constexpr size_t cVlistPrefetchSize = 1 << 18; // bytes of a value list read ahead at a time, 256 KB
+// node sizes of Fmultimap. See there.
+constexpr size_t cMinInnerDegree = 16;
+constexpr size_t cMinVlistDegree = 4;
+constexpr size_t cMinVlistBlockSize = 512;
+
+// the largest degree, counting down from @degree, whose Node<degree> takes no more than @size bytes.
+template<template<size_t> class Node, size_t size, size_t degree>
+constexpr size_t fit_degree() {
+  if constexpr(degree == 0 || sizeof(Node<degree>) <= size) return degree;
+  else return fit_degree<Node, size, degree - 1>();
+}
+
+template<int capacity>
+class ConstStr;
+
+// searching the sorted keys of a node.
+// the first i in [0, size) that keys[i] < key doesn't hold, or size.
+// It's branch-free: about log2(size) rounds whatever the keys, each only picking the next base (a cmov),
+// so there's no mispredicted branch to pay for, and the next loads can be started ahead.
+// Integral keys bisect down to cLinearSearchSize and then count the ones less than key,
+// 4 at a time with AVX2 if it's built with it (-mavx2 or -march=native).
+template<class KeyType>
+size_t node_lower_bound(const KeyType *keys, size_t size, const KeyType &key);
+constexpr size_t cLinearSearchSize = 16;
+// A key type with a KeyPrefix has the prefixes of the keys kept in an array beside them,
+// so most of the search runs on 8-byte integers in a row, not on keys spread all over the node.
+// of() should keep the order: a < b means of(a) <= of(b). Only the keys with the same prefix are compared.
+template<class KeyType>
+struct KeyPrefix {
+  static constexpr bool cHasPrefix = false;
+};
+template<int capacity>
+struct KeyPrefix<ConstStr<capacity>> {
+  static constexpr bool cHasPrefix = true;
+  static uint64_t of(const ConstStr<capacity> &key) {
+    return key.prefix();
+  }
+};
+template<class KeyType>
+size_t node_lower_bound(const uint64_t *prefixes, const KeyType *keys, size_t size, const KeyType &key);
+
+// The degrees are worked out at compile time from the sizes of KeyType and ValueType,
+// so that every node fills the block it's stored in (see Fstream), with less than one more slot to spare:
+//   An inner node takes whole pages, as many as a degree of cMinInnerDegree needs.
+//     There are few of them, and their fan-out is the height of the tree.
+//   A value list node takes as many pages as a degree of cMinVlistDegree needs,
+//     or for small values, the power-of-two part of a page (no less than cMinVlistBlockSize) that's enough.
+//     Every key has a list (and its empty head) of its own, so a full page each would be mostly empty.
+// An inner node holds up to degree keys (one more before it splits),
+// and a value list node up to 2 * degree values (one more before it splits).
 // no ValueType is directly used. we only reads and passes fpointer of ValueType.
 // Note: KeyType should have <, >, ==, <=, >=, != (maybe std::hash?)
 //       ValueType should have <, >, ==, <=, >=, !=
-template<class KeyType, class ValueType, size_t degree, size_t capacity>
+template<class KeyType, class ValueType, size_t capacity>
 class Fmultimap {
-  struct InnerNode;
-  struct VlistNode;
-  using InnerPtr = Fpointer<2 * capacity / degree + 10>;
-  using InnerFstream = Fstream<InnerNode, InnerPtr, 2 * capacity / degree + 10>;
+  // every inner node but the root holds at least cMinInnerDegree / 2 keys, one for a value list at least.
+  static constexpr size_t cInnerCapacity = 2 * capacity / cMinInnerDegree + 10;
+  using InnerPtr = Fpointer<cInnerCapacity>;
   using VlistPtr = Fpointer<capacity>;
-  using VlistFstream = Fstream<VlistNode, size_t, capacity>;
-private:
-  struct InnerNode {
+  struct NoPrefixes {};
+  template<size_t degree>
+  struct InnerNodeType {
     // todo: add this_ptr
     bool is_leaf = false;
     InnerPtr link_ptr{};
     KeyType high_key{};
     InnerPtr parent_ptr{};
     size_t node_size = 0;
+    // of keys[], if KeyType has a KeyPrefix. Filled by refresh_prefixes() whenever the node is written.
+    [[no_unique_address]] std::conditional_t<KeyPrefix<KeyType>::cHasPrefix,
+      std::array<uint64_t, degree + 1>, NoPrefixes> prefixes{};
     KeyType keys[degree + 1]{};
     InnerPtr inner_ptrs[degree + 1]{};
     VlistPtr vlist_ptrs[degree + 1]{};
+    // the first slot whose key isn't less than @key, or the last slot.
+    size_t search(const KeyType &key) const {
+      size_t pos;
+      if constexpr(KeyPrefix<KeyType>::cHasPrefix) pos = node_lower_bound(prefixes.data(), keys, node_size, key);
+      else pos = node_lower_bound(keys, node_size, key);
+      return std::min(pos, node_size - 1);
+    }
+    void refresh_prefixes() {
+      if constexpr(KeyPrefix<KeyType>::cHasPrefix)
+        for(size_t i = 0; i < node_size; ++i)
+          prefixes[i] = KeyPrefix<KeyType>::of(keys[i]);
+    }
   };
-  struct VlistNode {
+  template<size_t degree>
+  struct VlistNodeType {
     // todo: add this_ptr
     int node_size = 0;
     ValueType value[2 * degree + 1];
     VlistPtr nxt;
   };
+public:
+  static constexpr size_t cInnerBlockSize =
+    block_size_of(std::max(sizeof(InnerNodeType<cMinInnerDegree>), cPageSize));
+  static constexpr size_t cInnerDegree = fit_degree<InnerNodeType, cInnerBlockSize,
+    (cInnerBlockSize - sizeof(InnerNodeType<0>)) /
+    (sizeof(KeyType) + sizeof(InnerPtr) + sizeof(VlistPtr) + (KeyPrefix<KeyType>::cHasPrefix ? sizeof(uint64_t) : 0)) + 1>();
+  static constexpr size_t cVlistBlockSize =
+    block_size_of(std::max(sizeof(VlistNodeType<cMinVlistDegree>), cMinVlistBlockSize));
+  static constexpr size_t cVlistDegree = fit_degree<VlistNodeType, cVlistBlockSize,
+    (cVlistBlockSize - sizeof(VlistNodeType<0>)) / (2 * sizeof(ValueType)) + 1>();
+private:
+  using InnerNode = InnerNodeType<cInnerDegree>;
+  using VlistNode = VlistNodeType<cVlistDegree>;
+  using InnerFstream = Fstream<InnerNode, InnerPtr, cInnerCapacity>;
+  using VlistFstream = Fstream<VlistNode, size_t, capacity>;
+  static_assert(cInnerDegree >= cMinInnerDegree && cVlistDegree >= cMinVlistDegree);
+  // the node is no smaller than it could be, and takes exactly its block in the file.
+  static_assert(sizeof(InnerNodeType<cInnerDegree + 1>) > cInnerBlockSize && InnerFstream::cBlockSize == cInnerBlockSize);
+  static_assert(sizeof(VlistNodeType<cVlistDegree + 1>) > cVlistBlockSize && VlistFstream::cBlockSize == cVlistBlockSize);
+  static_assert(cPageSize % alignof(InnerNode) == 0 && cPageSize % alignof(VlistNode) == 0);
   InnerFstream inner_fstream;
   VlistFstream vlist_fstream;
   bool is_open = false;
+  std::string prefix_;
+  // whether the files are open. With open_lazily(), they're opened by the first operation.
+  std::atomic<bool> is_loaded{false};
+  std::mutex load_latch; // two readers may both be the first
   InnerPtr root_ptr; // parent_ptr of root_node is "nullptr"
+  InnerPtr saved_root_ptr; // root_ptr at begin()
+  // the (key, value) in the map, kept in the header of vlist_fstream like root_ptr in inner_fstream's.
+  // Files from before it start at 0, so there it's only a lower bound.
+  size_t entry_count = 0;
+  size_t saved_entry_count = 0; // entry_count at begin()
+  // the value list going on from @from to @ptr is mostly a run of blocks (see insert and build).
+  // Read ahead along it, unless @ptr is in [window_begin, window_end) that's already asked for.
+  void prefetch_vlist(const VlistPtr &from, const VlistPtr &ptr, offsetType &window_begin, offsetType &window_end);
+  // every inner node is written through these, so that its prefixes are kept up with its keys.
+  void write_inner(InnerNode &node, const InnerPtr &ptr);
+  InnerPtr allocate_inner(InnerNode &node);
+  // append the values of @key to @res. For operator[] and find().
+  template<class Container>
+  void find_into(const KeyType &key, Container &res);
+  // append the values under ptr to @res in order, till it has @count of them. For find_first().
+  void find_first_into(const InnerPtr &ptr, size_t count, std::pmr::vector<ValueType> &res);
+  bool load_files(); // with load_latch held
+  void load();
+  // move every (key, value) under ptr into entries in order, freeing the nodes on the way.
+  void collect_and_free(const InnerPtr &ptr, std::vector<std::pair<KeyType, ValueType>> &entries);
+  // build the tree of the sorted, distinct entries. The map should be empty.
+  void build(const std::vector<std::pair<KeyType, ValueType>> &entries);
 public:
   Fmultimap() = default;
   ~Fmultimap();
+  // open the files now. Return whether they exist.
   bool open(const std::string &prefix);
+  // only remember the prefix. Nothing is read till the map is first used,
+  // so an index nobody asks for costs nothing at startup.
+  void open_lazily(const std::string &prefix);
   void close();
 
   void insert(const KeyType &key, const ValueType &value);
   void erase(const KeyType &key, const ValueType &value);
   std::vector<ValueType> operator[](const KeyType &key);
+  // operator[], with the result allocated from @resource (the arena of a command, say).
+  std::pmr::vector<ValueType> find(const KeyType &key, std::pmr::memory_resource *resource);
+  // the values of the smallest keys, in order, no more than @count of them.
+  std::pmr::vector<ValueType> find_first(size_t count, std::pmr::memory_resource *resource);
+  // drop the key with all its values. erase() keeps an emptied key in the tree,
+  // which would pile up in a map whose keys keep moving (a ranking, say).
+  void remove(const KeyType &key);
+  // insert many (key, value) at once. Repeated ones and ones already in are skipped.
+  // They're sorted, then the tree is built bottom-up with the nodes written in order,
+  // merged with what's already in. A batch much smaller than what the map holds is inserted one by one instead.
+  void bulk_insert(std::vector<std::pair<KeyType, ValueType>> entries);
+
+  // changes between begin() and commit() stay in memory, and are all dropped by abort().
+  void begin();
+  // record what commit() is going to write (see CommitJournal).
+  void prepare_commit(CommitJournal &journal);
+  void commit();
+  void abort();
+
+  // pin the tree as it is now (see Fstream). Writers go on with copy-on-write till snapshot_end().
+  void snapshot_begin();
+  void snapshot_write(const std::string &directory);
+  void snapshot_end();
+  // write the root and the headers, so that the files are consistent on their own (log shipping).
+  void checkpoint();
 
   // after splitting, split_node will become its parent node,
   // split_ptr will become the pointer of the original split_node.
@@ -123,7 +270,9 @@ public:
   ConstStr();
   ~ConstStr() = default;
   ConstStr(const std::string &str);
+  ConstStr(const char *str, int length);
   ConstStr(const ConstStr &other);
+  ConstStr &operator=(const ConstStr &other) = default;
   std::string to_str() const;
   bool operator==(const ConstStr &other) const;
   bool operator!=(const ConstStr &other) const;
@@ -133,7 +282,10 @@ public:
   bool operator>=(const ConstStr &other) const;
   bool empty() const;
   int length() const;
+  const char *c_str() const;
   const char operator[](int index) const;
+  // the first 8 chars as a number, in the order of the strings. See KeyPrefix.
+  uint64_t prefix() const;
 };
 
 std::string dtos(double val, int digit = 2);
@@ -8,17 +8,44 @@
 
 #include "bookstore_exceptions.h"
 
+#include <string>
+#include <string_view>
+
 namespace StarryPurple {
+
+// A 256-entry table of which chars are allowed.
+// Checking a string against it costs one lookup per char.
+class Charset {
+private:
+  bool table[256]{};
+public:
+  constexpr Charset(std::string_view alphabet) {
+    for(const char ch: alphabet)
+      table[static_cast<unsigned char>(ch)] = true;
+  }
+  constexpr Charset(const char *alphabet) : Charset(std::string_view(alphabet)) {}
+  constexpr bool contains(char ch) const {
+    return table[static_cast<unsigned char>(ch)];
+  }
+};
+
+// expect(val): throws ValidatorException at the first failed check.
+// check(val): never throws. A failed check marks the validator invalid,
+//   later checks in the chain are skipped, and the result is read by converting it to bool:
+//   if(!check(x).greaterEqual(0)) return false;
 template<class T>
 class Validator {
 private:
   T v;
   bool is_rev = false;
+  bool is_throwing = true;
+  bool is_valid = true;
+  Validator &fail();
 public:
   Validator &And = *this;
   Validator &Or = *this;
   Validator &but = *this;
-  Validator(const T &val);
+  Validator(const T &val, bool throwing = true);
   Validator &toBe(const T &other);
   template<class U, class ... Args>
   Validator &toBeOneOf(const U &other, const Args &... args );
@@ -27,17 +54,20 @@ public:
   Validator &lesserEqual(const T &other);
   Validator &greaterEqual(const T &other);
   Validator &Not();
-  template<class CharT>
-  Validator &toBeConsistedOf(const std::basic_string<CharT> &str);
+  Validator &toBeConsistedOf(const Charset &charset);
   template<class CharT>
   Validator &toMatch(const std::basic_string<CharT> &str);
+  explicit operator bool() const;
 };
 
 template<class T>
 Validator<T> expect(const T &val);
 
+template<class T>
+Validator<T> check(const T &val);
+
 } // namespace StarryPurple
 
 #include "validator.tpp"
 
-#endif // VALIDATOR_H
\ No newline at end of file
+#endif // VALIDATOR_H
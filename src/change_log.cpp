@@ -0,0 +1,255 @@
+#include "change_log.h"
+#include "bookstore_exceptions.h"
+
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <string_view>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+template<class T>
+void put_raw(std::string &buffer, const T &value) {
+  buffer.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template<class T>
+T get_raw(const char *pos) {
+  T value;
+  std::memcpy(&value, pos, sizeof(T));
+  return value;
+}
+
+std::string_view name_of(const std::string &filename) {
+  const size_t slash = filename.rfind('/');
+  return slash == std::string::npos ? std::string_view(filename) : std::string_view(filename).substr(slash + 1);
+}
+
+void put_record(std::string &buffer, std::string_view name, uint64_t offset, const void *data, size_t size) {
+  put_raw(buffer, static_cast<uint32_t>(name.size()));
+  buffer.append(name);
+  put_raw(buffer, offset);
+  put_raw(buffer, static_cast<uint32_t>(size));
+  buffer.append(static_cast<const char *>(data), size);
+}
+
+// the directory of @path, ending with '/', or "" for the current one.
+std::string directory_of(const std::string &path) {
+  const size_t slash = path.rfind('/');
+  return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+}
+
+// so that a file created or removed in it stays so.
+void sync_directory(const std::string &directory) {
+  const int fd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_DIRECTORY);
+  if(fd < 0) return;
+  ::fsync(fd);
+  ::close(fd);
+}
+
+} // namespace
+
+StarryPurple::ChangeLog::~ChangeLog() {
+  stop();
+}
+
+bool StarryPurple::ChangeLog::start(const std::string &path) {
+  stop();
+  const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if(fd < 0) return false;
+  std::lock_guard lock(latch_);
+  fd_ = fd;
+  buffer_.clear();
+  entries_.clear();
+  latest_.clear();
+  enabled_.store(true, std::memory_order_relaxed);
+  return true;
+}
+
+void StarryPurple::ChangeLog::stop() {
+  std::lock_guard lock(latch_);
+  enabled_.store(false, std::memory_order_relaxed);
+  buffer_.clear();
+  entries_.clear();
+  latest_.clear();
+  if(fd_ >= 0) ::close(fd_);
+  fd_ = -1;
+}
+
+void StarryPurple::ChangeLog::record(
+  const std::string &filename, uint64_t offset, const void *data, size_t size) {
+  if(!is_enabled()) return;
+  const std::string_view name = name_of(filename);
+  std::lock_guard lock(latch_);
+  if(fd_ < 0) return;
+  auto [it, is_new] = latest_.try_emplace({std::string(name), offset, static_cast<uint32_t>(size)}, entries_.size());
+  if(!is_new) {
+    entries_[it->second].is_live = false;
+    it->second = entries_.size();
+  }
+  const size_t begin = buffer_.size();
+  put_record(buffer_, name, offset, data, size);
+  entries_.push_back({begin, buffer_.size(), true});
+}
+
+bool StarryPurple::ChangeLog::has_pending() const {
+  std::lock_guard lock(latch_);
+  return !buffer_.empty();
+}
+
+void StarryPurple::ChangeLog::commit() {
+  std::lock_guard lock(latch_);
+  if(fd_ < 0 || buffer_.empty()) return;
+  std::string batch;
+  for(const EntryType &entry: entries_)
+    if(entry.is_live) batch.append(buffer_, entry.begin, entry.end - entry.begin);
+  put_raw(batch, static_cast<uint32_t>(0));
+  size_t written = 0;
+  while(written < batch.size()) {
+    const ssize_t res = ::write(fd_, batch.data() + written, batch.size() - written);
+    if(res < 0 && errno == EINTR) continue;
+    if(res <= 0) {
+      // a batch cut short is never applied: the reader waits for its mark.
+      enabled_.store(false, std::memory_order_relaxed);
+      ::close(fd_);
+      fd_ = -1;
+      break;
+    }
+    written += res;
+  }
+  buffer_.clear();
+  entries_.clear();
+  latest_.clear();
+}
+
+StarryPurple::ChangeLogReader::~ChangeLogReader() {
+  close();
+}
+
+bool StarryPurple::ChangeLogReader::open(const std::string &path, uint64_t position) {
+  close();
+  // non-blocking, so that a pipe with no writer yet doesn't hold us here.
+  fd_ = ::open(path.c_str(), O_RDONLY | O_NONBLOCK);
+  if(fd_ < 0) return false;
+  position_ = position;
+  buffer_.clear();
+  // a pipe can't seek. It only ever has what's new.
+  if(position > 0 && ::lseek(fd_, static_cast<off_t>(position), SEEK_SET) < 0 && errno != ESPIPE) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void StarryPurple::ChangeLogReader::close() {
+  if(fd_ >= 0) ::close(fd_);
+  fd_ = -1;
+}
+
+bool StarryPurple::ChangeLogReader::read_batch(std::vector<RecordType> &batch) {
+  batch.clear();
+  if(fd_ < 0) return false;
+  char chunk[1 << 16];
+  while(true) {
+    const ssize_t res = ::read(fd_, chunk, sizeof(chunk));
+    if(res < 0 && errno == EINTR) continue;
+    if(res <= 0) break; // nothing more for now (EOF, or EAGAIN on a pipe)
+    buffer_.append(chunk, res);
+  }
+  // walk the records up to the first commit mark.
+  size_t pos = 0;
+  while(true) {
+    if(buffer_.size() - pos < sizeof(uint32_t)) return false;
+    const uint32_t name_size = get_raw<uint32_t>(buffer_.data() + pos);
+    if(name_size == 0) {
+      pos += sizeof(uint32_t);
+      break;
+    }
+    const size_t head_size = sizeof(uint32_t) + name_size + sizeof(uint64_t) + sizeof(uint32_t);
+    if(buffer_.size() - pos < head_size) return false;
+    const char *head = buffer_.data() + pos;
+    const uint32_t data_size = get_raw<uint32_t>(head + head_size - sizeof(uint32_t));
+    if(buffer_.size() - pos < head_size + data_size) return false;
+    batch.push_back({
+      std::string(head + sizeof(uint32_t), name_size),
+      get_raw<uint64_t>(head + sizeof(uint32_t) + name_size),
+      std::string(head + head_size, data_size)});
+    pos += head_size + data_size;
+  }
+  buffer_.erase(0, pos);
+  position_ += pos;
+  return true;
+}
+
+void StarryPurple::ChangeLogReader::apply(const std::string &directory, const std::vector<RecordType> &batch) {
+  // a batch writes a few files many times. Open each once.
+  std::map<std::string, int> files;
+  for(const RecordType &record: batch) {
+    auto it = files.find(record.filename);
+    if(it == files.end()) {
+      const std::string path = directory + record.filename;
+      it = files.emplace(record.filename, ::open(path.c_str(), O_WRONLY | O_CREAT, 0644)).first;
+    }
+    if(it->second < 0)
+      throw FileExceptions("Cannot apply the change log to \"" + directory + record.filename + "\"");
+    size_t written = 0;
+    while(written < record.data.size()) {
+      const ssize_t res = ::pwrite(it->second, record.data.data() + written,
+        record.data.size() - written, static_cast<off_t>(record.offset + written));
+      if(res < 0 && errno == EINTR) continue;
+      if(res <= 0)
+        throw FileExceptions("Cannot apply the change log to \"" + directory + record.filename + "\"");
+      written += res;
+    }
+  }
+  for(const auto &[filename, fd]: files) {
+    if(fd < 0) continue;
+    ::fsync(fd);
+    ::close(fd);
+  }
+}
+
+void StarryPurple::CommitJournal::record(
+  const std::string &filename, uint64_t offset, const void *data, size_t size) {
+  put_record(buffer_, name_of(filename), offset, data, size);
+}
+
+bool StarryPurple::CommitJournal::write(const std::string &path) const {
+  const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0) return false;
+  std::string batch = buffer_;
+  put_raw(batch, static_cast<uint32_t>(0));
+  size_t written = 0;
+  while(written < batch.size()) {
+    const ssize_t res = ::write(fd, batch.data() + written, batch.size() - written);
+    if(res < 0 && errno == EINTR) continue;
+    if(res <= 0) break;
+    written += res;
+  }
+  const bool is_written = written == batch.size() && ::fsync(fd) == 0;
+  ::close(fd);
+  if(!is_written) {
+    ::unlink(path.c_str());
+    return false;
+  }
+  sync_directory(directory_of(path));
+  return true;
+}
+
+void StarryPurple::CommitJournal::remove(const std::string &path) {
+  if(::unlink(path.c_str()) == 0)
+    sync_directory(directory_of(path));
+}
+
+void StarryPurple::CommitJournal::recover(const std::string &path) {
+  ChangeLogReader reader;
+  if(!reader.open(path, 0)) return; // none: the last run ended cleanly
+  std::vector<ChangeLogReader::RecordType> batch;
+  if(reader.read_batch(batch))
+    ChangeLogReader::apply(directory_of(path), batch);
+  reader.close();
+  remove(path);
+}
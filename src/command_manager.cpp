@@ -1,327 +1,1157 @@
 #include "command_manager.h"
 
-#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using StarryPurple::check;
+
+namespace {
+
+// Parse a number from the beginning of str, like std::stoi / std::stod do.
+// Out of range or no number at all is invalid.
+template<class T>
+bool number_parser(std::string_view str, T &res) {
+  auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), res);
+  return ec == std::errc();
+}
+
+// Check str against the charset and the capacity before it's made into a ConstStr.
+template<int capacity>
+bool str_parser(std::string_view str, const StarryPurple::Charset &charset,
+  StarryPurple::ConstStr<capacity> &res) {
+  if(!check(str.size()).lesserEqual(capacity)) return false;
+  if(!check(str).toBeConsistedOf(charset)) return false;
+  res = StarryPurple::ConstStr<capacity>(str.data(), str.size());
+  return true;
+}
 
-using StarryPurple::expect;
+// (first letter, length) tells every command apart, so this is a perfect hash for them.
+// The name still needs comparing, as other words may share the hash.
+constexpr unsigned command_hash(std::string_view name) {
+  return name.empty() ? 0 : static_cast<unsigned char>(name[0]) << 4 | (name.size() & 15);
+}
+
+// set by SIGINT / SIGTERM to stop command_server.
+volatile std::sig_atomic_t server_stop = 0;
+
+void server_stop_handler(int) {
+  server_stop = 1;
+}
+
+} // namespace
 
-void BookStore::CommandManager::command_login(const ArglistType &argv) {
+bool BookStore::CommandManager::command_login(SessionType &session, const ArglistType &argv) {
   // "su [UserID] ([Password])?"
-  expect(argv.size()).toBeOneOf(2, 3);
-  expect(argv[1]).toBeConsistedOf(digit_alpha_underline_alphabet);
+  if(!check(argv.size()).toBeOneOf(2, 3)) return false;
+  UserInfoType user_id;
+  if(!str_parser(argv[1], digit_alpha_underline_alphabet, user_id)) return false;
   LogType log;
-  if(argv.size() == 2)
-    log = user_manager.login(UserInfoType(argv[1]));
-  else {
-    expect(argv[2]).toBeConsistedOf(digit_alpha_underline_alphabet);
-    log = user_manager.login(UserInfoType(argv[1]), PasswordType(argv[2]));
+  if(argv.size() == 2) {
+    if(!user_manager.login(session, user_id, log)) return false;
+  } else {
+    PasswordType password;
+    if(!str_parser(argv[2], digit_alpha_underline_alphabet, password)) return false;
+    if(!user_manager.login(session, user_id, password, log)) return false;
   }
-  log_manager.add_log(log, 0);
+  add_log(session, log, 0);
+  return true;
 }
 
-void BookStore::CommandManager::command_logout(const ArglistType &argv) {
+bool BookStore::CommandManager::command_logout(SessionType &session, const ArglistType &argv) {
   // “logout”
-  expect(argv.size()).toBe(1);
-  LogType log = user_manager.logout();
-  log_manager.add_log(log, 0);
+  if(!check(argv.size()).toBe(1)) return false;
+  LogType log;
+  if(!user_manager.logout(session, log)) return false;
+  add_log(session, log, 0);
+  return true;
 }
 
-void BookStore::CommandManager::command_user_register(const ArglistType &argv) {
+bool BookStore::CommandManager::command_user_register(SessionType &session, const ArglistType &argv) {
   // "register [UserID] [Password] [Username]"
-  expect(argv.size()).toBe(4);
-  expect(argv[1]).toBeConsistedOf(digit_alpha_underline_alphabet);
-  expect(argv[2]).toBeConsistedOf(digit_alpha_underline_alphabet);
-  expect(argv[3]).toBeConsistedOf(ascii_alphabet);
-  LogType log = user_manager.user_register(
-    UserType(
-      UserInfoType(argv[1]), PasswordType(argv[2]),
-      1, UserInfoType(argv[3])));
-  log_manager.add_log(log, 0);
-}
-
-void BookStore::CommandManager::command_change_password(const ArglistType &argv) {
+  if(!check(argv.size()).toBe(4)) return false;
+  UserInfoType user_id, username;
+  PasswordType password;
+  if(!str_parser(argv[1], digit_alpha_underline_alphabet, user_id)) return false;
+  if(!str_parser(argv[2], digit_alpha_underline_alphabet, password)) return false;
+  if(!str_parser(argv[3], ascii_alphabet, username)) return false;
+  LogType log;
+  if(!user_manager.user_register(UserType(user_id, password, 1, username), log)) return false;
+  add_log(session, log, 0);
+  return true;
+}
+
+bool BookStore::CommandManager::command_change_password(SessionType &session, const ArglistType &argv) {
   // "passwd [UserID] ([CurrentPassword])? [NewPassword]"
-  expect(argv.size()).toBeOneOf(3, 4);
-  expect(argv[1]).toBeConsistedOf(digit_alpha_underline_alphabet);
+  if(!check(argv.size()).toBeOneOf(3, 4)) return false;
+  UserInfoType user_id;
+  if(!str_parser(argv[1], digit_alpha_underline_alphabet, user_id)) return false;
   LogType log;
   if(argv.size() == 4) {
-    expect(argv[2]).toBeConsistedOf(digit_alpha_underline_alphabet);
-    expect(argv[3]).toBeConsistedOf(digit_alpha_underline_alphabet);
-    log = user_manager.change_password(
-      UserInfoType(argv[1]), PasswordType(argv[2]), PasswordType(argv[3]));
+    PasswordType cur_password, new_password;
+    if(!str_parser(argv[2], digit_alpha_underline_alphabet, cur_password)) return false;
+    if(!str_parser(argv[3], digit_alpha_underline_alphabet, new_password)) return false;
+    if(!user_manager.change_password(session, user_id, cur_password, new_password, log)) return false;
   } else {
-    expect(argv[2]).toBeConsistedOf(digit_alpha_underline_alphabet);
-    log = user_manager.change_password(
-      UserInfoType(argv[1]), PasswordType(argv[2]));
+    PasswordType new_password;
+    if(!str_parser(argv[2], digit_alpha_underline_alphabet, new_password)) return false;
+    if(!user_manager.change_password(session, user_id, new_password, log)) return false;
   }
-  log_manager.add_log(log, 0);
+  add_log(session, log, 0);
+  return true;
 }
 
-void BookStore::CommandManager::command_user_add(const ArglistType &argv) {
+bool BookStore::CommandManager::command_user_add(SessionType &session, const ArglistType &argv) {
   // "useradd [UserID] [Password] [Privilege] [Username]"
-  expect(argv.size()).toBe(5);
-  expect(argv[1]).toBeConsistedOf(digit_alpha_underline_alphabet);
-  expect(argv[2]).toBeConsistedOf(digit_alpha_underline_alphabet);
-  expect(argv[3]).toBeConsistedOf(user_priviledge_alphabet);
-  expect(argv[4]).toBeConsistedOf(ascii_alphabet);
-  int pri = std::stoi(argv[3]);
-  expect(pri).toBeOneOf(1, 3, 7);
-  LogType log = user_manager.user_add(
-    UserType(
-      UserInfoType(argv[1]), PasswordType(argv[2]),
-      pri, UserInfoType(argv[4])));
-  log_manager.add_log(log, 1);
-}
-
-void BookStore::CommandManager::command_user_unregister(const ArglistType &argv) {
+  if(!check(argv.size()).toBe(5)) return false;
+  UserInfoType user_id, username;
+  PasswordType password;
+  if(!str_parser(argv[1], digit_alpha_underline_alphabet, user_id)) return false;
+  if(!str_parser(argv[2], digit_alpha_underline_alphabet, password)) return false;
+  if(!check(argv[3]).toBeConsistedOf(user_priviledge_alphabet)) return false;
+  if(!str_parser(argv[4], ascii_alphabet, username)) return false;
+  int pri = 0;
+  if(!number_parser(argv[3], pri)) return false;
+  if(!check(pri).toBeOneOf(1, 3, 7)) return false;
+  LogType log;
+  if(!user_manager.user_add(session, UserType(user_id, password, pri, username), log)) return false;
+  add_log(session, log, 1);
+  return true;
+}
+
+bool BookStore::CommandManager::command_user_unregister(SessionType &session, const ArglistType &argv) {
   // "delete [UserID]"
-  expect(argv.size()).toBe(2);
-  expect(argv[1]).toBeConsistedOf(digit_alpha_underline_alphabet);
-  LogType log = user_manager.user_unregister(UserInfoType(argv[1]));
-  log_manager.add_log(log, 1);
+  if(!check(argv.size()).toBe(2)) return false;
+  UserInfoType user_id;
+  if(!str_parser(argv[1], digit_alpha_underline_alphabet, user_id)) return false;
+  LogType log;
+  if(!user_manager.user_unregister(session, user_id, log)) return false;
+  add_log(session, log, 1);
+  return true;
 }
 
-void BookStore::CommandManager::command_list_book(const ArglistType &argv) {
+bool BookStore::CommandManager::command_list_book(SessionType &session, const ArglistType &argv) {
   // "show (-ISBN=[ISBN] | -name="[BookName]" | -author="[Author]" | -keyword="[Keyword]")?"
-  expect(argv.size()).toBeOneOf(1, 2);
+  if(!check(argv.size()).toBeOneOf(1, 2)) return false;
   if(argv.size() == 1)
-    book_manager.list_all();
-  else {
-    std::smatch match;
-    if(std::regex_search(argv[1], match, ISBN_aug_regex)) {
-      std::string ISBN = match[1];
-      expect(ISBN).toBeConsistedOf(ascii_alphabet);
-      expect(ISBN.empty()).toBe(false);
-      book_manager.list_ISBN(ISBNType(ISBN));
-    } else if(std::regex_search(argv[1], match, bookname_aug_regex)) {
-      std::string bookname = match[1];
-      expect(bookname).toBeConsistedOf(ascii_no_double_quotaton_alphabet);
-      expect(bookname.empty()).toBe(false);
-      book_manager.list_bookname(BookInfoType(bookname));
-    } else if(std::regex_search(argv[1], match, author_aug_regex)) {
-      std::string author = match[1];
-      expect(author).toBeConsistedOf(ascii_no_double_quotaton_alphabet);
-      expect(author.empty()).toBe(false);
-      book_manager.list_author(BookInfoType(author));
-    } else if(std::regex_search(argv[1], match, keyword_aug_regex)) {
-      std::string keyword = match[1];
-      expect(keyword).toBeConsistedOf(ascii_no_double_quotaton_alphabet);
-      expect(keyword.empty()).toBe(false);
-      book_manager.list_keyword(BookInfoType(keyword));
-    } else throw StarryPurple::ValidatorException();
-  }
-}
-
-void BookStore::CommandManager::command_show_finance(const ArglistType &argv) {
+    return book_manager.list_all(session);
+  AugKeyType key;
+  std::string_view value;
+  if(!aug_parser(argv[1], key, value)) return false;
+  ISBNType ISBN;
+  BookInfoType book_info;
+  switch(key) {
+  case AugKeyType::ISBN:
+    return str_parser(value, ascii_alphabet, ISBN) && book_manager.list_ISBN(session, ISBN);
+  case AugKeyType::bookname:
+    return str_parser(value, ascii_no_double_quotaton_alphabet, book_info)
+      && book_manager.list_bookname(session, book_info);
+  case AugKeyType::author:
+    return str_parser(value, ascii_no_double_quotaton_alphabet, book_info)
+      && book_manager.list_author(session, book_info);
+  case AugKeyType::keyword:
+    return str_parser(value, ascii_no_double_quotaton_alphabet, book_info)
+      && book_manager.list_keyword(session, book_info);
+  default:
+    return false;
+  }
+}
+
+bool BookStore::CommandManager::command_show_finance(SessionType &session, const ArglistType &argv) {
   // "show finance ([Count])?"
-  expect(argv.size()).toBeOneOf(2, 3);
+  // "show finance (-since=[Time] | -until=[Time])+"
+  if(!check(argv.size()).toBeOneOf(2, 3, 4)) return false;
   if(argv.size() == 2)
-    log_manager.show_deal_history();
-  else {
-    expect(argv[2]).toBeConsistedOf(digit_alphabet);
-    LogCountType count = std::stoi(argv[2]);
-    log_manager.show_deal_history(count);
+    return log_manager.show_deal_history(session);
+  if(argv[2][0] == '-') {
+    TimestampType since = std::numeric_limits<TimestampType>::min();
+    TimestampType until = std::numeric_limits<TimestampType>::max();
+    bool is_given[2] = {false, false};
+    for(size_t i = 2; i < argv.size(); ++i) {
+      AugKeyType key;
+      std::string_view value;
+      if(!aug_parser(argv[i], key, value)) return false;
+      if(key == AugKeyType::since) {
+        if(is_given[0] || !timestamp_parser(value, since)) return false;
+        is_given[0] = true;
+      } else if(key == AugKeyType::until) {
+        if(is_given[1] || !timestamp_parser(value, until)) return false;
+        is_given[1] = true;
+      } else return false;
+    }
+    return log_manager.show_deal_history(session, since, until);
   }
+  if(!check(argv.size()).toBe(3)) return false;
+  if(!check(argv[2]).toBeConsistedOf(digit_alphabet)) return false;
+  LogCountType count = 0;
+  if(!number_parser(argv[2], count)) return false;
+  return log_manager.show_deal_history(session, count);
 }
 
-void BookStore::CommandManager::command_sellout(const ArglistType &argv) {
+bool BookStore::CommandManager::command_sellout(SessionType &session, const ArglistType &argv) {
   // "buy [ISBN] [Quantity]"
-  expect(argv.size()).toBe(3);
-  expect(argv[1]).toBeConsistedOf(ascii_alphabet);
-  expect(argv[2]).toBeConsistedOf(digit_alphabet);
-  QuantityType quantity = 0;
-  try {
-    quantity = std::stoi(argv[2]);
-  } catch(std::out_of_range &) {
-    throw StarryPurple::ValidatorException();
-    return;
-  }
-  LogType log = book_manager.sellout(ISBNType(argv[1]), quantity);
+  if(!check(argv.size()).toBe(3)) return false;
+  ISBNType ISBN;
+  if(!str_parser(argv[1], ascii_alphabet, ISBN)) return false;
+  if(!check(argv[2]).toBeConsistedOf(digit_alphabet)) return false;
+  int quantity = 0;
+  if(!number_parser(argv[2], quantity)) return false;
+  LogType log;
+  if(!book_manager.sellout(session, ISBN, quantity, log)) return false;
 
-  log_manager.add_log(log, 2);
+  add_log(session, log, 2);
+  return true;
 }
 
-void BookStore::CommandManager::command_select_book(const ArglistType &argv) {
+bool BookStore::CommandManager::command_select_book(SessionType &session, const ArglistType &argv) {
   // "select [ISBN]"
-  expect(argv.size()).toBe(2);
-  expect(argv[1]).toBeConsistedOf(ascii_alphabet);
-  book_manager.select_book(ISBNType(argv[1]));
+  if(!check(argv.size()).toBe(2)) return false;
+  ISBNType ISBN;
+  if(!str_parser(argv[1], ascii_alphabet, ISBN)) return false;
+  return book_manager.select_book(session, ISBN);
 }
 
-void BookStore::CommandManager::command_modify_book(const ArglistType &argv) {
+bool BookStore::CommandManager::command_modify_book(SessionType &session, const ArglistType &argv) {
   // "modify (-ISBN=[ISBN] | -name="[BookName]" | -author="[Author]" | -keyword="[Keyword]" | -price=[Price])+"
-  expect(argv.size()).toBeOneOf(2, 3, 4, 5, 6);
-  std::string ISBN, bookname, author, keyword_list;
+  if(!check(argv.size()).toBeOneOf(2, 3, 4, 5, 6)) return false;
+  ISBNType ISBN;
+  BookInfoType bookname, author, keyword_list;
   PriceType price = 0;
   bool is_modified[5] = {false, false, false, false, false};
   for(size_t i = 1; i < argv.size(); ++i) {
-    std::smatch match;
-    if(std::regex_search(argv[i], match, ISBN_aug_regex)) {
-      if(is_modified[0])
-        throw StarryPurple::ValidatorException();
-      ISBN = match[1];
-      expect(ISBN).toBeConsistedOf(ascii_alphabet);
-      is_modified[0] = true;
-    } else if(std::regex_search(argv[i], match, bookname_aug_regex)) {
-      if(is_modified[1])
-        throw StarryPurple::ValidatorException();
-      bookname = match[1];
-      expect(bookname).toBeConsistedOf(ascii_no_double_quotaton_alphabet);
-      is_modified[1] = true;
-    } else if(std::regex_search(argv[i], match, author_aug_regex)) {
-      if(is_modified[2])
-        throw StarryPurple::ValidatorException();
-      author = match[1];
-      expect(author).toBeConsistedOf(ascii_no_double_quotaton_alphabet);
-      is_modified[2] = true;
-    } else if(std::regex_search(argv[i], match, keyword_aug_regex)) {
-      if(is_modified[3])
-        throw StarryPurple::ValidatorException();
-      keyword_list = match[1];
-      expect(keyword_list).toBeConsistedOf(ascii_no_double_quotaton_alphabet);
-      is_modified[3] = true;
-    } else if(std::regex_search(argv[i], match, price_aug_regex)) {
-      if(is_modified[4])
-        throw StarryPurple::ValidatorException();
-      std::string price_str = match[1];
-      expect(price_str).toBeConsistedOf(digit_with_dot_alphabet);
-      price = std::stod(price_str);
-      is_modified[4] = true;
-    } else throw StarryPurple::ValidatorException();
-  }
-  LogType log = book_manager.modify_book(
-    ISBNType(ISBN), BookInfoType(bookname), BookInfoType(author),
-    BookInfoType(keyword_list), price, is_modified);
-  log_manager.add_log(log, 1);
-}
-
-void BookStore::CommandManager::command_restock(const ArglistType &argv) {
+    AugKeyType key;
+    std::string_view value;
+    if(!aug_parser(argv[i], key, value)) return false;
+    bool is_valid = false;
+    switch(key) {
+    case AugKeyType::ISBN:
+      is_valid = str_parser(value, ascii_alphabet, ISBN);
+      break;
+    case AugKeyType::bookname:
+      is_valid = str_parser(value, ascii_no_double_quotaton_alphabet, bookname);
+      break;
+    case AugKeyType::author:
+      is_valid = str_parser(value, ascii_no_double_quotaton_alphabet, author);
+      break;
+    case AugKeyType::keyword:
+      is_valid = str_parser(value, ascii_no_double_quotaton_alphabet, keyword_list);
+      break;
+    case AugKeyType::price:
+      is_valid = check(value).toBeConsistedOf(digit_with_dot_alphabet) && number_parser(value, price);
+      break;
+    default:
+      return false;
+    }
+    // key is among the first 5 of AugKeyType here, in the same order as is_modified.
+    const int pos = static_cast<int>(key);
+    if(!is_valid || is_modified[pos]) return false;
+    is_modified[pos] = true;
+  }
+  LogType log;
+  if(!book_manager.modify_book(session, ISBN, bookname, author, keyword_list, price, is_modified, log))
+    return false;
+  add_log(session, log, 1);
+  return true;
+}
+
+bool BookStore::CommandManager::command_restock(SessionType &session, const ArglistType &argv) {
   // “import [Quantity] [TotalCost]”
-  expect(argv.size()).toBe(3);
-  expect(argv[1]).toBeConsistedOf(digit_alphabet);
-  expect(argv[2]).toBeConsistedOf(digit_with_dot_alphabet);
-  expect(argv[1].length()).lesserEqual(10);
-  expect(argv[2].length()).lesserEqual(13);
-  QuantityType quantity = 0;
+  if(!check(argv.size()).toBe(3)) return false;
+  if(!check(argv[1]).toBeConsistedOf(digit_alphabet)) return false;
+  if(!check(argv[2]).toBeConsistedOf(digit_with_dot_alphabet)) return false;
+  if(!check(argv[1].length()).lesserEqual(10)) return false;
+  if(!check(argv[2].length()).lesserEqual(13)) return false;
+  // read in restriction: [Quantity] <= MAXINT
+  // It may take "1.1.1" as "1.1", as std::stod did. sad.
+  int quantity = 0;
   PriceType price = 0.0;
+  if(!number_parser(argv[1], quantity) || !number_parser(argv[2], price)) return false;
+  LogType log;
+  if(!book_manager.restock(session, quantity, price, log)) return false;
+  add_log(session, log, 3);
+  return true;
+}
+
+bool BookStore::CommandManager::client_path(std::string_view path, std::string &resolved) const {
+  if(path.empty()) return false;
+  if(client_directory.empty()) {
+    resolved = path;
+    return true;
+  }
+  const std::filesystem::path client_path_name(path);
+  if(client_path_name.is_absolute()) return false;
+  for(const auto &part: client_path_name)
+    if(part == "..") return false;
+  resolved = client_directory + std::string(path);
+  return true;
+}
+
+bool BookStore::CommandManager::command_import_catalog(SessionType &session, const ArglistType &argv) {
+  // "import-catalog [File]"
+  // a book a line: [ISBN] [BookName] [Author] [Keyword] [Price] [Stock], split by tabs.
+  // Only [ISBN] can't be empty. Blank lines are skipped. One bad line and nothing is imported.
+  if(!check(argv.size()).toBe(2)) return false;
+  // before the file is even opened: reading it holds the databases.
+  if(!user_manager.has_privilege(session, UserPrivilege(3))) return false;
+  std::string path;
+  if(!client_path(argv[1], path)) return false;
+  std::ifstream file{path};
+  if(!file.is_open()) return false;
+  std::vector<BookType> books;
+  std::string line;
+  std::string_view fields[6];
+  while(std::getline(file, line)) {
+    std::string_view rest = line;
+    if(!rest.empty() && rest.back() == '\r') rest.remove_suffix(1);
+    if(rest.empty()) continue;
+    size_t field_count = 0;
+    while(true) {
+      if(field_count == 6) return false;
+      const size_t tab = rest.find('\t');
+      fields[field_count++] = rest.substr(0, tab);
+      if(tab == std::string_view::npos) break;
+      rest.remove_prefix(tab + 1);
+    }
+    if(!check(field_count).toBe(6)) return false;
+    ISBNType ISBN;
+    BookInfoType bookname, author, keyword_list;
+    PriceType price = 0;
+    int storage = 0;
+    if(!check(fields[0].empty()).toBe(false)) return false;
+    if(!str_parser(fields[0], ascii_alphabet, ISBN)) return false;
+    if(!str_parser(fields[1], ascii_no_double_quotaton_alphabet, bookname)) return false;
+    if(!str_parser(fields[2], ascii_no_double_quotaton_alphabet, author)) return false;
+    if(!str_parser(fields[3], ascii_no_double_quotaton_alphabet, keyword_list)) return false;
+    if(!check(fields[4]).toBeConsistedOf(digit_with_dot_alphabet)) return false;
+    if(!check(fields[4].length()).lesserEqual(13)) return false;
+    if(!check(fields[5]).toBeConsistedOf(digit_alphabet)) return false;
+    if(!check(fields[5].length()).lesserEqual(10)) return false;
+    if(!number_parser(fields[4], price) || !number_parser(fields[5], storage)) return false;
+    books.emplace_back(ISBN, bookname, author, keyword_list, price, storage);
+  }
+  LogType log;
+  if(!book_manager.import_catalog(session, books, log)) return false;
+  add_log(session, log, 1);
+  return true;
+}
+
+bool BookStore::CommandManager::command_backup(SessionType &session, const ArglistType &argv) {
+  // "backup [Directory]"
+  // The databases are locked only while the snapshot is taken, which is cheap.
+  // Writing it out goes along with the other commands; the blocks they write over are kept for it.
+  if(!check(argv.size()).toBe(2)) return false;
+  // a transaction holds the lock and may have changes not committed.
+  if(!check(session.in_transaction).toBe(false)) return false;
+  // nothing is created for a session that may not back up.
+  if(!user_manager.has_privilege(session, UserPrivilege(7))) return false;
+  std::string directory;
+  if(!client_path(argv[1], directory)) return false;
+  std::error_code error;
+  // never over another backup, or over the data.
+  if(std::filesystem::exists(directory, error) && !std::filesystem::is_empty(directory, error)) return false;
+  if(error) return false;
+  std::filesystem::create_directories(directory, error);
+  if(error) return false;
+  bool expected = false;
+  if(!is_backing_up.compare_exchange_strong(expected, true)) return false;
+  LogType log;
+  {
+    std::unique_lock lock(database_mutex);
+    if(!log_manager.snapshot_begin(session, log)) {
+      is_backing_up = false;
+      return false;
+    }
+    user_manager.snapshot_begin();
+    book_manager.snapshot_begin();
+  }
+  bool is_written = true;
   try {
-    quantity = std::stoi(argv[1]); // read in restriction: [Quantity] <= MAXINT
-    price = std::stod(argv[2]);
-  } catch(std::out_of_range &) {
-    // std::invalid_argument won't be thrown for the regex check.
-    // But it may take "1.1.1" as "1.1". sad.
-    throw StarryPurple::ValidatorException();
-    return;
+    user_manager.snapshot_write(directory);
+    book_manager.snapshot_write(directory);
+    log_manager.snapshot_write(directory);
+  } catch(const StarryPurple::FileExceptions &) {
+    is_written = false;
   }
-  LogType log = book_manager.restock(quantity, price);
-  log_manager.add_log(log, 3);
+  user_manager.snapshot_end();
+  book_manager.snapshot_end();
+  log_manager.snapshot_end();
+  is_backing_up = false;
+  if(!is_written) return false;
+  // logged like "buy", under the shared lock.
+  std::shared_lock lock(database_mutex);
+  add_log(session, log, 1);
+  return true;
 }
 
-void BookStore::CommandManager::command_show_log(const ArglistType &argv) {
+bool BookStore::CommandManager::command_show_log(SessionType &session, const ArglistType &argv) {
   // “log”
-  expect(argv.size()).toBe(1);
-  log_manager.report_history();
+  if(!check(argv.size()).toBe(1)) return false;
+  return log_manager.report_history(session);
+}
+
+bool BookStore::CommandManager::command_show_report(SessionType &session, const ArglistType &argv) {
+  // “report finance”, "report employee ([UserID])?"
+  // "report bestsellers ([Count])?", "report sales -ISBN=[ISBN]"
+  if(!check(argv.size()).toBeOneOf(2, 3)) return false;
+  if(argv.size() == 2 && argv[1] == "finance")
+    return log_manager.report_finance(session);
+  if(argv.size() == 2 && argv[1] == "employee")
+    return log_manager.report_employee(session);
+  if(argv.size() == 2 && argv[1] == "bestsellers")
+    return book_manager.report_bestsellers(session, cBestsellerCount);
+  if(argv[1] == "employee") {
+    UserInfoType user_id;
+    if(!str_parser(argv[2], digit_alpha_underline_alphabet, user_id)) return false;
+    return log_manager.report_employee(session, user_id);
+  }
+  if(argv[1] == "bestsellers") {
+    if(!check(argv[2]).toBeConsistedOf(digit_alphabet)) return false;
+    int count = 0;
+    if(!number_parser(argv[2], count)) return false;
+    return book_manager.report_bestsellers(session, count);
+  }
+  if(argv[1] == "sales") {
+    AugKeyType key;
+    std::string_view value;
+    if(!aug_parser(argv[2], key, value) || key != AugKeyType::ISBN) return false;
+    ISBNType ISBN;
+    if(!str_parser(value, ascii_alphabet, ISBN)) return false;
+    return book_manager.report_sales(session, ISBN);
+  }
+  return false;
+}
+
+bool BookStore::CommandManager::command_show_history(SessionType &session, const ArglistType &argv) {
+  // "show history"
+  if(!check(argv.size()).toBe(2)) return false;
+  return log_manager.report_deal_history(session);
+}
+
+bool BookStore::CommandManager::command_begin(SessionType &session, const ArglistType &argv) {
+  // "begin"
+  if(!check(argv.size()).toBe(1)) return false;
+  if(!check(session.in_transaction).toBe(false)) return false;
+  user_manager.begin(session);
+  book_manager.begin(session);
+  session.pending_logs.clear();
+  session.in_transaction = true;
+  return true;
+}
+
+bool BookStore::CommandManager::command_commit(SessionType &session, const ArglistType &argv) {
+  // "commit"
+  if(!check(argv.size()).toBe(1)) return false;
+  if(!check(session.in_transaction).toBe(true)) return false;
+  // the whole commit is in the journal, synced, before any file is written.
+  // A crash from then on is finished by open(); the logs still go to the writer as usual.
+  StarryPurple::CommitJournal journal;
+  user_manager.prepare_commit(journal);
+  book_manager.prepare_commit(journal);
+  if(!journal.write(journal_path)) {
+    transaction_abort(session);
+    return false;
+  }
+  user_manager.commit();
+  book_manager.commit(session);
+  StarryPurple::CommitJournal::remove(journal_path);
+  session.in_transaction = false;
+  // the logs of the whole transaction go to the writer back to back.
+  for(const auto &[log, log_level]: session.pending_logs)
+    log_manager.add_log(log, log_level);
+  session.pending_logs.clear();
+  return true;
+}
+
+bool BookStore::CommandManager::command_abort(SessionType &session, const ArglistType &argv) {
+  // "abort"
+  if(!check(argv.size()).toBe(1)) return false;
+  if(!check(session.in_transaction).toBe(true)) return false;
+  transaction_abort(session);
+  return true;
+}
+
+void BookStore::CommandManager::transaction_abort(SessionType &session) {
+  user_manager.abort(session);
+  book_manager.abort(session);
+  session.pending_logs.clear();
+  session.in_transaction = false;
+}
+
+void BookStore::CommandManager::add_log(SessionType &session, const LogType &log, int log_level) {
+  // the log of a standby is the primary's.
+  if(is_standby) return;
+  if(session.in_transaction)
+    session.pending_logs.emplace_back(log, log_level);
+  else
+    log_manager.add_log(log, log_level);
 }
 
-void BookStore::CommandManager::command_show_report(const ArglistType &argv) {
-  // “report finance”, "report employee"
-  expect(argv.size()).toBe(2);
-  if(argv[1] == "finance")
-    log_manager.report_finance();
-  else if(argv[1] == "employee")
-    log_manager.report_employee();
-  else throw StarryPurple::ValidatorException();
+void BookStore::CommandManager::add_system_log(LogOpcode opcode) {
+  // a transaction left open in the console already holds the lock.
+  std::unique_lock lock(database_mutex, std::defer_lock);
+  if(!console_session.transaction_lock.owns_lock()) lock.lock();
+  log_manager.add_log(LogType(opcode), 0);
 }
 
 void BookStore::CommandManager::open(const std::string &prefix) {
   if(is_running) close();
+  // a commit cut short by a crash goes into the files before they're read.
+  journal_path = prefix + "_journal";
+  StarryPurple::CommitJournal::recover(journal_path);
   user_manager.open(prefix + "_user");
   book_manager.open(prefix + "_book");
   log_manager.open(prefix + "_log");
   is_running = true;
 
-  book_manager.user_stack_ptr = log_manager.user_stack_ptr = &user_manager.user_stack;
+  book_manager.sessions_ptr = &sessions;
+  sessions.insert(&console_session);
 
+  is_background_stopping = false;
+  if(is_standby)
+    standby_follower = std::thread(&CommandManager::standby_loop, this);
+  else if(StarryPurple::change_log.is_enabled())
+    shipper = std::thread(&CommandManager::shipper_loop, this);
 }
 
 void BookStore::CommandManager::close() {
   if(!is_running) return;
+  if(console_session.in_transaction) {
+    transaction_abort(console_session);
+    console_session.transaction_lock.unlock();
+  }
+  user_manager.logout_all(console_session);
+  sessions.clear();
+  {
+    std::lock_guard lock(background_mutex);
+    is_background_stopping = true;
+  }
+  background_cv.notify_all();
+  if(shipper.joinable()) shipper.join();
+  if(standby_follower.joinable()) standby_follower.join();
   user_manager.close();
   book_manager.close();
   log_manager.close();
+  // closing wrote every header. That's the last batch.
+  StarryPurple::change_log.commit();
   is_running = false;
 }
 
+void BookStore::CommandManager::shipper_loop() {
+  std::unique_lock stop_lock(background_mutex);
+  while(!background_cv.wait_for(stop_lock, std::chrono::milliseconds(cShipInterval),
+    [this]() { return is_background_stopping; })) {
+    stop_lock.unlock();
+    ship_checkpoint();
+    stop_lock.lock();
+  }
+}
+
+void BookStore::CommandManager::ship_checkpoint() {
+  if(!StarryPurple::change_log.has_pending()) return;
+  // no command half done, and no transaction open: it holds the lock.
+  std::unique_lock lock(database_mutex);
+  user_manager.checkpoint();
+  book_manager.checkpoint();
+  log_manager.checkpoint();
+  StarryPurple::change_log.commit();
+}
+
+void BookStore::CommandManager::standby_loop() {
+  const std::string position_path = standby_directory + standby_prefix + "_standby_position";
+  uint64_t position = 0;
+  std::ifstream(position_path) >> position;
+  StarryPurple::ChangeLogReader reader;
+  std::vector<StarryPurple::ChangeLogReader::RecordType> batch;
+  std::unique_lock stop_lock(background_mutex);
+  while(!is_background_stopping) {
+    stop_lock.unlock();
+    // the primary may not have created the ship file yet.
+    if(reader.is_open() || reader.open(standby_ship_path, position)) {
+      std::unique_lock lock(database_mutex, std::defer_lock);
+      while(reader.read_batch(batch)) {
+        if(!lock.owns_lock()) {
+          lock.lock();
+          user_manager.database_close();
+          book_manager.database_close();
+          log_manager.database_close();
+        }
+        StarryPurple::ChangeLogReader::apply(standby_directory, batch);
+      }
+      if(lock.owns_lock()) {
+        user_manager.database_open();
+        book_manager.database_open();
+        log_manager.database_open();
+        position = reader.position();
+        std::ofstream(position_path, std::ios::trunc) << position << '\n';
+      }
+    }
+    stop_lock.lock();
+    background_cv.wait_for(stop_lock, std::chrono::milliseconds(cStandbyPollInterval),
+      [this]() { return is_background_stopping; });
+  }
+}
+
+bool BookStore::CommandManager::is_standby_command(CommandType type) {
+  switch(type) {
+  case CommandType::quit:
+  case CommandType::login:
+  case CommandType::logout:
+  case CommandType::list_book:
+  case CommandType::show_finance:
+  case CommandType::show_history:
+  case CommandType::show_log:
+  case CommandType::show_report:
+    return true;
+  default:
+    return false;
+  }
+}
+
 BookStore::CommandManager::~CommandManager() {
   if(is_running) close();
 }
 
 
-BookStore::CommandManager::ArglistType
-BookStore::CommandManager::command_splitter(const std::string &command) {
-  std::vector<std::string> argv;
-  std::string arg;
-  for(const char &ch: command) {
-    if(ch == ' ' || ch == '\n' || ch == '\r' || ch == EOF) { // is EOF judge trully needed?
-      if(!arg.empty()) {
-        argv.push_back(arg);
-        arg.clear();
-      }
-    } else arg += ch;
+void BookStore::CommandManager::command_splitter(std::string_view command, ArglistType &argv) {
+  StarryPurple::TraceSpan span("CommandManager::split", "parse");
+  argv.clear();
+  size_t begin = 0;
+  for(size_t i = 0; i <= command.size(); ++i) {
+    // is EOF judge trully needed?
+    if(i == command.size() || command[i] == ' ' || command[i] == '\n' || command[i] == '\r'
+      || command[i] == static_cast<char>(EOF)) {
+      if(i > begin)
+        argv.push_back(command.substr(begin, i - begin));
+      begin = i + 1;
+    }
+  }
+}
+
+bool BookStore::CommandManager::aug_parser(
+  std::string_view arg, AugKeyType &key, std::string_view &value) {
+  const size_t eq_pos = arg.find('=');
+  if(arg.empty() || arg[0] != '-' || eq_pos == std::string_view::npos)
+    return false;
+  const std::string_view key_str = arg.substr(1, eq_pos - 1);
+  value = arg.substr(eq_pos + 1);
+  bool is_quoted = false;
+  if(key_str == "ISBN") key = AugKeyType::ISBN;
+  else if(key_str == "name") key = AugKeyType::bookname, is_quoted = true;
+  else if(key_str == "author") key = AugKeyType::author, is_quoted = true;
+  else if(key_str == "keyword") key = AugKeyType::keyword, is_quoted = true;
+  else if(key_str == "price") key = AugKeyType::price;
+  else if(key_str == "since") key = AugKeyType::since;
+  else if(key_str == "until") key = AugKeyType::until;
+  else return false;
+  if(is_quoted) {
+    if(value.size() < 2 || value.front() != '"' || value.back() != '"')
+      return false;
+    value = value.substr(1, value.size() - 2);
+  }
+  if(value.empty()) return false;
+  for(const char ch: value)
+    if(ch < 0x20 || ch > 0x7e)
+      return false;
+  return true;
+}
+
+bool BookStore::CommandManager::timestamp_parser(std::string_view str, TimestampType &timestamp) {
+  // "YYYY-MM-DD" or "YYYY-MM-DDTHH:MM:SS", in local time
+  if(!check(str.size()).toBeOneOf(10, 19)) return false;
+  const std::string_view format = "0000-00-00T00:00:00";
+  for(size_t i = 0; i < str.size(); ++i) {
+    if(format[i] == '0') {
+      if(str[i] < '0' || str[i] > '9')
+        return false;
+    } else if(str[i] != format[i])
+      return false;
+  }
+  std::tm time{};
+  number_parser(str.substr(0, 4), time.tm_year);
+  number_parser(str.substr(5, 2), time.tm_mon);
+  number_parser(str.substr(8, 2), time.tm_mday);
+  time.tm_year -= 1900;
+  time.tm_mon -= 1;
+  if(str.size() == 19) {
+    number_parser(str.substr(11, 2), time.tm_hour);
+    number_parser(str.substr(14, 2), time.tm_min);
+    number_parser(str.substr(17, 2), time.tm_sec);
+  }
+  time.tm_isdst = -1; // let mktime decide
+  std::tm normalized = time;
+  std::time_t res = std::mktime(&normalized);
+  // mktime quietly carries "02-30" into March. Don't accept that.
+  if(res == static_cast<std::time_t>(-1)) return false;
+  if(normalized.tm_mday != time.tm_mday || normalized.tm_mon != time.tm_mon
+    || normalized.tm_hour != time.tm_hour || normalized.tm_min != time.tm_min
+    || normalized.tm_sec != time.tm_sec)
+    return false;
+  timestamp = res;
+  return true;
+}
+
+BookStore::CommandManager::CommandType
+BookStore::CommandManager::command_classifier(const ArglistType &argv) {
+  StarryPurple::TraceSpan span("CommandManager::classify", "parse");
+  switch(command_hash(argv[0])) {
+  case command_hash("quit"):
+  case command_hash("exit"):
+    // “quit”, "exit"
+    return (argv[0] == "quit" || argv[0] == "exit") && argv.size() == 1 ?
+      CommandType::quit : CommandType::invalid;
+  case command_hash("su"):
+    return argv[0] == "su" ? CommandType::login : CommandType::invalid;
+  case command_hash("logout"):
+    return argv[0] == "logout" ? CommandType::logout : CommandType::invalid;
+  case command_hash("register"):
+    return argv[0] == "register" ? CommandType::user_register : CommandType::invalid;
+  case command_hash("passwd"):
+    return argv[0] == "passwd" ? CommandType::change_password : CommandType::invalid;
+  case command_hash("useradd"):
+    return argv[0] == "useradd" ? CommandType::user_add : CommandType::invalid;
+  case command_hash("delete"):
+    return argv[0] == "delete" ? CommandType::user_unregister : CommandType::invalid;
+  case command_hash("show"):
+    if(argv[0] != "show")
+      return CommandType::invalid;
+    if(argv.size() >= 2 && argv[1] == "finance")
+      return CommandType::show_finance;
+    if(argv.size() >= 2 && argv[1] == "history")
+      return CommandType::show_history;
+    return CommandType::list_book;
+  case command_hash("buy"):
+    return argv[0] == "buy" ? CommandType::sellout : CommandType::invalid;
+  case command_hash("select"):
+    return argv[0] == "select" ? CommandType::select_book : CommandType::invalid;
+  case command_hash("modify"):
+    return argv[0] == "modify" ? CommandType::modify_book : CommandType::invalid;
+  case command_hash("import"):
+    return argv[0] == "import" ? CommandType::restock : CommandType::invalid;
+  case command_hash("import-catalog"):
+    return argv[0] == "import-catalog" ? CommandType::import_catalog : CommandType::invalid;
+  case command_hash("log"):
+    return argv[0] == "log" ? CommandType::show_log : CommandType::invalid;
+  case command_hash("report"):
+    return argv[0] == "report" ? CommandType::show_report : CommandType::invalid;
+  case command_hash("backup"):
+    return argv[0] == "backup" ? CommandType::backup : CommandType::invalid;
+  case command_hash("begin"):
+    return argv[0] == "begin" ? CommandType::transaction_begin : CommandType::invalid;
+  case command_hash("commit"):
+    return argv[0] == "commit" ? CommandType::transaction_commit : CommandType::invalid;
+  case command_hash("abort"):
+    return argv[0] == "abort" ? CommandType::transaction_abort : CommandType::invalid;
+  default:
+    return CommandType::invalid;
+  }
+}
+
+bool BookStore::CommandManager::is_lock_shared(CommandType type) {
+  switch(type) {
+  case CommandType::invalid:
+  case CommandType::quit:
+  case CommandType::list_book:
+  // these change one book only, under the latch of its shard. See BookDatabase.
+  case CommandType::sellout:
+  case CommandType::restock:
+  // the reports read the logs as they are when they start, while the log writer goes on. See LogDatabase.
+  case CommandType::show_finance:
+  case CommandType::show_history:
+  case CommandType::show_log:
+  case CommandType::show_report:
+    return true;
+  default:
+    // "select" may register a new book, and "modify" may move one across shards.
+    return false;
+  }
+}
+
+const char *BookStore::CommandManager::command_name(CommandType type) {
+  switch(type) {
+  case CommandType::quit: return "quit";
+  case CommandType::login: return "su";
+  case CommandType::logout: return "logout";
+  case CommandType::user_register: return "register";
+  case CommandType::change_password: return "passwd";
+  case CommandType::user_add: return "useradd";
+  case CommandType::user_unregister: return "delete";
+  case CommandType::list_book: return "show";
+  case CommandType::show_finance: return "show finance";
+  case CommandType::show_history: return "show history";
+  case CommandType::sellout: return "buy";
+  case CommandType::select_book: return "select";
+  case CommandType::modify_book: return "modify";
+  case CommandType::restock: return "import";
+  case CommandType::import_catalog: return "import-catalog";
+  case CommandType::show_log: return "log";
+  case CommandType::show_report: return "report";
+  case CommandType::backup: return "backup";
+  case CommandType::transaction_begin: return "begin";
+  case CommandType::transaction_commit: return "commit";
+  case CommandType::transaction_abort: return "abort";
+  default: return "invalid";
+  }
+}
+
+void BookStore::CommandManager::command_executor(
+  SessionType &session, CommandType type, const ArglistType &argv) {
+  const auto start = std::chrono::steady_clock::now();
+  StarryPurple::TraceSpan command_span(command_name(type), "command");
+  std::shared_lock read_lock(database_mutex, std::defer_lock);
+  std::unique_lock write_lock(database_mutex, std::defer_lock);
+  // a session in a transaction holds the databases alone already.
+  // "backup" locks them itself, only while the snapshot is taken.
+  if(!session.transaction_lock.owns_lock() && type != CommandType::backup) {
+    StarryPurple::TraceSpan lock_span("CommandManager::lock", "lock");
+    if(is_lock_shared(type)) read_lock.lock();
+    else write_lock.lock();
+  }
+  bool is_valid = false;
+  try {
+    switch(is_standby && !is_standby_command(type) ? CommandType::invalid : type) {
+    case CommandType::quit: is_valid = true; break;
+    case CommandType::login: is_valid = command_login(session, argv); break;
+    case CommandType::logout: is_valid = command_logout(session, argv); break;
+    case CommandType::user_register: is_valid = command_user_register(session, argv); break;
+    case CommandType::change_password: is_valid = command_change_password(session, argv); break;
+    case CommandType::user_add: is_valid = command_user_add(session, argv); break;
+    case CommandType::user_unregister: is_valid = command_user_unregister(session, argv); break;
+    case CommandType::list_book: is_valid = command_list_book(session, argv); break;
+    case CommandType::show_finance: is_valid = command_show_finance(session, argv); break;
+    case CommandType::show_history: is_valid = command_show_history(session, argv); break;
+    case CommandType::sellout: is_valid = command_sellout(session, argv); break;
+    case CommandType::select_book: is_valid = command_select_book(session, argv); break;
+    case CommandType::modify_book: is_valid = command_modify_book(session, argv); break;
+    case CommandType::restock: is_valid = command_restock(session, argv); break;
+    case CommandType::import_catalog: is_valid = command_import_catalog(session, argv); break;
+    case CommandType::show_log: is_valid = command_show_log(session, argv); break;
+    case CommandType::show_report: is_valid = command_show_report(session, argv); break;
+    case CommandType::backup: is_valid = command_backup(session, argv); break;
+    case CommandType::transaction_begin: is_valid = command_begin(session, argv); break;
+    case CommandType::transaction_commit: is_valid = command_commit(session, argv); break;
+    case CommandType::transaction_abort: is_valid = command_abort(session, argv); break;
+    default: is_valid = false;
+    }
+  } catch(StarryPurple::ValidatorException &) {
+    // only the old throwing checks (expect) get here.
+    is_valid = false;
+  }
+  if(!is_valid)
+    session.output << "Invalid\n";
+  // everything the command allocated from the arena is gone by now.
+  session.arena.release();
+  // the lock taken for "begin" is kept till "commit" / "abort".
+  if(session.in_transaction && write_lock.owns_lock())
+    session.transaction_lock = std::move(write_lock);
+  else if(!session.in_transaction && session.transaction_lock.owns_lock())
+    session.transaction_lock.unlock();
+  const size_t index = static_cast<size_t>(type);
+  (is_valid ? accepted_count : rejected_count)[index].fetch_add(1, std::memory_order_relaxed);
+  command_latency[index].record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start).count());
+}
+
+void BookStore::CommandManager::write_stats(std::ostream &os) const {
+  char line[160];
+  std::snprintf(line, sizeof(line), "%-14s %9s %9s %9s %9s %9s %9s %9s\n",
+    "command", "accepted", "rejected", "p50(us)", "p90(us)", "p99(us)", "p999(us)", "max(us)");
+  os << line;
+  for(size_t index = 0; index < cCommandTypeCount; ++index) {
+    const StarryPurple::LatencyHistogram &latency = command_latency[index];
+    if(latency.count() == 0) continue;
+    std::snprintf(line, sizeof(line), "%-14s %9llu %9llu %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+      command_name(static_cast<CommandType>(index)),
+      static_cast<unsigned long long>(accepted_count[index].load(std::memory_order_relaxed)),
+      static_cast<unsigned long long>(rejected_count[index].load(std::memory_order_relaxed)),
+      latency.percentile(0.5) / 1000.0, latency.percentile(0.9) / 1000.0,
+      latency.percentile(0.99) / 1000.0, latency.percentile(0.999) / 1000.0, latency.max() / 1000.0);
+    os << line;
   }
-  if(!arg.empty()) argv.push_back(arg);
-  return argv;
 }
 
 void BookStore::CommandManager::command_list_reader(const std::string &prefix, const std::string &directory) {
-  LogType::log_count = 0;
-  open(directory + prefix);
-  log_manager.add_log(LogType(0, 0, LogDescriptionType("System startup.")), 0);
+  console_open(prefix, directory);
   std::string command;
+  // someone typing wants the answer right away; a piped script only wants it eventually.
+  const bool is_interactive = isatty(fileno(stdin));
   while(std::getline(std::cin, command)) {
-    ArglistType argv = command_splitter(command);
-    if(argv.empty()) continue;
-    try {
-      if(argv[0] == "quit" || argv[0] == "exit") {
-        // “quit”, "exit"
-        expect(argv.size()).toBe(1);
-        break;
+    const bool is_going_on = console_run(command);
+    if(is_interactive)
+      console_session.output.flush();
+    if(!is_going_on) break;
+  }
+  console_close();
+}
+
+void BookStore::CommandManager::console_open(const std::string &prefix, const std::string &directory) {
+  open(directory + prefix);
+  add_system_log(LogOpcode::system_startup);
+}
+
+bool BookStore::CommandManager::console_run(std::string_view line) {
+  command_splitter(line, console_argv);
+  if(console_argv.empty()) return true;
+  const CommandType type = command_classifier(console_argv);
+  command_executor(console_session, type, console_argv);
+  if(console_session.output.size() >= cOutputFlushSize)
+    console_session.output.flush();
+  return type != CommandType::quit;
+}
+
+void BookStore::CommandManager::console_close() {
+  console_session.output.flush();
+  add_system_log(LogOpcode::system_shutdown);
+  close();
+}
+
+void BookStore::CommandManager::command_batch_reader(
+  const std::string &input_path, const std::string &prefix, const std::string &directory) {
+  // map the whole script. Every token handed around below is a view into it.
+  const int fd = ::open(input_path.c_str(), O_RDONLY);
+  if(fd < 0)
+    throw StarryPurple::FileExceptions("cannot open batch input " + input_path);
+  struct stat file_stat{};
+  if(fstat(fd, &file_stat) != 0) {
+    ::close(fd);
+    throw StarryPurple::FileExceptions("cannot stat batch input " + input_path);
+  }
+  const size_t file_size = file_stat.st_size;
+  void *mapped = nullptr;
+  if(file_size > 0) {
+    mapped = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(mapped == MAP_FAILED) {
+      ::close(fd);
+      throw StarryPurple::FileExceptions("cannot map batch input " + input_path);
+    }
+    madvise(mapped, file_size, MADV_SEQUENTIAL);
+  }
+  const std::string_view input(static_cast<const char *>(mapped), file_size);
+
+  open(directory + prefix);
+  add_system_log(LogOpcode::system_startup);
+  auto queue = std::make_unique<StarryPurple::RingBuffer<CommandRecord, cBatchQueueCapacity>>();
+
+  // parser: split lines and classify them, nothing else.
+  // It touches no database, so it runs freely ahead of the executor.
+  std::thread parser([this, input, &queue]() {
+    ArglistType argv;
+    CommandRecord record;
+    size_t begin = 0;
+    while(begin < input.size()) {
+      size_t end = input.find('\n', begin);
+      if(end == std::string_view::npos) end = input.size();
+      command_splitter(input.substr(begin, end - begin), argv);
+      begin = end + 1;
+      if(argv.empty()) continue;
+      // no command takes that many words.
+      record.type = argv.size() > cMaxArgc ? CommandType::invalid : command_classifier(argv);
+      record.argc = std::min(argv.size(), cMaxArgc);
+      std::copy_n(argv.begin(), record.argc, record.argv);
+      queue->push(record);
+      // the executor stops reading here.
+      if(record.type == CommandType::quit) return;
+    }
+    record.is_end = true;
+    queue->push(record);
+  });
+
+  // executor: this thread, in input order.
+  ArglistType argv;
+  while(true) {
+    const CommandRecord &record = queue->front();
+    if(record.is_end) {
+      queue->pop();
+      break;
+    }
+    const CommandType type = record.type;
+    argv.assign(record.argv, record.argv + record.argc);
+    queue->pop();
+    command_executor(console_session, type, argv);
+    if(console_session.output.size() >= cOutputFlushSize)
+      console_session.output.flush();
+    if(type == CommandType::quit) break;
+  }
+  parser.join();
+  console_session.output.flush();
+  add_system_log(LogOpcode::system_shutdown);
+  close();
+
+  if(mapped != nullptr)
+    munmap(mapped, file_size);
+  ::close(fd);
+}
+
+void BookStore::CommandManager::command_session_reader(int fd) {
+  SessionType session(fd);
+  {
+    std::unique_lock lock(database_mutex);
+    sessions.insert(&session);
+  }
+  std::string input;
+  char chunk[cServerReadSize];
+  ArglistType argv;
+  bool is_quit = false, is_eof = false;
+  while(!is_quit && !is_eof) {
+    if(session.in_transaction) {
+      // the transaction holds the database lock, so a client gone quiet would block everyone.
+      pollfd poll_fd{fd, POLLIN, 0};
+      const int ready = poll(&poll_fd, 1, cTransactionIdleTimeout);
+      if(ready < 0 && errno == EINTR) continue;
+      if(ready == 0) {
+        // dropped like "abort". The client finds out from its "commit" being "Invalid".
+        transaction_abort(session);
+        session.transaction_lock.unlock();
+        continue;
       }
-      if(argv[0] == "su")
-        command_login(argv);
-      else if(argv[0] == "logout")
-        command_logout(argv);
-      else if(argv[0] == "register")
-        command_user_register(argv);
-      else if(argv[0] == "passwd")
-        command_change_password(argv);
-      else if(argv[0] == "useradd")
-        command_user_add(argv);
-      else if(argv[0] == "delete")
-        command_user_unregister(argv);
-      else if(argv[0] == "show") {
-        if(argv[1] == "finance")
-          command_show_finance(argv);
-        else command_list_book(argv);
-      } else if(argv[0] == "buy")
-        command_sellout(argv);
-      else if(argv[0] == "select")
-        command_select_book(argv);
-      else if(argv[0] == "modify")
-        command_modify_book(argv);
-      else if(argv[0] == "import")
-        command_restock(argv);
-      else if(argv[0] == "log")
-        command_show_log(argv);
-      else if(argv[0] == "report")
-        command_show_report(argv);
-      else throw StarryPurple::ValidatorException();
-    } catch(StarryPurple::ValidatorException &) {
-      std::cout << "Invalid\n";
-    }/* catch(std::out_of_range &) {
-      std::cout << "Debug fail";
-    }*/
-  }
-  log_manager.add_log(LogType(0, 0, LogDescriptionType("System shutdown.")), 0);
+    }
+    const ssize_t res = ::read(fd, chunk, sizeof(chunk));
+    if(res < 0 && errno == EINTR) continue;
+    if(res <= 0) {
+      // hung up. A last line without '\n' still counts, as with std::getline.
+      is_eof = true;
+      if(input.empty()) break;
+      input += '\n';
+    } else input.append(chunk, res);
+    size_t begin = 0, end;
+    while(!is_quit && (end = input.find('\n', begin)) != std::string::npos) {
+      command_splitter(std::string_view(input).substr(begin, end - begin), argv);
+      begin = end + 1;
+      if(argv.empty()) continue;
+      const CommandType type = command_classifier(argv);
+      command_executor(session, type, argv);
+      is_quit = (type == CommandType::quit);
+    }
+    input.erase(0, begin);
+    // answer everything that came in one read with one write.
+    session.output.flush();
+  }
+  // a transaction left open is dropped. Its lock is already ours.
+  std::unique_lock lock(database_mutex, std::defer_lock);
+  if(session.in_transaction) {
+    transaction_abort(session);
+    lock = std::move(session.transaction_lock);
+  } else lock.lock();
+  user_manager.logout_all(session);
+  sessions.erase(&session);
+}
+
+void BookStore::CommandManager::command_server(
+  const std::string &socket_path, const std::string &prefix, const std::string &directory,
+  size_t worker_count) {
+  sockaddr_un address{};
+  if(socket_path.size() >= sizeof(address.sun_path))
+    throw StarryPurple::FileExceptions("socket path too long: " + socket_path);
+  const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(listen_fd < 0)
+    throw StarryPurple::FileExceptions("cannot create socket " + socket_path);
+  address.sun_family = AF_UNIX;
+  std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+  unlink(socket_path.c_str()); // left by a server that didn't stop cleanly
+  if(bind(listen_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0
+    || listen(listen_fd, cServerBacklog) != 0) {
+    ::close(listen_fd);
+    throw StarryPurple::FileExceptions("cannot listen on socket " + socket_path);
+  }
+  server_stop = 0;
+  struct sigaction action{};
+  action.sa_handler = server_stop_handler;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+  signal(SIGPIPE, SIG_IGN); // a client hanging up mid-answer isn't our death
+
+  open(directory + prefix);
+  client_directory = directory;
+  if(!is_standby)
+    add_system_log(LogOpcode::system_startup);
+
+  // accepted connections wait in pending for a free worker.
+  std::mutex pending_mutex;
+  std::condition_variable pending_cv;
+  std::deque<int> pending;
+  std::set<int> serving; // connections being served, to be shut down at stop
+  bool is_stopping = false;
+  std::vector<std::thread> workers;
+  for(size_t i = 0; i < worker_count; ++i)
+    workers.emplace_back([&]() {
+      while(true) {
+        int fd;
+        {
+          std::unique_lock lock(pending_mutex);
+          pending_cv.wait(lock, [&]() { return is_stopping || !pending.empty(); });
+          if(is_stopping) return;
+          fd = pending.front();
+          pending.pop_front();
+          serving.insert(fd);
+        }
+        command_session_reader(fd);
+        {
+          std::lock_guard lock(pending_mutex);
+          serving.erase(fd);
+        }
+        ::close(fd);
+      }
+    });
+
+  while(!server_stop) {
+    pollfd poll_fd{listen_fd, POLLIN, 0};
+    if(poll(&poll_fd, 1, cServerPollInterval) <= 0) continue;
+    const int fd = accept(listen_fd, nullptr, nullptr);
+    if(fd < 0) continue;
+    std::lock_guard lock(pending_mutex);
+    pending.push_back(fd);
+    pending_cv.notify_one();
+  }
+
+  {
+    std::lock_guard lock(pending_mutex);
+    is_stopping = true;
+    for(const int fd: pending) ::close(fd);
+    pending.clear();
+    // the workers see their clients hang up, after answering what they've already read.
+    for(const int fd: serving) shutdown(fd, SHUT_RD);
+  }
+  pending_cv.notify_all();
+  for(auto &worker: workers) worker.join();
+  ::close(listen_fd);
+  unlink(socket_path.c_str());
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+
+  if(!is_standby)
+    add_system_log(LogOpcode::system_shutdown);
   close();
 }
+
+void BookStore::CommandManager::command_standby(const std::string &ship_path, const std::string &socket_path,
+  const std::string &prefix, const std::string &directory, size_t worker_count) {
+  is_standby = true;
+  standby_ship_path = ship_path;
+  standby_directory = directory;
+  standby_prefix = prefix;
+  command_server(socket_path, prefix, directory, worker_count);
+  is_standby = false;
+}
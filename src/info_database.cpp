@@ -1,6 +1,10 @@
 #include "info_database.h"
 
+#include <algorithm>
+#include <functional>
+#include <queue>
 #include <set>
+#include <thread>
 
 BookStore::UserStack::~UserStack() {
   if(is_open) close();
@@ -24,32 +28,23 @@ void BookStore::UserStack::clear() {
   // The data in std::vector will be automatically released and discarded.
   // but for the function of "clear", let's do some clearing.
   u_stack.clear();
-  logged_set.clear();
 }
 
 BookStore::LoggedUserType::LoggedUserType(const UserType &user)
   : user_id(user.user_id), username(user.username), privilege(user.privilege) {}
 
-std::string BookStore::LoggedUserType::user_identity_str() const {
-  std::string res = "\"";
-  if(privilege.pri_3) res += "Keeper";
-  else if(privilege.pri_2) res += "Worker";
-  else if(privilege.pri_1) res += "Client";
-  else res += "Tourist";
-  res += "\" " + username.to_str() + " (id: " + user_id.to_str() + ")";
-  return res;
+BookStore::LogUserType BookStore::LoggedUserType::log_identity() const {
+  return LogUserType(user_id, username, privilege);
 }
 
 
 void BookStore::UserStack::user_login(const UserType &user) {
   u_stack.push_back(LoggedUserType(user));
-  logged_set.insert(user.user_id);
 }
 
 void BookStore::UserStack::user_logout() {
   if(u_stack.empty())
     throw StarryPurple::ValidatorException();
-  logged_set.erase(u_stack.back().user_id);
   u_stack.pop_back();
 }
 
@@ -73,7 +68,9 @@ BookStore::LoggedUserType
 
 const BookStore::UserPrivilege
 BookStore::UserStack::active_privilege() {
-  return active_user().privilege;
+  if(u_stack.empty())
+    return UserPrivilege(); // nobody logged in, lower than any user
+  return u_stack.back().privilege;
 }
 
 
@@ -109,13 +106,47 @@ void BookStore::UserDatabase::close() {
 }
 
 void BookStore::UserDatabase::user_register(const UserType &user) {
+  StarryPurple::TraceSpan span("UserDatabase::user_register", "database");
   user_id_map.insert(user.user_id, user);
 }
 
 void BookStore::UserDatabase::user_unregister(const UserType &user) {
+  StarryPurple::TraceSpan span("UserDatabase::user_unregister", "database");
   user_id_map.erase(user.user_id, user);
 }
 
+void BookStore::UserDatabase::begin() {
+  user_id_map.begin();
+}
+
+void BookStore::UserDatabase::prepare_commit(StarryPurple::CommitJournal &journal) {
+  user_id_map.prepare_commit(journal);
+}
+
+void BookStore::UserDatabase::commit() {
+  user_id_map.commit();
+}
+
+void BookStore::UserDatabase::abort() {
+  user_id_map.abort();
+}
+
+void BookStore::UserDatabase::snapshot_begin() {
+  user_id_map.snapshot_begin();
+}
+
+void BookStore::UserDatabase::snapshot_write(const std::string &directory) {
+  user_id_map.snapshot_write(directory);
+}
+
+void BookStore::UserDatabase::snapshot_end() {
+  user_id_map.snapshot_end();
+}
+
+void BookStore::UserDatabase::checkpoint() {
+  user_id_map.checkpoint();
+}
+
 
 
 
@@ -127,101 +158,514 @@ BookStore::BookDatabase::~BookDatabase() {
 
 void BookStore::BookDatabase::open(const std::string &prefix) {
   if(is_open) close();
-  book_map.open(prefix + "_book_id_map.bsdat");
-  ISBN_map.open(prefix + "_book_isbn_map.bsdat");
-  bookname_map.open(prefix + "_book_bookname_map.bsdat");
-  author_map.open(prefix + "_book_author_map.bsdat");
-  keyword_map.open(prefix + "_book_keyword_map.bsdat");
+  // opened by the first command that needs them.
+  for(size_t k = 0; k < cBookShardCount; ++k) {
+    if(!shards[k]) shards[k] = std::make_unique<BookShardType>();
+    BookShardType &shard = *shards[k];
+    const std::string shard_prefix = prefix + "_shard" + std::to_string(k);
+    shard.book_map.open_lazily(shard_prefix + "_book_id_map.bsdat");
+    shard.ISBN_map.open_lazily(shard_prefix + "_book_isbn_map.bsdat");
+    shard.bookname_map.open_lazily(shard_prefix + "_book_bookname_map.bsdat");
+    shard.author_map.open_lazily(shard_prefix + "_book_author_map.bsdat");
+    shard.keyword_map.open_lazily(shard_prefix + "_book_keyword_map.bsdat");
+    shard.sales_map.open_lazily(shard_prefix + "_book_sales_map.bsdat");
+    shard.bestseller_map.open_lazily(shard_prefix + "_book_bestseller_map.bsdat");
+    shard.day_sales_map.open_lazily(shard_prefix + "_book_day_sales_map.bsdat");
+  }
+  // on a single core the tasks would only take turns, so they're run in place.
+  const size_t core_count = std::thread::hardware_concurrency();
+  index_pool.start(core_count > 1 ? std::min(cIndexWorkerCount, core_count - 1) : 0);
   is_open = true;
-
 }
 
 void BookStore::BookDatabase::close() {
   if(!is_open) return;
-  book_map.close();
-  ISBN_map.close();
-  bookname_map.close();
-  author_map.close();
-  keyword_map.close();
+  index_pool.stop();
+  for(auto &shard: shards) {
+    shard->book_map.close();
+    shard->ISBN_map.close();
+    shard->bookname_map.close();
+    shard->author_map.close();
+    shard->keyword_map.close();
+    shard->sales_map.close();
+    shard->bestseller_map.close();
+    shard->day_sales_map.close();
+  }
   is_open = false;
 }
 
-std::vector<BookStore::BookInfoType> BookStore::BookDatabase::keyword_splitter(
-  const BookInfoType &keyword_list) {
-  std::vector<BookInfoType> keyword_vector;
-  std::string keyword;
-  for(int i = 0; i < keyword_list.length(); ++i) {
-    if(keyword_list[i] == '|') {
-      if(!keyword.empty()) {
-        keyword_vector.push_back(BookInfoType(keyword));
-        keyword.clear();
-      }
-    } else keyword += keyword_list[i];
-  }
-  if(!keyword.empty())
-    keyword_vector.push_back(BookInfoType(keyword));
+void BookStore::BookDatabase::begin() {
+  for(auto &shard: shards) {
+    shard->book_map.begin();
+    shard->ISBN_map.begin();
+    shard->bookname_map.begin();
+    shard->author_map.begin();
+    shard->keyword_map.begin();
+    shard->sales_map.begin();
+    shard->bestseller_map.begin();
+    shard->day_sales_map.begin();
+  }
+}
+
+void BookStore::BookDatabase::prepare_commit(StarryPurple::CommitJournal &journal) {
+  for(auto &shard: shards) {
+    shard->book_map.prepare_commit(journal);
+    shard->ISBN_map.prepare_commit(journal);
+    shard->bookname_map.prepare_commit(journal);
+    shard->author_map.prepare_commit(journal);
+    shard->keyword_map.prepare_commit(journal);
+    shard->sales_map.prepare_commit(journal);
+    shard->bestseller_map.prepare_commit(journal);
+    shard->day_sales_map.prepare_commit(journal);
+  }
+}
+
+void BookStore::BookDatabase::commit() {
+  for(auto &shard: shards) {
+    shard->book_map.commit();
+    shard->ISBN_map.commit();
+    shard->bookname_map.commit();
+    shard->author_map.commit();
+    shard->keyword_map.commit();
+    shard->sales_map.commit();
+    shard->bestseller_map.commit();
+    shard->day_sales_map.commit();
+  }
+}
+
+void BookStore::BookDatabase::abort() {
+  for(auto &shard: shards) {
+    shard->book_map.abort();
+    shard->ISBN_map.abort();
+    shard->bookname_map.abort();
+    shard->author_map.abort();
+    shard->keyword_map.abort();
+    shard->sales_map.abort();
+    shard->bestseller_map.abort();
+    shard->day_sales_map.abort();
+  }
+}
+
+void BookStore::BookDatabase::snapshot_begin() {
+  for(auto &shard: shards) {
+    shard->book_map.snapshot_begin();
+    shard->ISBN_map.snapshot_begin();
+    shard->bookname_map.snapshot_begin();
+    shard->author_map.snapshot_begin();
+    shard->keyword_map.snapshot_begin();
+    shard->sales_map.snapshot_begin();
+    shard->bestseller_map.snapshot_begin();
+    shard->day_sales_map.snapshot_begin();
+  }
+}
+
+void BookStore::BookDatabase::snapshot_write(const std::string &directory) {
+  // one file after another, so the disk reads and writes stay sequential.
+  for(auto &shard: shards) {
+    shard->book_map.snapshot_write(directory);
+    shard->ISBN_map.snapshot_write(directory);
+    shard->bookname_map.snapshot_write(directory);
+    shard->author_map.snapshot_write(directory);
+    shard->keyword_map.snapshot_write(directory);
+    shard->sales_map.snapshot_write(directory);
+    shard->bestseller_map.snapshot_write(directory);
+    shard->day_sales_map.snapshot_write(directory);
+  }
+}
+
+void BookStore::BookDatabase::snapshot_end() {
+  for(auto &shard: shards) {
+    shard->book_map.snapshot_end();
+    shard->ISBN_map.snapshot_end();
+    shard->bookname_map.snapshot_end();
+    shard->author_map.snapshot_end();
+    shard->keyword_map.snapshot_end();
+    shard->sales_map.snapshot_end();
+    shard->bestseller_map.snapshot_end();
+    shard->day_sales_map.snapshot_end();
+  }
+}
+
+void BookStore::BookDatabase::checkpoint() {
+  for(auto &shard: shards) {
+    shard->book_map.checkpoint();
+    shard->ISBN_map.checkpoint();
+    shard->bookname_map.checkpoint();
+    shard->author_map.checkpoint();
+    shard->keyword_map.checkpoint();
+    shard->sales_map.checkpoint();
+    shard->bestseller_map.checkpoint();
+    shard->day_sales_map.checkpoint();
+  }
+}
+
+std::pmr::vector<BookStore::BookInfoType> BookStore::BookDatabase::keyword_splitter(
+  const BookInfoType &keyword_list, std::pmr::memory_resource *resource) {
+  std::pmr::vector<BookInfoType> keyword_vector(resource);
+  // cut right out of the list, no string in between.
+  const char *list = keyword_list.c_str();
+  int begin = 0;
+  for(int i = 0; i <= keyword_list.length(); ++i) {
+    if(i < keyword_list.length() && list[i] != '|') continue;
+    if(i > begin)
+      keyword_vector.emplace_back(list + begin, i - begin);
+    begin = i + 1;
+  }
   return keyword_vector;
 }
 
+bool BookStore::BookDatabase::is_keyword_list_valid(const BookInfoType &keyword_list) {
+  for(int i = 0; i < keyword_list.length(); ++i)
+    if(keyword_list[i] == '|')
+      if(i == 0 || i == keyword_list.length() - 1
+        || keyword_list[i - 1] == '|'
+        || keyword_list[i + 1] == '|')
+        return false;
+  const std::pmr::vector<BookInfoType> keyword_vector = keyword_splitter(keyword_list);
+  std::set<BookInfoType> keyword_set;
+  for(const auto &keyword: keyword_vector)
+    keyword_set.insert(keyword);
+  return keyword_set.size() == keyword_vector.size();
+}
+
+size_t BookStore::BookDatabase::shard_of(const ISBNType &ISBN) {
+  uint32_t hash = 2166136261u;
+  for(int i = 0; i < ISBN.length(); ++i) {
+    hash ^= static_cast<unsigned char>(ISBN[i]);
+    hash *= 16777619u;
+  }
+  return hash % cBookShardCount;
+}
+
+std::pmr::vector<BookStore::BookType> BookStore::BookDatabase::merge_shards(
+  std::pmr::vector<std::pmr::vector<BookType>> &results) {
+  std::pmr::memory_resource *resource = results.get_allocator().resource();
+  // (book, shard), smallest on top.
+  using HeadType = std::pair<const BookType *, size_t>;
+  auto is_after = [](const HeadType &lhs, const HeadType &rhs) { return *rhs.first < *lhs.first; };
+  std::priority_queue<HeadType, std::pmr::vector<HeadType>, decltype(is_after)>
+    heads(is_after, std::pmr::vector<HeadType>(resource));
+  std::pmr::vector<size_t> pos(results.size(), 0, resource);
+  size_t total = 0;
+  for(size_t k = 0; k < results.size(); ++k) {
+    total += results[k].size();
+    if(!results[k].empty()) heads.emplace(&results[k][0], k);
+  }
+  std::pmr::vector<BookType> merged(resource);
+  merged.reserve(total);
+  while(!heads.empty()) {
+    const size_t k = heads.top().second;
+    heads.pop();
+    merged.push_back(results[k][pos[k]]);
+    if(++pos[k] < results[k].size()) heads.emplace(&results[k][pos[k]], k);
+  }
+  return merged;
+}
 
-void BookStore::BookDatabase::book_register(const BookType &book) {
-  expect(ISBN_map[book.isbn].size()).toBe(0);
-  book_map.insert(0, book);
-  ISBN_map.insert(book.isbn, book);
-  bookname_map.insert(book.bookname, book);
-  author_map.insert(book.author, book);
+std::pmr::vector<BookStore::BookType> BookStore::BookDatabase::find_ISBN(
+  const ISBNType &ISBN, std::pmr::memory_resource *resource) {
+  BookShardType &shard = *shards[shard_of(ISBN)];
+  std::shared_lock lock(shard.latch);
+  return shard.ISBN_map.find(ISBN, resource);
+}
+
+std::pmr::vector<BookStore::BookType> BookStore::BookDatabase::find_all(std::pmr::memory_resource *resource) {
+  std::pmr::vector<std::pmr::vector<BookType>> results(cBookShardCount, resource);
+  for(size_t k = 0; k < cBookShardCount; ++k) {
+    std::shared_lock lock(shards[k]->latch);
+    results[k] = shards[k]->book_map.find(0, resource);
+  }
+  return merge_shards(results);
+}
+
+std::pmr::vector<BookStore::BookType> BookStore::BookDatabase::find_bookname(
+  const BookInfoType &bookname, std::pmr::memory_resource *resource) {
+  std::pmr::vector<std::pmr::vector<BookType>> results(cBookShardCount, resource);
+  for(size_t k = 0; k < cBookShardCount; ++k) {
+    std::shared_lock lock(shards[k]->latch);
+    results[k] = shards[k]->bookname_map.find(bookname, resource);
+  }
+  return merge_shards(results);
+}
+
+std::pmr::vector<BookStore::BookType> BookStore::BookDatabase::find_author(
+  const BookInfoType &author, std::pmr::memory_resource *resource) {
+  std::pmr::vector<std::pmr::vector<BookType>> results(cBookShardCount, resource);
+  for(size_t k = 0; k < cBookShardCount; ++k) {
+    std::shared_lock lock(shards[k]->latch);
+    results[k] = shards[k]->author_map.find(author, resource);
+  }
+  return merge_shards(results);
+}
+
+std::pmr::vector<BookStore::BookType> BookStore::BookDatabase::find_keyword(
+  const BookInfoType &keyword, std::pmr::memory_resource *resource) {
+  std::pmr::vector<std::pmr::vector<BookType>> results(cBookShardCount, resource);
+  for(size_t k = 0; k < cBookShardCount; ++k) {
+    std::shared_lock lock(shards[k]->latch);
+    results[k] = shards[k]->keyword_map.find(keyword, resource);
+  }
+  return merge_shards(results);
+}
+
+
+bool BookStore::BookDatabase::book_register(const BookType &book) {
+  StarryPurple::TraceSpan span("BookDatabase::book_register", "database");
+  BookShardType &shard = *shards[shard_of(book.isbn)];
+  std::unique_lock lock(shard.latch);
+  if(!check(shard.ISBN_map[book.isbn].size()).toBe(0)) return false;
+  shard.book_map.insert(0, book);
+  shard.ISBN_map.insert(book.isbn, book);
+  shard.bookname_map.insert(book.bookname, book);
+  shard.author_map.insert(book.author, book);
   for(const auto &keyword: keyword_splitter(book.keyword_list))
-    keyword_map.insert(keyword, book);
+    shard.keyword_map.insert(keyword, book);
+  return true;
+}
+
+bool BookStore::BookDatabase::book_modify_info(
+  const BookType &old_book, BookType &modified_book, bool is_modified[6], std::pmr::memory_resource *resource) {
+  // latched in shard order, so that two of these never wait for each other.
+  size_t from = shard_of(old_book.isbn), to = is_modified[0] ? shard_of(modified_book.isbn) : from;
+  if(from > to) std::swap(from, to);
+  std::unique_lock first_lock(shards[from]->latch);
+  std::unique_lock second_lock(shards[to]->latch, std::defer_lock);
+  if(to != from) second_lock.lock();
+  return book_modify_locked(old_book, modified_book, is_modified, resource);
 }
 
-void BookStore::BookDatabase::book_modify_info(
-  const BookType &old_book, BookType &modified_book, bool is_modified[6]) {
+bool BookStore::BookDatabase::book_modify_locked(
+  const BookType &old_book, BookType &modified_book, bool is_modified[6], std::pmr::memory_resource *resource) {
+  StarryPurple::TraceSpan span("BookDatabase::book_modify_info", "database");
   if(!is_modified[0]) modified_book.isbn = old_book.isbn;
-  else expect(ISBN_map[modified_book.isbn].size()).toBe(0);
+  else if(!check(shards[shard_of(modified_book.isbn)]->ISBN_map.find(modified_book.isbn, resource).size()).toBe(0))
+    return false;
   if(!is_modified[1]) modified_book.bookname = old_book.bookname;
   if(!is_modified[2]) modified_book.author = old_book.author;
   if(!is_modified[3]) modified_book.keyword_list = old_book.keyword_list;
-  else {
-    for(int i = 0; i < modified_book.keyword_list.length(); ++i)
-      if(modified_book.keyword_list[i] == '|')
-        if(i == 0 || i == modified_book.keyword_list.length() - 1
-          || modified_book.keyword_list[i - 1] == '|'
-          || modified_book.keyword_list[i + 1] == '|')
-          throw StarryPurple::ValidatorException();
-    std::vector<BookInfoType> keyword_vector = keyword_splitter(modified_book.keyword_list);
-    std::set<BookInfoType> keyword_set;
-    for(const auto &keyword: keyword_vector)
-      keyword_set.insert(keyword);
-    expect(keyword_set.size()).toBe(keyword_vector.size());
-  }
+  else if(!is_keyword_list_valid(modified_book.keyword_list)) return false;
   if(!is_modified[4]) modified_book.price = old_book.price;
   if(!is_modified[5]) modified_book.storage = old_book.storage;
 
-  book_map.erase(0, old_book);
-  ISBN_map.erase(old_book.isbn, old_book);
-  bookname_map.erase(old_book.bookname, old_book);
-  author_map.erase(old_book.author, old_book);
-  for(const auto &keyword: keyword_splitter(old_book.keyword_list))
-    keyword_map.erase(keyword, old_book);
-
-  book_map.insert(0, modified_book);
-  ISBN_map.insert(modified_book.isbn, modified_book);
-  bookname_map.insert(modified_book.bookname, modified_book);
-  author_map.insert(modified_book.author, modified_book);
-  for(const auto &keyword: keyword_splitter(modified_book.keyword_list))
-    keyword_map.insert(keyword, modified_book);
+  const std::pmr::vector<BookInfoType> old_keywords = keyword_splitter(old_book.keyword_list, resource),
+    modified_keywords = keyword_splitter(modified_book.keyword_list, resource);
+  // move every index from one book to the other, and from its shard to the other's.
+  // One task per index, as no two share a file.
+  // Erase and insert are both no-ops when repeated, so moving back also undoes a half-done move.
+  struct IndexMoveType {
+    BookShardType *from_shard, *to_shard;
+    const BookType *from, *to;
+    const std::pmr::vector<BookInfoType> *from_keywords, *to_keywords;
+  };
+  // a task holds just a pointer to its move, small enough for std::function to keep without allocating.
+  auto index_tasks = [&](const IndexMoveType &move) {
+    std::pmr::vector<std::function<void()>> tasks(resource);
+    tasks.reserve(5);
+    tasks.emplace_back([m = &move]() {
+      m->from_shard->book_map.erase(0, *m->from);
+      m->to_shard->book_map.insert(0, *m->to);
+    });
+    tasks.emplace_back([m = &move]() {
+      m->from_shard->ISBN_map.erase(m->from->isbn, *m->from);
+      m->to_shard->ISBN_map.insert(m->to->isbn, *m->to);
+    });
+    tasks.emplace_back([m = &move]() {
+      m->from_shard->bookname_map.erase(m->from->bookname, *m->from);
+      m->to_shard->bookname_map.insert(m->to->bookname, *m->to);
+    });
+    tasks.emplace_back([m = &move]() {
+      m->from_shard->author_map.erase(m->from->author, *m->from);
+      m->to_shard->author_map.insert(m->to->author, *m->to);
+    });
+    tasks.emplace_back([m = &move]() {
+      for(const auto &keyword: *m->from_keywords) m->from_shard->keyword_map.erase(keyword, *m->from);
+      for(const auto &keyword: *m->to_keywords) m->to_shard->keyword_map.insert(keyword, *m->to);
+    });
+    return tasks;
+  };
+  BookShardType *old_shard = shards[shard_of(old_book.isbn)].get();
+  BookShardType *modified_shard = shards[shard_of(modified_book.isbn)].get();
+  const IndexMoveType forward{old_shard, modified_shard, &old_book, &modified_book, &old_keywords, &modified_keywords};
+  std::pmr::vector<std::function<void()>> tasks = index_tasks(forward);
+  try {
+    index_pool.run_all(tasks);
+  } catch(...) {
+    const IndexMoveType backward{modified_shard, old_shard, &modified_book, &old_book, &modified_keywords, &old_keywords};
+    for(auto &task: index_tasks(backward)) task();
+    throw;
+  }
+  if(is_modified[0]) sales_move(old_book.isbn, modified_book.isbn);
+  return true;
 }
 
+bool BookStore::BookDatabase::book_change_storage(
+  const ISBNType &ISBN, const QuantityType &quantity, BookType &book, std::pmr::memory_resource *resource) {
+  StarryPurple::TraceSpan span("BookDatabase::book_change_storage", "database");
+  std::unique_lock lock(shards[shard_of(ISBN)]->latch);
+  return book_change_storage_locked(ISBN, quantity, book, resource);
+}
 
-void BookStore::BookDatabase::book_change_storage(
-  const BookType &book, const QuantityType &quantity) {
+bool BookStore::BookDatabase::book_change_storage_locked(
+  const ISBNType &ISBN, const QuantityType &quantity, BookType &book, std::pmr::memory_resource *resource) {
+  const std::pmr::vector<BookType> book_vector = shards[shard_of(ISBN)]->ISBN_map.find(ISBN, resource);
+  if(!check(book_vector.size()).toBe(1)) return false;
+  book = book_vector[0];
   BookType modified_book;
   modified_book.storage = book.storage + quantity;
-  expect(modified_book.storage).greaterEqual(0);
+  if(!check(modified_book.storage).greaterEqual(0)) return false;
   bool is_modified[6] = {false, false, false, false, false, true};
-  book_modify_info(book, modified_book, is_modified);
+  return book_modify_locked(book, modified_book, is_modified, resource);
+}
+
+bool BookStore::BookDatabase::book_sellout(const ISBNType &ISBN, const QuantityType &quantity,
+  const TimestampType &day, BookType &book, std::pmr::memory_resource *resource) {
+  StarryPurple::TraceSpan span("BookDatabase::book_sellout", "database");
+  BookShardType &shard = *shards[shard_of(ISBN)];
+  std::unique_lock lock(shard.latch);
+  if(!book_change_storage_locked(ISBN, -quantity, book, resource)) return false;
+  const std::pmr::vector<SalesType> old_sales = shard.sales_map.find(ISBN, resource);
+  SalesType book_sales{ISBN};
+  if(!old_sales.empty()) {
+    book_sales = old_sales[0];
+    shard.sales_map.erase(ISBN, book_sales);
+    shard.bestseller_map.remove(bestseller_key(book_sales));
+  }
+  const TimestampType old_day = book_sales.day;
+  const QuantityType old_day_quantity = book_sales.day_quantity;
+  book_sales.quantity += quantity;
+  book_sales.income += book.price * quantity;
+  // the clock may go back. Keep the days of a book non-decreasing.
+  if(day > book_sales.day) {
+    book_sales.day = day;
+    book_sales.day_quantity = 0;
+  }
+  book_sales.day_quantity += quantity;
+  shard.sales_map.insert(ISBN, book_sales);
+  shard.bestseller_map.insert(bestseller_key(book_sales), book_sales);
+  if(!old_sales.empty() && old_day == book_sales.day) {
+    shard.day_sales_map.erase(ISBN, DaySalesType{old_day, old_day_quantity});
+  } else if(!old_sales.empty()) {
+    // a new day. Only the latest cSalesDayCount are reported, so the list never grows past that.
+    const std::pmr::vector<DaySalesType> days = shard.day_sales_map.find(ISBN, resource);
+    for(size_t i = 0; i + cSalesDayCount <= days.size(); ++i)
+      shard.day_sales_map.erase(ISBN, days[i]);
+  }
+  shard.day_sales_map.insert(ISBN, DaySalesType{book_sales.day, book_sales.day_quantity});
+  return true;
+}
+
+void BookStore::BookDatabase::sales_move(const ISBNType &old_ISBN, const ISBNType &modified_ISBN) {
+  BookShardType &old_shard = *shards[shard_of(old_ISBN)];
+  BookShardType &modified_shard = *shards[shard_of(modified_ISBN)];
+  const std::vector<SalesType> old_sales = old_shard.sales_map[old_ISBN];
+  if(old_sales.empty()) return;
+  SalesType book_sales = old_sales[0];
+  old_shard.sales_map.erase(old_ISBN, book_sales);
+  old_shard.bestseller_map.remove(bestseller_key(book_sales));
+  book_sales.isbn = modified_ISBN;
+  modified_shard.sales_map.insert(modified_ISBN, book_sales);
+  modified_shard.bestseller_map.insert(bestseller_key(book_sales), book_sales);
+  for(const DaySalesType &day_sales: old_shard.day_sales_map[old_ISBN]) {
+    old_shard.day_sales_map.erase(old_ISBN, day_sales);
+    modified_shard.day_sales_map.insert(modified_ISBN, day_sales);
+  }
+}
+
+std::pmr::vector<BookStore::BookDatabase::SalesType> BookStore::BookDatabase::find_bestsellers(
+  size_t count, std::pmr::memory_resource *resource) {
+  std::pmr::vector<SalesType> res(resource);
+  // every shard at once, so that no "buy" lands between two of them.
+  std::vector<std::shared_lock<std::shared_mutex>> locks;
+  locks.reserve(cBookShardCount);
+  for(auto &shard: shards)
+    locks.emplace_back(shard->latch);
+  for(auto &shard: shards) {
+    const std::pmr::vector<SalesType> top = shard->bestseller_map.find_first(count, resource);
+    res.insert(res.end(), top.begin(), top.end());
+  }
+  const auto is_better = [](const SalesType &lhs, const SalesType &rhs) {
+    return bestseller_key(lhs) < bestseller_key(rhs);
+  };
+  const size_t top_count = std::min(count, res.size());
+  std::partial_sort(res.begin(), res.begin() + top_count, res.end(), is_better);
+  res.resize(top_count);
+  return res;
+}
+
+bool BookStore::BookDatabase::find_sales(
+  const ISBNType &ISBN, SalesType &book_sales, std::pmr::vector<DaySalesType> &days) {
+  BookShardType &shard = *shards[shard_of(ISBN)];
+  std::shared_lock lock(shard.latch);
+  std::pmr::memory_resource *resource = days.get_allocator().resource();
+  const std::pmr::vector<SalesType> sales = shard.sales_map.find(ISBN, resource);
+  if(sales.empty()) return false;
+  book_sales = sales[0];
+  days = shard.day_sales_map.find(ISBN, resource);
+  std::reverse(days.begin(), days.end());
+  if(days.size() > cSalesDayCount) days.resize(cSalesDayCount);
+  return true;
 }
 
+bool BookStore::BookDatabase::book_import_catalog(std::vector<BookType> &books) {
+  StarryPurple::TraceSpan span("BookDatabase::book_import_catalog", "database");
+  for(const auto &book: books)
+    if(!is_keyword_list_valid(book.keyword_list)) return false;
+  std::sort(books.begin(), books.end());
+  if(std::adjacent_find(books.begin(), books.end()) != books.end()) return false;
+  std::vector<std::vector<BookType>> shard_books(cBookShardCount);
+  for(const auto &book: books)
+    shard_books[shard_of(book.isbn)].push_back(book); // still sorted
+  // all the shards, in order.
+  std::vector<std::unique_lock<std::shared_mutex>> locks;
+  for(auto &shard: shards)
+    locks.emplace_back(shard->latch);
+  for(size_t k = 0; k < cBookShardCount; ++k) {
+    if(shard_books[k].empty()) continue;
+    // both sorted, so one pass finds any ISBN already in.
+    const std::vector<BookType> existing = shards[k]->book_map[0];
+    auto it = existing.begin();
+    for(const auto &book: shard_books[k]) {
+      while(it != existing.end() && *it < book) ++it;
+      if(it != existing.end() && *it == book) return false;
+    }
+  }
+  // one task per index of every shard. No two share a file.
+  std::vector<std::function<void()>> tasks;
+  for(size_t k = 0; k < cBookShardCount; ++k) {
+    if(shard_books[k].empty()) continue;
+    BookShardType *shard = shards[k].get();
+    const std::vector<BookType> *batch = &shard_books[k];
+    tasks.emplace_back([shard, batch]() {
+      std::vector<std::pair<size_t, BookType>> entries;
+      for(const auto &book: *batch) entries.emplace_back(0, book);
+      shard->book_map.bulk_insert(std::move(entries));
+    });
+    tasks.emplace_back([shard, batch]() {
+      std::vector<std::pair<ISBNType, BookType>> entries;
+      for(const auto &book: *batch) entries.emplace_back(book.isbn, book);
+      shard->ISBN_map.bulk_insert(std::move(entries));
+    });
+    tasks.emplace_back([shard, batch]() {
+      std::vector<std::pair<BookInfoType, BookType>> entries;
+      for(const auto &book: *batch) entries.emplace_back(book.bookname, book);
+      shard->bookname_map.bulk_insert(std::move(entries));
+    });
+    tasks.emplace_back([shard, batch]() {
+      std::vector<std::pair<BookInfoType, BookType>> entries;
+      for(const auto &book: *batch) entries.emplace_back(book.author, book);
+      shard->author_map.bulk_insert(std::move(entries));
+    });
+    tasks.emplace_back([shard, batch]() {
+      std::vector<std::pair<BookInfoType, BookType>> entries;
+      for(const auto &book: *batch)
+        for(const auto &keyword: keyword_splitter(book.keyword_list))
+          entries.emplace_back(keyword, book);
+      shard->keyword_map.bulk_insert(std::move(entries));
+    });
+  }
+  index_pool.run_all(tasks);
+  return true;
+}
 
 
 
@@ -232,9 +676,28 @@ BookStore::LogDatabase::~LogDatabase() {
 void BookStore::LogDatabase::open(const std::string &prefix) {
   if(is_open) close();
   bool is_exist = log_info.open(prefix + "_log.bsdat");
-  all_log_id_map.open(prefix + "_log_id_map.bsdat");
-  finance_log_id_map.open(prefix + "_log_finance_id_map.bsdat");
-  employee_work_log_id_map.open(prefix + "_log_employee_work_map.bsdat");
+  all_log_stream.open(prefix + "_log_stream");
+  finance_log_id_list.open(prefix + "_log_finance_id_list.bsdat");
+  finance_index.open(prefix + "_log_finance_index.bsdat");
+  finance_segments.clear();
+  for(size_t first = 0; first < finance_index.size(); first += cFinanceSegmentLength) {
+    FinanceSegmentType segment{finance_index[first].timestamp, 0, 0};
+    if(first != 0) {
+      const FinanceIndexType last = finance_index[first - 1];
+      segment.income_before = last.total_income;
+      segment.expenditure_before = last.total_expenditure;
+    }
+    finance_segments.push_back(segment);
+  }
+  employee_work_log_id_list.open(prefix + "_log_employee_work_id_list.bsdat");
+  // only "report employee" / "show history" read them, and only some logs add to them.
+  employee_work_log_id_map.open_lazily(prefix + "_log_employee_work_id_map.bsdat");
+  deal_log_id_map.open_lazily(prefix + "_log_deal_id_map.bsdat");
+  actor_list.open(prefix + "_log_actor_list.bsdat");
+  actors = actor_list.read_range(0, actor_list.size());
+  actor_id_map.clear();
+  for(uint32_t i = 0; i < actors.size(); ++i)
+    actor_id_map[actors[i]] = i;
   is_open = true;
 
   if(is_exist)
@@ -244,6 +707,8 @@ void BookStore::LogDatabase::open(const std::string &prefix) {
     info.finance_log_count = 0;
     info.all_log_count = 0;
     info.total_income = 0;
+    info.total_expenditure = 0;
+    info.last_timestamp = 0;
   }
 }
 
@@ -252,22 +717,327 @@ void BookStore::LogDatabase::close() {
   log_info.write_info(info);
 
   log_info.close();
-  all_log_id_map.close();
-  finance_log_id_map.close();
+  all_log_stream.close();
+  finance_log_id_list.close();
+  finance_index.close();
+  employee_work_log_id_list.close();
   employee_work_log_id_map.close();
+  deal_log_id_map.close();
+  actor_list.close();
   is_open = false;
 }
 
-void BookStore::LogDatabase::add_log(
-  const PriceType &income, const PriceType &expenditure,
-  const LogDescriptionType &description, int log_level) {
-  info.total_income += income;
-  info.total_expenditure += expenditure;
-  LogType log(info.total_income, info.total_expenditure, description, true);
-  all_log_id_map.insert(++info.all_log_count, log);
-  if(log_level & 1)
-    employee_work_log_id_map.insert(++info.employee_work_log_count, log);
-  if(log_level & 2)
-    finance_log_id_map.insert(++info.finance_log_count, log);
+void BookStore::LogDatabase::snapshot_begin() {
+  // info is only written to the header at close().
+  log_info.write_info(info);
+  log_info.snapshot_begin();
+  all_log_stream.snapshot_begin();
+  finance_log_id_list.snapshot_begin();
+  finance_index.snapshot_begin();
+  employee_work_log_id_list.snapshot_begin();
+  employee_work_log_id_map.snapshot_begin();
+  deal_log_id_map.snapshot_begin();
+  actor_list.snapshot_begin();
+}
+
+void BookStore::LogDatabase::snapshot_write(const std::string &directory) {
+  log_info.snapshot_write(directory);
+  all_log_stream.snapshot_write(directory);
+  finance_log_id_list.snapshot_write(directory);
+  finance_index.snapshot_write(directory);
+  employee_work_log_id_list.snapshot_write(directory);
+  employee_work_log_id_map.snapshot_write(directory);
+  deal_log_id_map.snapshot_write(directory);
+  actor_list.snapshot_write(directory);
+}
+
+void BookStore::LogDatabase::snapshot_end() {
+  log_info.snapshot_end();
+  all_log_stream.snapshot_end();
+  finance_log_id_list.snapshot_end();
+  finance_index.snapshot_end();
+  employee_work_log_id_list.snapshot_end();
+  employee_work_log_id_map.snapshot_end();
+  deal_log_id_map.snapshot_end();
+  actor_list.snapshot_end();
 }
 
+void BookStore::LogDatabase::checkpoint() {
+  log_info.write_info(info);
+  log_info.checkpoint();
+  employee_work_log_id_map.checkpoint();
+  deal_log_id_map.checkpoint();
+}
+
+void BookStore::LogDatabase::add_log(const LogType &log, int log_level) {
+  StarryPurple::TraceSpan span("LogDatabase::add_log", "log");
+  std::unique_lock lock(latch);
+  const PriceType income_before = info.total_income, expenditure_before = info.total_expenditure;
+  info.total_income += log.income();
+  info.total_expenditure += log.expenditure();
+  LogType recorded_log = log;
+  recorded_log.total_income = info.total_income;
+  recorded_log.total_expenditure = info.total_expenditure;
+  recorded_log.id = ++info.all_log_count;
+  // the clock may go back. keep timestamps sorted for the finance index.
+  if(recorded_log.timestamp < info.last_timestamp)
+    recorded_log.timestamp = info.last_timestamp;
+  info.last_timestamp = recorded_log.timestamp;
+  log_encode(recorded_log, record_buffer);
+  all_log_stream.append(record_buffer);
+  // the views only keep the id of the log.
+  const bool has_actor = !recorded_log.actor.user_id.empty();
+  if(log_level & 1) {
+    employee_work_log_id_list.push_back(recorded_log.id);
+    if(has_actor)
+      employee_work_log_id_map.insert(recorded_log.actor.user_id, recorded_log.id);
+    ++info.employee_work_log_count;
+  }
+  if(recorded_log.opcode == LogOpcode::sellout && has_actor)
+    deal_log_id_map.insert(recorded_log.actor.user_id, recorded_log.id);
+  if(log_level & 2) {
+    finance_log_id_list.push_back(recorded_log.id);
+    if(finance_index.size() % cFinanceSegmentLength == 0)
+      finance_segments.push_back(
+        FinanceSegmentType{recorded_log.timestamp, income_before, expenditure_before});
+    finance_index.push_back(
+      FinanceIndexType{recorded_log.timestamp, info.total_income, info.total_expenditure});
+    ++info.finance_log_count;
+  }
+}
+
+void BookStore::LogDatabase::finance_lower_bound(
+  const TimestampType &t, PriceType &income, PriceType &expenditure) {
+  // the last segment beginning before t holds the bound.
+  auto it = std::partition_point(finance_segments.begin(), finance_segments.end(),
+    [&](const FinanceSegmentType &segment) { return segment.first_timestamp < t; });
+  if(it == finance_segments.begin()) {
+    income = expenditure = 0;
+    return;
+  }
+  --it;
+  const size_t first = (it - finance_segments.begin()) * cFinanceSegmentLength;
+  const std::vector<FinanceIndexType> entries = finance_index.read_range(
+    first, std::min(cFinanceSegmentLength, finance_index.size() - first));
+  // entries[0].timestamp < t always holds.
+  auto bound = std::partition_point(entries.begin() + 1, entries.end(),
+    [&](const FinanceIndexType &entry) { return entry.timestamp < t; });
+  income = (bound - 1)->total_income;
+  expenditure = (bound - 1)->total_expenditure;
+}
+
+void BookStore::LogDatabase::finance_between(
+  const TimestampType &since, const TimestampType &until,
+  PriceType &income, PriceType &expenditure) {
+  StarryPurple::TraceSpan span("LogDatabase::finance_between", "log");
+  std::shared_lock lock(latch);
+  income = expenditure = 0;
+  if(since >= until) return;
+  PriceType since_income, since_expenditure, until_income, until_expenditure;
+  finance_lower_bound(since, since_income, since_expenditure);
+  finance_lower_bound(until, until_income, until_expenditure);
+  income = until_income - since_income;
+  expenditure = until_expenditure - since_expenditure;
+}
+
+BookStore::LogType BookStore::LogDatabase::read_log(size_t log_id) {
+  StarryPurple::TraceSpan span("LogDatabase::read_log", "log");
+  std::string record;
+  all_log_stream.read(log_id, record);
+  LogType log;
+  log_decode(record, log, current_actors());
+  log.id = log_id;
+  return log;
+}
+
+BookStore::LogDatabase::InfoType BookStore::LogDatabase::current_info() {
+  std::shared_lock lock(latch);
+  return info;
+}
+
+std::vector<BookStore::LogUserType> BookStore::LogDatabase::current_actors() {
+  std::shared_lock lock(latch);
+  return actors;
+}
+
+std::vector<size_t> BookStore::LogDatabase::find_log_ids(
+  StarryPurple::Fmultimap<UserInfoType, size_t, cMaxFlowSize> &map, const UserInfoType &user) {
+  std::shared_lock lock(latch);
+  return map[user];
+}
+
+uint32_t BookStore::LogDatabase::actor_id(const LogUserType &user) {
+  auto it = actor_id_map.find(user);
+  if(it != actor_id_map.end())
+    return it->second;
+  uint32_t id = actors.size();
+  actors.push_back(user);
+  actor_list.push_back(user);
+  actor_id_map[user] = id;
+  return id;
+}
+
+namespace {
+
+// little-endian base-128 varint.
+void put_varint(std::string &record, uint64_t value) {
+  while(value >= 0x80) {
+    record += static_cast<char>((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  record += static_cast<char>(value);
+}
+
+uint64_t get_varint(const char *&pos) {
+  uint64_t value = 0;
+  for(int shift = 0; ; shift += 7) {
+    const unsigned char byte = *pos++;
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if(!(byte & 0x80)) return value;
+  }
+}
+
+template<int capacity>
+void put_str(std::string &record, const StarryPurple::ConstStr<capacity> &str) {
+  put_varint(record, str.length());
+  record.append(str.c_str(), str.length());
+}
+
+template<int capacity>
+void get_str(const char *&pos, StarryPurple::ConstStr<capacity> &str) {
+  const int len = get_varint(pos);
+  str = StarryPurple::ConstStr<capacity>(pos, len);
+  pos += len;
+}
+
+void put_price(std::string &record, const BookStore::PriceType &price) {
+  record.append(reinterpret_cast<const char *>(&price), sizeof(BookStore::PriceType));
+}
+
+void get_price(const char *&pos, BookStore::PriceType &price) {
+  memcpy(&price, pos, sizeof(BookStore::PriceType));
+  pos += sizeof(BookStore::PriceType);
+}
+
+} // namespace
+
+void BookStore::LogDatabase::log_encode(const LogType &log, std::string &record) {
+  record.clear();
+  record += static_cast<char>(log.opcode);
+  put_varint(record, log.timestamp);
+  switch(log.opcode) {
+  case LogOpcode::system_startup:
+  case LogOpcode::system_shutdown:
+    break;
+  case LogOpcode::login:
+  case LogOpcode::user_register:
+    put_varint(record, actor_id(log.target));
+    break;
+  case LogOpcode::logout:
+    put_varint(record, actor_id(log.actor));
+    break;
+  case LogOpcode::user_add:
+  case LogOpcode::user_unregister:
+    put_varint(record, actor_id(log.actor));
+    put_varint(record, actor_id(log.target));
+    break;
+  case LogOpcode::change_password:
+    put_varint(record, actor_id(log.target));
+    put_str(record, log.old_password);
+    put_str(record, log.new_password);
+    break;
+  case LogOpcode::reset_password:
+    put_varint(record, actor_id(log.target));
+    put_str(record, log.new_password);
+    break;
+  case LogOpcode::restock:
+  case LogOpcode::sellout:
+    put_varint(record, actor_id(log.actor));
+    put_str(record, log.book.isbn);
+    put_str(record, log.book.bookname);
+    put_varint(record, log.quantity);
+    put_price(record, log.amount);
+    put_price(record, log.total_income);
+    put_price(record, log.total_expenditure);
+    break;
+  case LogOpcode::modify_book:
+    put_varint(record, actor_id(log.actor));
+    for(const BookType *book: {&log.book, &log.modified_book}) {
+      put_str(record, book->isbn);
+      put_str(record, book->bookname);
+      put_str(record, book->author);
+      put_str(record, book->keyword_list);
+      put_price(record, book->price);
+      put_varint(record, book->storage);
+    }
+    break;
+  case LogOpcode::import_catalog:
+    put_varint(record, actor_id(log.actor));
+    put_varint(record, log.quantity);
+    break;
+  case LogOpcode::backup:
+    put_varint(record, actor_id(log.actor));
+    break;
+  }
+}
+
+void BookStore::LogDatabase::log_decode(
+  const std::string &record, LogType &log, const std::vector<LogUserType> &actor_table) {
+  const char *pos = record.data();
+  log = LogType(static_cast<LogOpcode>(*pos++));
+  log.timestamp = get_varint(pos);
+  switch(log.opcode) {
+  case LogOpcode::system_startup:
+  case LogOpcode::system_shutdown:
+    break;
+  case LogOpcode::login:
+  case LogOpcode::user_register:
+    log.target = actor_table[get_varint(pos)];
+    break;
+  case LogOpcode::logout:
+    log.actor = actor_table[get_varint(pos)];
+    break;
+  case LogOpcode::user_add:
+  case LogOpcode::user_unregister:
+    log.actor = actor_table[get_varint(pos)];
+    log.target = actor_table[get_varint(pos)];
+    break;
+  case LogOpcode::change_password:
+    log.target = actor_table[get_varint(pos)];
+    get_str(pos, log.old_password);
+    get_str(pos, log.new_password);
+    break;
+  case LogOpcode::reset_password:
+    log.target = actor_table[get_varint(pos)];
+    get_str(pos, log.new_password);
+    break;
+  case LogOpcode::restock:
+  case LogOpcode::sellout:
+    log.actor = actor_table[get_varint(pos)];
+    get_str(pos, log.book.isbn);
+    get_str(pos, log.book.bookname);
+    log.quantity = get_varint(pos);
+    get_price(pos, log.amount);
+    get_price(pos, log.total_income);
+    get_price(pos, log.total_expenditure);
+    break;
+  case LogOpcode::modify_book:
+    log.actor = actor_table[get_varint(pos)];
+    for(BookType *book: {&log.book, &log.modified_book}) {
+      get_str(pos, book->isbn);
+      get_str(pos, book->bookname);
+      get_str(pos, book->author);
+      get_str(pos, book->keyword_list);
+      get_price(pos, book->price);
+      book->storage = get_varint(pos);
+    }
+    break;
+  case LogOpcode::import_catalog:
+    log.actor = actor_table[get_varint(pos)];
+    log.quantity = get_varint(pos);
+    break;
+  case LogOpcode::backup:
+    log.actor = actor_table[get_varint(pos)];
+    break;
+  }
+}
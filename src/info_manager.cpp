@@ -1,135 +1,255 @@
 #include "info_manager.h"
 
-#include <iomanip>
+#include <chrono>
+#include <ctime>
 #include <set>
 
+namespace {
+
+// the local midnight beginning the day of @timestamp.
+// mktime isn't cheap, and "buy" asks for today over and over.
+BookStore::TimestampType day_of(BookStore::TimestampType timestamp) {
+  thread_local BookStore::TimestampType day_begin = 0, day_end = 0;
+  if(timestamp >= day_begin && timestamp < day_end) return day_begin;
+  const std::time_t time = timestamp;
+  std::tm local{};
+  localtime_r(&time, &local);
+  local.tm_hour = local.tm_min = local.tm_sec = 0;
+  local.tm_isdst = -1;
+  std::tm next = local;
+  ++next.tm_mday; // mktime carries it into the next month
+  day_begin = std::mktime(&local);
+  day_end = std::mktime(&next);
+  return day_begin;
+}
+
+// "YYYY-MM-DD", in local time
+std::string date_str(BookStore::TimestampType timestamp) {
+  const std::time_t time = timestamp;
+  std::tm local{};
+  localtime_r(&time, &local);
+  char buffer[16];
+  std::strftime(buffer, sizeof(buffer), "%Y-%m-%d", &local);
+  return buffer;
+}
+
+} // namespace
+
+BookStore::SessionType::SessionType(std::ostream &sink) : output(sink) {}
+
+BookStore::SessionType::SessionType(int fd) : output(fd) {}
+
 BookStore::UserManager::~UserManager() {
   if(is_running) close();
 }
 
 void BookStore::UserManager::open(const std::string &prefix) {
   if(is_running) close();
-  user_stack.open(prefix + "_stack");
-  user_database.open(prefix + "_database");
+  database_prefix = prefix + "_database";
+  user_database.open(database_prefix);
   is_running = true;
 }
 
 void BookStore::UserManager::close() {
   if(!is_running) return;
 
-  user_stack.clear();
-  user_stack.close();
+  logged_count.clear();
   user_database.close();
   is_running = false;
 }
 
-BookStore::LogType
-BookStore::UserManager::login(const UserInfoType &userID, const PasswordType &password) {
+bool
+BookStore::UserManager::login(
+  SessionType &session, const UserInfoType &userID, const PasswordType &password, LogType &log) {
+  StarryPurple::TraceSpan span("UserManager::login", "manager");
   std::vector<UserType> user_vector = user_database.user_id_map[userID];
-  expect(user_vector.size()).toBe(1);
+  if(!check(user_vector.size()).toBe(1)) return false;
   UserType user = user_vector[0];
-  expect(user.passwd).toBe(password); // Hey I swapped this line and the line below and still passed the test
-  user_stack.user_login(user);
+  if(!check(user.passwd).toBe(password)) return false; // Hey I swapped this line and the line below and still passed the test
+  session.user_stack.user_login(user);
+  ++logged_count[user.user_id];
 
-  return LogType(0, 0, LogDescriptionType(
-    user.user_identity_str() + " has logged in."));
+  log = LogType(LogOpcode::login);
+  log.target = LogUserType(user);
+  return true;
 }
 
 
-BookStore::LogType
-BookStore::UserManager::login(const UserInfoType &userID) {
+bool
+BookStore::UserManager::login(SessionType &session, const UserInfoType &userID, LogType &log) {
+  StarryPurple::TraceSpan span("UserManager::login", "manager");
   std::vector<UserType> user_vector = user_database.user_id_map[userID];
-  expect(user_vector.size()).toBe(1);
+  if(!check(user_vector.size()).toBe(1)) return false;
   UserType user = user_vector[0];
-  expect(user_stack.active_privilege()).greaterEqual(user.privilege);
-  user_stack.user_login(user);
+  if(!check(session.user_stack.active_privilege()).greaterEqual(user.privilege)) return false;
+  session.user_stack.user_login(user);
+  ++logged_count[user.user_id];
+
+  log = LogType(LogOpcode::login);
+  log.target = LogUserType(user);
+  return true;
+}
+
+void BookStore::UserManager::logout_all(SessionType &session) {
+  // no log for these, as with logouts at system shutdown.
+  while(!session.user_stack.empty()) {
+    const UserInfoType user_id = session.user_stack.active_user().user_id;
+    session.user_stack.user_logout();
+    if(--logged_count[user_id] == 0)
+      logged_count.erase(user_id);
+  }
+}
 
-  return LogType(0, 0, LogDescriptionType(
-    user.user_identity_str() + " has logged in."));
+bool BookStore::UserManager::has_privilege(SessionType &session, const UserPrivilege &privilege) {
+  if(!check(session.user_stack.active_privilege()).greaterEqual(privilege)) return false;
+  return true;
 }
 
-BookStore::LogType
-BookStore::UserManager::user_register(const UserType &user) {
+void BookStore::UserManager::begin(SessionType &session) {
+  session.saved_user_stack = session.user_stack;
+  user_database.begin();
+}
+
+void BookStore::UserManager::prepare_commit(StarryPurple::CommitJournal &journal) {
+  user_database.prepare_commit(journal);
+}
+
+void BookStore::UserManager::commit() {
+  user_database.commit();
+}
+
+void BookStore::UserManager::snapshot_begin() {
+  user_database.snapshot_begin();
+}
+
+void BookStore::UserManager::snapshot_write(const std::string &directory) {
+  user_database.snapshot_write(directory);
+}
+
+void BookStore::UserManager::snapshot_end() {
+  user_database.snapshot_end();
+}
+
+void BookStore::UserManager::checkpoint() {
+  user_database.checkpoint();
+}
+
+void BookStore::UserManager::database_close() {
+  user_database.close();
+}
+
+void BookStore::UserManager::database_open() {
+  user_database.open(database_prefix);
+}
+
+void BookStore::UserManager::abort(SessionType &session) {
+  user_database.abort();
+  // nobody else ran in the transaction, so only this session's logins need undoing.
+  logout_all(session);
+  session.user_stack = session.saved_user_stack;
+  for(const auto &logged_user: session.user_stack.u_stack)
+    ++logged_count[logged_user.user_id];
+}
+
+bool
+BookStore::UserManager::user_register(const UserType &user, LogType &log) {
+  StarryPurple::TraceSpan span("UserManager::user_register", "manager");
   std::vector<UserType> user_vector = user_database.user_id_map[user.user_id];
-  expect(user_vector.size()).toBe(0);
+  if(!check(user_vector.size()).toBe(0)) return false;
   user_database.user_register(user);
 
-  return LogType(0, 0, LogDescriptionType(
-    "New user registered: " + user.user_identity_str() + '.'));
+  log = LogType(LogOpcode::user_register);
+  log.target = LogUserType(user);
+  return true;
 }
 
-BookStore::LogType
-BookStore::UserManager::user_add(const UserType &user) {
-  expect(user_stack.active_privilege()).greaterEqual(UserPrivilege(3));
-  expect(user_stack.active_privilege()).Not().lesserEqual(user.privilege);
+bool
+BookStore::UserManager::user_add(SessionType &session, const UserType &user, LogType &log) {
+  StarryPurple::TraceSpan span("UserManager::user_add", "manager");
+  if(!check(session.user_stack.active_privilege()).greaterEqual(UserPrivilege(3))) return false;
+  if(!check(session.user_stack.active_privilege()).Not().lesserEqual(user.privilege)) return false;
   std::vector<UserType> user_vector = user_database.user_id_map[user.user_id];
-  expect(user_vector.size()).toBe(0);
+  if(!check(user_vector.size()).toBe(0)) return false;
   user_database.user_register(user);
 
-  return LogType(0, 0, LogDescriptionType(
-    user_stack.active_user().user_identity_str() + " has added a new user: " +
-    user.user_identity_str() + '.'));
+  log = LogType(LogOpcode::user_add);
+  log.actor = session.user_stack.active_user().log_identity();
+  log.target = LogUserType(user);
+  return true;
 }
 
 
 
-BookStore::LogType
+bool
 BookStore::UserManager::change_password(
-    const UserInfoType &userID,
-    const PasswordType &cur_pwd, const PasswordType &new_pwd) {
-  expect(user_stack.active_privilege()).greaterEqual(UserPrivilege(1));
+    SessionType &session, const UserInfoType &userID,
+    const PasswordType &cur_pwd, const PasswordType &new_pwd, LogType &log) {
+  StarryPurple::TraceSpan span("UserManager::change_password", "manager");
+  if(!check(session.user_stack.active_privilege()).greaterEqual(UserPrivilege(1))) return false;
   std::vector<UserType> user_vector = user_database.user_id_map[userID];
-  expect(user_vector.size()).toBe(1);
+  if(!check(user_vector.size()).toBe(1)) return false;
   UserType user = user_vector[0];
-  expect(user.passwd).toBe(cur_pwd);
+  if(!check(user.passwd).toBe(cur_pwd)) return false;
   user_database.user_id_map.erase(userID, user);
   user.passwd = new_pwd;
   user_database.user_id_map.insert(userID, user);
 
-  return LogType(0, 0, LogDescriptionType(
-    user.user_identity_str() + " has changed password from \"" +
-    cur_pwd.to_str() + "\" to \"" + new_pwd.to_str() + "\"."));
+  log = LogType(LogOpcode::change_password);
+  log.target = LogUserType(user);
+  log.old_password = cur_pwd;
+  log.new_password = new_pwd;
+  return true;
 }
 
-BookStore::LogType
+bool
 BookStore::UserManager::change_password(
-  const UserInfoType &userID,
-  const PasswordType &new_pwd) {
-  expect(user_stack.active_privilege()).greaterEqual(UserPrivilege(7));
+  SessionType &session, const UserInfoType &userID,
+  const PasswordType &new_pwd, LogType &log) {
+  StarryPurple::TraceSpan span("UserManager::change_password", "manager");
+  if(!check(session.user_stack.active_privilege()).greaterEqual(UserPrivilege(7))) return false;
   std::vector<UserType> user_vector = user_database.user_id_map[userID];
-  expect(user_vector.size()).toBe(1);
+  if(!check(user_vector.size()).toBe(1)) return false;
   UserType user = user_vector[0];
   user_database.user_id_map.erase(userID, user);
   user.passwd = new_pwd;
   user_database.user_id_map.insert(userID, user);
 
-  return LogType(0, 0, LogDescriptionType(
-    user.user_identity_str() + " has changed password to \"" +
-    new_pwd.to_str() + "\"."));
+  log = LogType(LogOpcode::reset_password);
+  log.target = LogUserType(user);
+  log.new_password = new_pwd;
+  return true;
 }
 
-BookStore::LogType
-BookStore::UserManager::logout() {
-  expect(user_stack.active_privilege()).greaterEqual(UserPrivilege(1));
-  expect(user_stack.empty()).toBe(false);
+bool
+BookStore::UserManager::logout(SessionType &session, LogType &log) {
+  StarryPurple::TraceSpan span("UserManager::logout", "manager");
+  if(!check(session.user_stack.active_privilege()).greaterEqual(UserPrivilege(1))) return false;
+  if(!check(session.user_stack.empty()).toBe(false)) return false;
   // remember to record before user trully logout.
-  LogType log = LogType(0, 0, LogDescriptionType(
-    user_stack.active_user().user_identity_str() + " has logged out."));
-  user_stack.user_logout();
-  return log;
-}
-
-BookStore::LogType
-BookStore::UserManager::user_unregister(const UserInfoType &userID) {
-  expect(user_stack.active_privilege()).greaterEqual(UserPrivilege(7));
-  expect(user_stack.logged_set.count(userID)).toBe(0);
+  log = LogType(LogOpcode::logout);
+  log.actor = session.user_stack.active_user().log_identity();
+  const UserInfoType user_id = session.user_stack.active_user().user_id;
+  session.user_stack.user_logout();
+  if(--logged_count[user_id] == 0)
+    logged_count.erase(user_id);
+  return true;
+}
+
+bool
+BookStore::UserManager::user_unregister(
+  SessionType &session, const UserInfoType &userID, LogType &log) {
+  StarryPurple::TraceSpan span("UserManager::user_unregister", "manager");
+  if(!check(session.user_stack.active_privilege()).greaterEqual(UserPrivilege(7))) return false;
+  if(!check(logged_count.count(userID)).toBe(0)) return false;
   std::vector<UserType> user_list = user_database.user_id_map[userID];
-  expect(user_list.size()).toBe(1);
+  if(!check(user_list.size()).toBe(1)) return false;
   UserType user = user_list[0];
   user_database.user_unregister(user);
 
-  return LogType(0, 0, LogDescriptionType(
-    user.user_identity_str() + " has been unregistered."));
+  log = LogType(LogOpcode::user_unregister);
+  log.actor = session.user_stack.active_user().log_identity();
+  log.target = LogUserType(user);
+  return true;
 }
 
 
@@ -144,7 +264,8 @@ BookStore::BookManager::~BookManager() {
 
 void BookStore::BookManager::open(const std::string &prefix) {
   if(is_running) close();
-  book_database.open(prefix + "_database");
+  database_prefix = prefix + "_database";
+  book_database.open(database_prefix);
   is_running = true;
 }
 
@@ -154,120 +275,238 @@ void BookStore::BookManager::close() {
   is_running = false;
 }
 
-void BookStore::BookManager::select_book(const ISBNType &ISBN) {
-  expect(user_stack_ptr->active_privilege()).greaterEqual(UserPrivilege(3));
-  std::vector<BookType> book_vector = book_database.ISBN_map[ISBN];
+void BookStore::BookManager::begin(SessionType &session) {
+  session.renamed_ISBNs.clear();
+  book_database.begin();
+}
+
+void BookStore::BookManager::prepare_commit(StarryPurple::CommitJournal &journal) {
+  book_database.prepare_commit(journal);
+}
+
+void BookStore::BookManager::commit(SessionType &session) {
+  session.renamed_ISBNs.clear();
+  book_database.commit();
+}
+
+void BookStore::BookManager::abort(SessionType &session) {
+  book_database.abort();
+  // this session gets its own stack back from UserManager.
+  for(auto it = session.renamed_ISBNs.rbegin(); it != session.renamed_ISBNs.rend(); ++it)
+    for(SessionType *other: *sessions_ptr)
+      if(other != &session)
+        other->user_stack.update_ISBN(it->second, it->first);
+  session.renamed_ISBNs.clear();
+}
+
+bool BookStore::BookManager::select_book(SessionType &session, const ISBNType &ISBN) {
+  StarryPurple::TraceSpan span("BookManager::select_book", "manager");
+  if(!check(session.user_stack.active_privilege()).greaterEqual(UserPrivilege(3))) return false;
+  const std::pmr::vector<BookType> book_vector = book_database.find_ISBN(ISBN, &session.arena);
   if(book_vector.size() == 0) {
     BookType book;
     book.isbn = ISBN;
-    book_database.book_register(book);
-    user_stack_ptr->user_select_book(ISBN);
+    if(!book_database.book_register(book)) return false;
+    session.user_stack.user_select_book(ISBN);
   } else if(book_vector.size() == 1) {
-    user_stack_ptr->user_select_book(book_vector[0].isbn);
+    session.user_stack.user_select_book(book_vector[0].isbn);
   } // else assert(false);
+  return true;
 }
 
-void BookStore::BookManager::list_all() {
-  expect(user_stack_ptr->active_privilege()).greaterEqual(UserPrivilege(1));
-  std::vector<BookType> book_vector = book_database.book_map[0];
+bool BookStore::BookManager::list_all(SessionType &session) {
+  StarryPurple::TraceSpan span("BookManager::list_all", "manager");
+  if(!check(session.user_stack.active_privilege()).greaterEqual(UserPrivilege(1))) return false;
+  const std::pmr::vector<BookType> book_vector = book_database.find_all(&session.arena);
   if(book_vector.empty())
-    std::cout << '\n';
+    session.output << '\n';
   else
     for(const auto &book: book_vector)
-      book.print();
+      book.print(session.output);
+  return true;
 }
 
 
-void BookStore::BookManager::list_ISBN(const ISBNType &ISBN) {
-  expect(user_stack_ptr->active_privilege()).greaterEqual(UserPrivilege(1));
-  expect(ISBN.empty()).toBe(false);
-  std::vector<BookType> book_vector = book_database.ISBN_map[ISBN];
+bool BookStore::BookManager::list_ISBN(SessionType &session, const ISBNType &ISBN) {
+  StarryPurple::TraceSpan span("BookManager::list_ISBN", "manager");
+  if(!check(session.user_stack.active_privilege()).greaterEqual(UserPrivilege(1))) return false;
+  if(!check(ISBN.empty()).toBe(false)) return false;
+  const std::pmr::vector<BookType> book_vector = book_database.find_ISBN(ISBN, &session.arena);
   if(book_vector.empty())
-    std::cout << '\n';
+    session.output << '\n';
   else
     for(const auto &book: book_vector)
-      book.print();
+      book.print(session.output);
+  return true;
 }
 
-void BookStore::BookManager::list_bookname(const BookInfoType &bookname) {
-  expect(user_stack_ptr->active_privilege()).greaterEqual(UserPrivilege(1));
-  expect(bookname.empty()).toBe(false);
-  std::vector<BookType> book_vector = book_database.bookname_map[bookname];
+bool BookStore::BookManager::list_bookname(SessionType &session, const BookInfoType &bookname) {
+  StarryPurple::TraceSpan span("BookManager::list_bookname", "manager");
+  if(!check(session.user_stack.active_privilege()).greaterEqual(UserPrivilege(1))) return false;
+  if(!check(bookname.empty()).toBe(false)) return false;
+  const std::pmr::vector<BookType> book_vector = book_database.find_bookname(bookname, &session.arena);
   if(book_vector.empty())
-    std::cout << '\n';
+    session.output << '\n';
   else
     for(const auto &book: book_vector)
-      book.print();
+      book.print(session.output);
+  return true;
 }
 
-void BookStore::BookManager::list_author(const BookInfoType &author) {
-  expect(user_stack_ptr->active_privilege()).greaterEqual(UserPrivilege(1));
-  expect(author.empty()).toBe(false);
-  std::vector<BookType> book_vector = book_database.author_map[author];
+bool BookStore::BookManager::list_author(SessionType &session, const BookInfoType &author) {
+  StarryPurple::TraceSpan span("BookManager::list_author", "manager");
+  if(!check(session.user_stack.active_privilege()).greaterEqual(UserPrivilege(1))) return false;
+  if(!check(author.empty()).toBe(false)) return false;
+  const std::pmr::vector<BookType> book_vector = book_database.find_author(author, &session.arena);
   if(book_vector.empty())
-    std::cout << '\n';
+    session.output << '\n';
   else
     for(const auto &book: book_vector)
-      book.print();
+      book.print(session.output);
+  return true;
 }
 
-void BookStore::BookManager::list_keyword(const BookInfoType &keyword) {
-  expect(user_stack_ptr->active_privilege()).greaterEqual(UserPrivilege(1));
-  expect(keyword.empty()).toBe(false);
+bool BookStore::BookManager::list_keyword(SessionType &session, const BookInfoType &keyword) {
+  StarryPurple::TraceSpan span("BookManager::list_keyword", "manager");
+  if(!check(session.user_stack.active_privilege()).greaterEqual(UserPrivilege(1))) return false;
+  if(!check(keyword.empty()).toBe(false)) return false;
   for(int i = 0; i < keyword.length(); ++i)
-    expect(keyword[i]).Not().toBe('|');  // True?
-  std::vector<BookType> book_vector = book_database.keyword_map[keyword];
+    if(!check(keyword[i]).Not().toBe('|')) return false;  // True?
+  const std::pmr::vector<BookType> book_vector = book_database.find_keyword(keyword, &session.arena);
   if(book_vector.empty())
-    std::cout << '\n';
+    session.output << '\n';
   else
     for(const auto &book: book_vector)
-      book.print();
+      book.print(session.output);
+  return true;
+}
+
+bool BookStore::BookManager::restock(
+  SessionType &session, const QuantityType &quantity, const PriceType &total_cost, LogType &log) {
+  StarryPurple::TraceSpan span("BookManager::restock", "manager");
+  if(!check(session.user_stack.active_privilege()).greaterEqual(UserPrivilege(3))) return false;
+  if(!check(session.user_stack.active_user().has_selected_book).toBe(true)) return false;
+  if(!check(quantity).Not().lesserEqual(0)) return false;
+  if(!check(total_cost).Not().lesserEqual(0.0)) return false;
+  ISBNType ISBN = session.user_stack.active_user().ISBN_selected;
+  BookType book;
+  if(!book_database.book_change_storage(ISBN, quantity, book, &session.arena)) return false;
+
+  log = LogType(LogOpcode::restock);
+  log.actor = session.user_stack.active_user().log_identity();
+  log.book = book;
+  log.quantity = quantity;
+  log.amount = total_cost;
+  return true;
+}
+
+bool BookStore::BookManager::sellout(
+  SessionType &session, const ISBNType &ISBN, const QuantityType &quantity, LogType &log) {
+  StarryPurple::TraceSpan span("BookManager::sellout", "manager");
+  if(!check(session.user_stack.active_privilege()).greaterEqual(UserPrivilege(1))) return false;
+  if(!check(quantity).Not().lesserEqual(0)) return false;
+  BookType book;
+  const TimestampType today = day_of(std::chrono::duration_cast<std::chrono::seconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count());
+  if(!book_database.book_sellout(ISBN, quantity, today, book, &session.arena)) return false;
+  session.output.write_price(book.price * quantity) << '\n';
+
+  log = LogType(LogOpcode::sellout);
+  log.actor = session.user_stack.active_user().log_identity();
+  log.book = book;
+  log.quantity = quantity;
+  log.amount = book.price * quantity;
+  return true;
+}
+
+bool BookStore::BookManager::report_bestsellers(SessionType &session, size_t count) {
+  StarryPurple::TraceSpan span("BookManager::report_bestsellers", "manager");
+  if(!check(session.user_stack.active_privilege()).greaterEqual(UserPrivilege(7))) return false;
+  const std::pmr::vector<BookDatabase::SalesType> bestsellers =
+    book_database.find_bestsellers(count, &session.arena);
+  session.output << "Now reporting the top ";
+  session.output.write_int(count) << " bestsellers.\n";
+  size_t i = 0;
+  for(const auto &book_sales: bestsellers) {
+    const std::pmr::vector<BookType> book_vector = book_database.find_ISBN(book_sales.isbn, &session.arena);
+    if(!check(book_vector.size()).toBe(1)) continue; // a sold book is never gone
+    ++i;
+    session.output.write_int(i, 6) << " |--" << book_vector[0].book_brief_identity_str() << ": ";
+    session.output.write_int(book_sales.quantity) << " sold, earned ";
+    session.output.write_price(book_sales.income) << '\n';
+  }
+  session.output << "Bestsellers report ends here.\n";
+  return true;
+}
+
+bool BookStore::BookManager::report_sales(SessionType &session, const ISBNType &ISBN) {
+  StarryPurple::TraceSpan span("BookManager::report_sales", "manager");
+  if(!check(session.user_stack.active_privilege()).greaterEqual(UserPrivilege(7))) return false;
+  const std::pmr::vector<BookType> book_vector = book_database.find_ISBN(ISBN, &session.arena);
+  if(!check(book_vector.size()).toBe(1)) return false;
+  BookDatabase::SalesType book_sales;
+  std::pmr::vector<BookDatabase::DaySalesType> days(&session.arena);
+  book_database.find_sales(ISBN, book_sales, days); // all zero if never sold
+  session.output << "Now reporting sales of " << book_vector[0].book_brief_identity_str() << ".\n";
+  session.output << "Sold: ";
+  session.output.write_int(book_sales.quantity) << '\n' << "Earned: ";
+  session.output.write_price(book_sales.income) << '\n';
+  for(const auto &day_sales: days) {
+    session.output << "          " << date_str(day_sales.day) << ": ";
+    session.output.write_int(day_sales.quantity) << " sold\n";
+  }
+  session.output << "Sales report ends here.\n";
+  return true;
+}
+
+bool BookStore::BookManager::import_catalog(
+  SessionType &session, std::vector<BookType> &books, LogType &log) {
+  StarryPurple::TraceSpan span("BookManager::import_catalog", "manager");
+  if(!check(session.user_stack.active_privilege()).greaterEqual(UserPrivilege(3))) return false;
+  if(!check(books.empty()).toBe(false)) return false;
+  if(!book_database.book_import_catalog(books)) return false;
+
+  log = LogType(LogOpcode::import_catalog);
+  log.actor = session.user_stack.active_user().log_identity();
+  log.quantity = books.size();
+  return true;
 }
 
-BookStore::LogType BookStore::BookManager::restock(
-  const QuantityType &quantity, const PriceType &total_cost) {
-  expect(user_stack_ptr->active_privilege()).greaterEqual(UserPrivilege(3));
-  expect(user_stack_ptr->active_user().has_selected_book).toBe(true);
-  expect(quantity).Not().lesserEqual(0);
-  expect(total_cost).Not().lesserEqual(0.0);
-  ISBNType ISBN = user_stack_ptr->active_user().ISBN_selected;
-  std::vector<BookType> book_vector = book_database.ISBN_map[ISBN];
-  expect(book_vector.size()).toBe(1);
-  BookType book = book_vector[0];
-  book_database.book_change_storage(book, quantity);
+void BookStore::BookManager::snapshot_begin() {
+  book_database.snapshot_begin();
+}
 
-  return LogType(0, total_cost, LogDescriptionType(
-  user_stack_ptr->active_user().user_identity_str() + " has restocked " +
-  std::to_string(quantity) + " book(s): "
-  + book.book_brief_identity_str() + " at price " + StarryPurple::dtos(total_cost) + '.'));
+void BookStore::BookManager::snapshot_write(const std::string &directory) {
+  book_database.snapshot_write(directory);
 }
 
-BookStore::LogType BookStore::BookManager::sellout(const ISBNType &ISBN, const QuantityType &quantity) {
-  expect(user_stack_ptr->active_privilege()).greaterEqual(UserPrivilege(1));
-  expect(quantity).Not().lesserEqual(0);
-  std::vector<BookType> book_vector = book_database.ISBN_map[ISBN];
-  expect(book_vector.size()).toBe(1);
-  BookType book = book_vector[0];
-  book_database.book_change_storage(book, -quantity); // remember this '-'
-  std::cout << std::fixed << std::setprecision(2) << (book.price * quantity) << '\n';
+void BookStore::BookManager::snapshot_end() {
+  book_database.snapshot_end();
+}
 
+void BookStore::BookManager::checkpoint() {
+  book_database.checkpoint();
+}
 
-  return LogType(book.price * quantity, 0, LogDescriptionType(
-    user_stack_ptr->active_user().user_identity_str() + " has bought " +
-    std::to_string(quantity) + " book(s): "
-    + book.book_brief_identity_str() + " at price " + StarryPurple::dtos(book.price * quantity) + '.'));
+void BookStore::BookManager::database_close() {
+  book_database.close();
 }
 
-BookStore::LogType
+void BookStore::BookManager::database_open() {
+  book_database.open(database_prefix);
+}
+
+bool
 BookStore::BookManager::modify_book(
-  const ISBNType &ISBN, const BookInfoType &bookname,const BookInfoType &author,
-  const BookInfoType &keyword_list, const PriceType &price, bool is_modified[5]) {
-  expect(user_stack_ptr->active_privilege()).greaterEqual(UserPrivilege(3));
-  expect(user_stack_ptr->active_user().has_selected_book).toBe(true);
-  ISBNType old_ISBN = user_stack_ptr->active_user().ISBN_selected;
-  std::vector<BookType> book_vector = book_database.ISBN_map[old_ISBN];
+  SessionType &session, const ISBNType &ISBN, const BookInfoType &bookname,const BookInfoType &author,
+  const BookInfoType &keyword_list, const PriceType &price, bool is_modified[5], LogType &log) {
+  StarryPurple::TraceSpan span("BookManager::modify_book", "manager");
+  if(!check(session.user_stack.active_privilege()).greaterEqual(UserPrivilege(3))) return false;
+  if(!check(session.user_stack.active_user().has_selected_book).toBe(true)) return false;
+  ISBNType old_ISBN = session.user_stack.active_user().ISBN_selected;
+  const std::pmr::vector<BookType> book_vector = book_database.find_ISBN(old_ISBN, &session.arena);
   // assert(book_vector.size() == 1); // Needed?
-  expect(book_vector.size()).toBe(1);
+  if(!check(book_vector.size()).toBe(1)) return false;
   BookType old_book = book_vector[0];
   BookType modified_book;
   modified_book.isbn = ISBN; modified_book.bookname = bookname;
@@ -275,17 +514,20 @@ BookStore::BookManager::modify_book(
   modified_book.keyword_list = keyword_list; modified_book.price = price;
   bool is_to_modify[6] =
     {is_modified[0], is_modified[1], is_modified[2], is_modified[3], is_modified[4], false};
-  book_database.book_modify_info(old_book, modified_book, is_to_modify);
+  if(!book_database.book_modify_info(old_book, modified_book, is_to_modify, &session.arena)) return false;
   if(is_modified[0]) {
-    // modify all old_isbn in the user_stack to new_isbn.
+    // modify all old_isbn in every session's user_stack to new_isbn.
     // modified_book here is a truthfully modified one, not with some uncertainties.
-    user_stack_ptr->update_ISBN(old_ISBN, modified_book.isbn);
+    for(SessionType *other: *sessions_ptr)
+      other->user_stack.update_ISBN(old_ISBN, modified_book.isbn);
+    if(session.in_transaction)
+      session.renamed_ISBNs.emplace_back(old_ISBN, modified_book.isbn);
   }
-  return LogType(0, 0, LogDescriptionType(
-    user_stack_ptr->active_user().user_identity_str() + " has modified information of one book." +
-    " Detailed information:"+
-    "\n          \tPreviously: " + old_book.book_full_identity_str() +
-    "\n          \tNow:        " + modified_book.book_full_identity_str()));
+  log = LogType(LogOpcode::modify_book);
+  log.actor = session.user_stack.active_user().log_identity();
+  log.book = old_book;
+  log.modified_book = modified_book;
+  return true;
 }
 
 
@@ -296,91 +538,212 @@ BookStore::LogManager::~LogManager() {
 
 void BookStore::LogManager::open(const std::string &prefix) {
   if(is_running) close();
-  log_database.open(prefix + "_database");
+  database_prefix = prefix + "_database";
+  log_database.open(database_prefix);
+  log_writer = std::thread(&LogManager::log_writer_loop, this);
   is_running = true;
 }
 
 void BookStore::LogManager::close() {
   if(!is_running) return;
+  log_queue.push(LogTaskType{LogType(), -1});
+  log_writer.join();
   log_database.close();
   is_running = false;
 }
 
-void BookStore::LogManager::show_deal_history(const LogCountType &count) {
-  expect(user_stack_ptr->active_privilege()).greaterEqual(UserPrivilege(7));
-  expect(count).greaterEqual(0);
-  expect(count).lesserEqual(log_database.info.finance_log_count);
-  if(count == 0) {
-    std::cout << '\n';
-    return;
+void BookStore::LogManager::log_writer_loop() {
+  while(true) {
+    LogTaskType &task = log_queue.front();
+    if(task.log_level < 0) {
+      log_queue.pop();
+      return;
+    }
+    log_database.add_log(task.log, task.log_level);
+    log_queue.pop();
   }
-  if(count == log_database.info.finance_log_count) {
-    show_deal_history();
-    return;
-  }
-  LogType history_log = log_database.finance_log_id_map[log_database.info.finance_log_count - count][0];
-  std::cout << "+ " << std::fixed << std::setprecision(2) <<
-    log_database.info.total_income - history_log.total_income
-  << " - " << log_database.info.total_expenditure - history_log.total_expenditure << '\n';
 }
 
-void BookStore::LogManager::show_deal_history() {
-  expect(user_stack_ptr->active_privilege()).greaterEqual(UserPrivilege(7));
-  std::cout << "+ " << std::fixed << std::setprecision(2) <<
-    log_database.info.total_income << " - " << log_database.info.total_expenditure << '\n';
+void BookStore::LogManager::flush() {
+  StarryPurple::TraceSpan span("LogManager::flush", "log");
+  log_queue.flush();
 }
 
-void BookStore::LogManager::report_finance() {
-  expect(user_stack_ptr->active_privilege()).greaterEqual(UserPrivilege(7));
-  std::cout << "Now reporting finance history.\n";
-  LogType log;
-  PriceType history_income = 0, history_expenditure = 0;
-  for(size_t i = 1; i <= log_database.info.finance_log_count; ++i) {
-    log = log_database.finance_log_id_map[i][0];
+bool BookStore::LogManager::snapshot_begin(SessionType &session, LogType &log) {
+  if(!check(session.user_stack.active_privilege()).greaterEqual(UserPrivilege(7))) return false;
+  flush();
+  log_database.snapshot_begin();
 
-    std::cout << std::setw(6) << i ;
-    std::cout << " |--" << log.log_description.to_str() << '\n';
+  log = LogType(LogOpcode::backup);
+  log.actor = session.user_stack.active_user().log_identity();
+  return true;
+}
 
-    if(log.total_income - history_income != 0)
-      std::cout << "          Earned: " << std::fixed << std::setprecision(2) <<
-        log.total_income - history_income << '\n';
-    else if(log.total_expenditure - history_expenditure != 0)
-      std::cout << "          Used: " << std::fixed << std::setprecision(2) <<
-        log.total_expenditure - history_expenditure << '\n';
+void BookStore::LogManager::snapshot_write(const std::string &directory) {
+  log_database.snapshot_write(directory);
+}
 
-    history_income = log.total_income;
-    history_expenditure = log.total_expenditure;
-  }
-  std::cout << '\n' << "Total history income: " << std::fixed << std::setprecision(2) <<
-    history_income << '\n' << "Total history expenditure: " <<
-      history_expenditure << '\n';
-  std::cout << "Finance history report ends here.\n";
-}
-
-void BookStore::LogManager::report_employee() {
-  expect(user_stack_ptr->active_privilege()).greaterEqual(UserPrivilege(7));
-  std::cout << "Now reporting employee working history.\n";
-  LogType log;
-  for(size_t i = 1; i <= log_database.info.employee_work_log_count; ++i) {
-    log = log_database.employee_work_log_id_map[i][0];
-    std::cout << std::setw(6) << i ;
-    std::cout << " |--" << log.log_description.to_str() << '\n';
-  }
-  std::cout << "Employee working history report ends here.\n";
+void BookStore::LogManager::snapshot_end() {
+  log_database.snapshot_end();
+}
+
+void BookStore::LogManager::checkpoint() {
+  flush();
+  log_database.checkpoint();
+}
+
+void BookStore::LogManager::database_close() {
+  log_database.close();
 }
 
-void BookStore::LogManager::report_history() {
-  expect(user_stack_ptr->active_privilege()).greaterEqual(UserPrivilege(7));
-  std::cout << "Now reporting system history.\n";
-  for(size_t i = 1; i <= log_database.info.all_log_count; ++i) {
-    LogType log = log_database.all_log_id_map[i][0];
-    std::cout << std::setw(6) << i ;
-    std::cout << " |--" << log.log_description.to_str() << '\n';
+void BookStore::LogManager::database_open() {
+  log_database.open(database_prefix);
+}
+
+bool BookStore::LogManager::show_deal_history(SessionType &session, const LogCountType &count) {
+  StarryPurple::TraceSpan span("LogManager::show_deal_history", "manager");
+  if(!check(session.user_stack.active_privilege()).greaterEqual(UserPrivilege(7))) return false;
+  flush();
+  const LogDatabase::InfoType info = log_database.current_info();
+  if(!check(count).greaterEqual(0)) return false;
+  if(!check(count).lesserEqual(info.finance_log_count)) return false;
+  if(count == 0) {
+    session.output << '\n';
+    return true;
   }
-  std::cout << "System history report ends here.\n";
+  // the totals before the first of them, from the same pinned info.
+  LogDatabase::FinanceIndexType history{0, 0, 0};
+  if(count != info.finance_log_count)
+    history = log_database.finance_index[info.finance_log_count - count - 1];
+  session.output << "+ ";
+  session.output.write_price(info.total_income - history.total_income) << " - ";
+  session.output.write_price(info.total_expenditure - history.total_expenditure) << '\n';
+  return true;
+}
+
+bool BookStore::LogManager::show_deal_history(
+  SessionType &session, const TimestampType &since, const TimestampType &until) {
+  StarryPurple::TraceSpan span("LogManager::show_deal_history", "manager");
+  if(!check(session.user_stack.active_privilege()).greaterEqual(UserPrivilege(7))) return false;
+  flush();
+  PriceType income, expenditure;
+  log_database.finance_between(since, until, income, expenditure);
+  session.output << "+ ";
+  session.output.write_price(income) << " - ";
+  session.output.write_price(expenditure) << '\n';
+  return true;
+}
+
+bool BookStore::LogManager::show_deal_history(SessionType &session) {
+  StarryPurple::TraceSpan span("LogManager::show_deal_history", "manager");
+  if(!check(session.user_stack.active_privilege()).greaterEqual(UserPrivilege(7))) return false;
+  flush();
+  const LogDatabase::InfoType info = log_database.current_info();
+  session.output << "+ ";
+  session.output.write_price(info.total_income) << " - ";
+  session.output.write_price(info.total_expenditure) << '\n';
+  return true;
+}
+
+bool BookStore::LogManager::report_finance(SessionType &session) {
+  StarryPurple::TraceSpan span("LogManager::report_finance", "manager");
+  if(!check(session.user_stack.active_privilege()).greaterEqual(UserPrivilege(7))) return false;
+  flush();
+  const LogDatabase::InfoType info = log_database.current_info();
+  session.output << "Now reporting finance history.\n";
+  PriceType history_income = 0, history_expenditure = 0;
+  size_t i = 0;
+  log_database.read_logs(
+    log_database.finance_log_id_list.read_range(0, info.finance_log_count),
+    [&](const LogType &log) {
+    ++i;
+    session.output.write_int(i, 6) << " |--" << log.description() << '\n';
+
+    if(log.total_income - history_income != 0) {
+      session.output << "          Earned: ";
+      session.output.write_price(log.total_income - history_income) << '\n';
+    } else if(log.total_expenditure - history_expenditure != 0) {
+      session.output << "          Used: ";
+      session.output.write_price(log.total_expenditure - history_expenditure) << '\n';
+    }
+
+    history_income = log.total_income;
+    history_expenditure = log.total_expenditure;
+  });
+  session.output << '\n' << "Total history income: ";
+  session.output.write_price(history_income) << '\n' << "Total history expenditure: ";
+  session.output.write_price(history_expenditure) << '\n';
+  session.output << "Finance history report ends here.\n";
+  return true;
+}
+
+bool BookStore::LogManager::report_employee(SessionType &session) {
+  StarryPurple::TraceSpan span("LogManager::report_employee", "manager");
+  if(!check(session.user_stack.active_privilege()).greaterEqual(UserPrivilege(7))) return false;
+  flush();
+  const LogDatabase::InfoType info = log_database.current_info();
+  session.output << "Now reporting employee working history.\n";
+  size_t i = 0;
+  log_database.read_logs(
+    log_database.employee_work_log_id_list.read_range(0, info.employee_work_log_count),
+    [&](const LogType &log) {
+    ++i;
+    session.output.write_int(i, 6) << " |--" << log.description() << '\n';
+  });
+  session.output << "Employee working history report ends here.\n";
+  return true;
+}
+
+bool BookStore::LogManager::report_employee(SessionType &session, const UserInfoType &userID) {
+  StarryPurple::TraceSpan span("LogManager::report_employee", "manager");
+  if(!check(session.user_stack.active_privilege()).greaterEqual(UserPrivilege(7))) return false;
+  flush();
+  session.output << "Now reporting working history of " << userID << ".\n";
+  size_t i = 0;
+  log_database.read_logs(log_database.find_log_ids(log_database.employee_work_log_id_map, userID),
+    [&](const LogType &log) {
+    ++i;
+    session.output.write_int(i, 6) << " |--" << log.description() << '\n';
+  });
+  session.output << "Working history report ends here.\n";
+  return true;
+}
+
+bool BookStore::LogManager::report_deal_history(SessionType &session) {
+  StarryPurple::TraceSpan span("LogManager::report_deal_history", "manager");
+  if(!check(session.user_stack.active_privilege()).greaterEqual(UserPrivilege(1))) return false;
+  flush();
+  size_t i = 0;
+  log_database.read_logs(
+    log_database.find_log_ids(log_database.deal_log_id_map, session.user_stack.active_user().user_id),
+    [&](const LogType &log) {
+    ++i;
+    session.output.write_int(i, 6) << " |--" << log.description() << '\n';
+  });
+  if(i == 0) session.output << '\n';
+  return true;
+}
+
+bool BookStore::LogManager::report_history(SessionType &session) {
+  StarryPurple::TraceSpan span("LogManager::report_history", "manager");
+  if(!check(session.user_stack.active_privilege()).greaterEqual(UserPrivilege(7))) return false;
+  flush();
+  const LogDatabase::InfoType info = log_database.current_info();
+  session.output << "Now reporting system history.\n";
+  log_database.read_logs(1, info.all_log_count, [&](const LogType &log) {
+    session.output.write_int(log.id, 6) << " |--" << log.description() << '\n';
+  });
+  session.output << "System history report ends here.\n";
+  return true;
 }
 
 void BookStore::LogManager::add_log(
   const LogType &log, int log_level) {
-  log_database.add_log(log.total_income, log.total_expenditure, log.log_description, log_level);
+  StarryPurple::TraceSpan span("LogManager::add_log", "log");
+  LogTaskType task{log, log_level};
+  // stamped here rather than in the writer, so that queueing delay doesn't count.
+  task.log.timestamp = std::chrono::duration_cast<std::chrono::seconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+  std::lock_guard lock(producer_latch);
+  log_queue.push(task);
 }
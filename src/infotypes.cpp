@@ -1,7 +1,5 @@
 #include "infotypes.h"
 
-#include <iomanip>
-
 BookStore::UserPrivilege::UserPrivilege(int privilege)
   : pri_1(privilege & 1), pri_2(privilege & 2), pri_3(privilege & 4) {}
 
@@ -26,6 +24,11 @@ bool BookStore::UserPrivilege::operator>=(const UserPrivilege &other) const {
 
 BookStore::BookType::BookType(const ISBNType &ISBN) : isbn(ISBN) {}
 
+BookStore::BookType::BookType(const ISBNType &ISBN, const BookInfoType &name, const BookInfoType &book_author,
+  const BookInfoType &keywords, const PriceType &book_price, const QuantityType &book_storage)
+    : isbn(ISBN), bookname(name), author(book_author), keyword_list(keywords),
+      price(book_price), storage(book_storage) {}
+
 bool BookStore::BookType::operator==(const BookType &other) const {
   return isbn == other.isbn;
 }
@@ -50,10 +53,10 @@ bool BookStore::BookType::operator>=(const BookType &other) const {
   return isbn >= other.isbn;
 }
 
-void BookStore::BookType::print() const {
-  std::cout << isbn.to_str() << '\t' << bookname.to_str() << '\t' << author.to_str() <<
-    '\t' << keyword_list.to_str() << '\t' << std::fixed << std::setprecision(2) <<
-      price << '\t' << storage << '\n';
+void BookStore::BookType::print(StarryPurple::OutputBuffer &output) const {
+  output << isbn << '\t' << bookname << '\t' << author << '\t' << keyword_list << '\t';
+  output.write_price(price) << '\t';
+  output.write_int(storage) << '\n';
 }
 
 std::string BookStore::BookType::book_brief_identity_str() const {
@@ -72,17 +75,6 @@ BookStore::UserType::UserType(
   int user_privilege, const UserInfoType &name)
     : user_id(userID), passwd(password), privilege(user_privilege), username(name) {}
 
-std::string BookStore::UserType::user_identity_str() const {
-  std::string res = "\"";
-  if(privilege.pri_3) res += "Keeper";
-  else if(privilege.pri_2) res += "Worker";
-  else if(privilege.pri_1) res += "Client";
-  else res += "Tourist";
-  res += "\" " + username.to_str() + " (id: " + user_id.to_str() + ")";
-  return res;
-}
-
-
 bool BookStore::UserType::operator==(const UserType &other) const {
   return user_id == other.user_id;
 }
@@ -107,19 +99,81 @@ bool BookStore::UserType::operator>=(const UserType &other) const {
   return user_id >= other.user_id;
 }
 
-size_t BookStore::LogType::log_count = 0;
+BookStore::LogUserType::LogUserType(const UserType &user)
+  : user_id(user.user_id), username(user.username), privilege(user.privilege) {}
 
-BookStore::LogType::LogType(
-  const PriceType &history_income, const PriceType &history_expenditure,
-  const LogDescriptionType &description)
-    : id(0), total_income(history_income), total_expenditure(history_expenditure),
-     log_description(description) {}
+BookStore::LogUserType::LogUserType(
+  const UserInfoType &userID, const UserInfoType &name, const UserPrivilege &user_privilege)
+    : user_id(userID), username(name), privilege(user_privilege) {}
 
-BookStore::LogType::LogType(
-  const PriceType &history_income, const PriceType &history_expenditure,
-  const LogDescriptionType &description, bool to_record)
-    : id(++log_count), total_income(history_income), total_expenditure(history_expenditure),
-     log_description(description) {}
+std::string BookStore::LogUserType::user_identity_str() const {
+  std::string res = "\"";
+  if(privilege.pri_3) res += "Keeper";
+  else if(privilege.pri_2) res += "Worker";
+  else if(privilege.pri_1) res += "Client";
+  else res += "Tourist";
+  res += "\" " + username.to_str() + " (id: " + user_id.to_str() + ")";
+  return res;
+}
+
+bool BookStore::LogUserType::operator<(const LogUserType &other) const {
+  if(user_id != other.user_id) return user_id < other.user_id;
+  if(username != other.username) return username < other.username;
+  if(privilege.pri_3 != other.privilege.pri_3) return other.privilege.pri_3;
+  if(privilege.pri_2 != other.privilege.pri_2) return other.privilege.pri_2;
+  return !privilege.pri_1 && other.privilege.pri_1;
+}
+
+BookStore::LogType::LogType(LogOpcode log_opcode) : opcode(log_opcode) {}
+
+std::string BookStore::LogType::description() const {
+  switch(opcode) {
+  case LogOpcode::system_startup:
+    return "System startup.";
+  case LogOpcode::system_shutdown:
+    return "System shutdown.";
+  case LogOpcode::login:
+    return target.user_identity_str() + " has logged in.";
+  case LogOpcode::user_register:
+    return "New user registered: " + target.user_identity_str() + '.';
+  case LogOpcode::user_unregister:
+    return target.user_identity_str() + " has been unregistered.";
+  case LogOpcode::logout:
+    return actor.user_identity_str() + " has logged out.";
+  case LogOpcode::user_add:
+    return actor.user_identity_str() + " has added a new user: " + target.user_identity_str() + '.';
+  case LogOpcode::change_password:
+    return target.user_identity_str() + " has changed password from \"" +
+      old_password.to_str() + "\" to \"" + new_password.to_str() + "\".";
+  case LogOpcode::reset_password:
+    return target.user_identity_str() + " has changed password to \"" +
+      new_password.to_str() + "\".";
+  case LogOpcode::restock:
+    return actor.user_identity_str() + " has restocked " + std::to_string(quantity) + " book(s): " +
+      book.book_brief_identity_str() + " at price " + StarryPurple::dtos(amount) + '.';
+  case LogOpcode::sellout:
+    return actor.user_identity_str() + " has bought " + std::to_string(quantity) + " book(s): " +
+      book.book_brief_identity_str() + " at price " + StarryPurple::dtos(amount) + '.';
+  case LogOpcode::modify_book:
+    return actor.user_identity_str() + " has modified information of one book." +
+      " Detailed information:" +
+      "\n          \tPreviously: " + book.book_full_identity_str() +
+      "\n          \tNow:        " + modified_book.book_full_identity_str();
+  case LogOpcode::import_catalog:
+    return actor.user_identity_str() + " has imported a catalog of " + std::to_string(quantity) + " book(s).";
+  case LogOpcode::backup:
+    return actor.user_identity_str() + " has backed up the databases.";
+  }
+  return "";
+}
+
+BookStore::PriceType BookStore::LogType::income() const {
+  return opcode == LogOpcode::sellout ? amount : 0;
+}
+
+BookStore::PriceType BookStore::LogType::expenditure() const {
+  return opcode == LogOpcode::restock ? amount : 0;
+}
 
 bool BookStore::LogType::operator==(const LogType &other) const {
   return id == other.id;
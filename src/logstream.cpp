@@ -0,0 +1,282 @@
+#include "logstream.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+void StarryPurple::copy_file_prefix(const std::string &from, const std::string &to, size_t byte_count) {
+  std::ifstream in(from, std::ios::binary);
+  std::ofstream out(to, std::ios::binary | std::ios::trunc);
+  if(!in.is_open() || !out.is_open())
+    throw FileExceptions("Cannot copy file \"" + from + "\" to \"" + to + "\"");
+  std::vector<char> buffer(std::min(byte_count, cSnapshotChunkSize));
+  while(byte_count > 0) {
+    const size_t count = std::min(byte_count, buffer.size());
+    in.read(buffer.data(), count);
+    out.write(buffer.data(), count);
+    byte_count -= count;
+  }
+  if(!in || !out)
+    throw FileExceptions("Cannot copy file \"" + from + "\" to \"" + to + "\"");
+}
+
+StarryPurple::Flog::~Flog() {
+  if(is_open) close();
+}
+
+std::string StarryPurple::Flog::segment_filename(size_t segment) const {
+  return prefix_ + "_" + std::to_string(segment) + ".bslog";
+}
+
+std::string StarryPurple::Flog::index_filename(size_t segment) const {
+  return prefix_ + "_" + std::to_string(segment) + ".bsidx";
+}
+
+bool StarryPurple::Flog::open(const std::string &prefix) {
+  std::lock_guard lock(latch_);
+  if(is_open)
+    throw FileExceptions("Opening unclosed log \"" + prefix + "\"");
+  prefix_ = prefix;
+  segments_.clear();
+  size_t next_id = 1;
+  for(size_t k = 0; std::filesystem::exists(segment_filename(k)); ++k) {
+    SegmentType segment;
+    segment.first_id = next_id;
+    segment.byte_size = std::filesystem::file_size(segment_filename(k));
+    // the sparse index in one read.
+    std::ifstream index_file(index_filename(k), std::ios::binary | std::ios::ate);
+    if(index_file.is_open()) {
+      segment.sparse_offset.resize(static_cast<size_t>(index_file.tellg()) / sizeof(uint32_t));
+      index_file.seekg(0, std::ios::beg);
+      index_file.read(reinterpret_cast<char *>(segment.sparse_offset.data()),
+        segment.sparse_offset.size() * sizeof(uint32_t));
+    }
+    // every record before the last sparse index entry is counted by the index.
+    // count the remaining ones by walking to the end of the segment.
+    if(!segment.sparse_offset.empty()) {
+      segment.record_count = (segment.sparse_offset.size() - 1) * cSegmentIndexInterval;
+      std::ifstream segment_file(segment_filename(k), std::ios::binary);
+      size_t pos = segment.sparse_offset.back();
+      uint32_t len;
+      while(pos + sizeof(uint32_t) <= segment.byte_size) {
+        segment_file.seekg(pos, std::ios::beg);
+        segment_file.read(reinterpret_cast<char *>(&len), sizeof(uint32_t));
+        pos += sizeof(uint32_t) + len;
+        ++segment.record_count;
+      }
+    }
+    next_id += segment.record_count;
+    segments_.push_back(std::move(segment));
+  }
+  bool is_exist = !segments_.empty();
+  if(!is_exist) new_segment();
+  else {
+    append_file_.open(segment_filename(segments_.size() - 1),
+      std::ios::binary | std::ios::in | std::ios::out);
+    index_file_.open(index_filename(segments_.size() - 1),
+      std::ios::binary | std::ios::in | std::ios::out);
+  }
+  is_read_valid = false;
+  is_open = true;
+  return is_exist;
+}
+
+void StarryPurple::Flog::close() {
+  std::lock_guard lock(latch_);
+  if(!is_open)
+    throw FileExceptions("Closing log while no log is open");
+  append_file_.close();
+  index_file_.close();
+  if(read_file_.is_open())
+    read_file_.close();
+  segments_.clear();
+  is_open = false;
+}
+
+void StarryPurple::Flog::new_segment() {
+  if(append_file_.is_open()) append_file_.close();
+  if(index_file_.is_open()) index_file_.close();
+  SegmentType segment;
+  if(!segments_.empty())
+    segment.first_id = segments_.back().first_id + segments_.back().record_count;
+  segments_.push_back(segment);
+  std::ofstream(segment_filename(segments_.size() - 1)).close();
+  std::ofstream(index_filename(segments_.size() - 1)).close();
+  append_file_.open(segment_filename(segments_.size() - 1),
+    std::ios::binary | std::ios::in | std::ios::out);
+  index_file_.open(index_filename(segments_.size() - 1),
+    std::ios::binary | std::ios::in | std::ios::out);
+}
+
+size_t StarryPurple::Flog::append(const std::string &record) {
+  std::lock_guard lock(latch_);
+  if(!is_open)
+    throw FileExceptions("Appending to log while no log is open");
+  const size_t record_size = sizeof(uint32_t) + record.size();
+  if(record_size > cSegmentSize)
+    throw FileExceptions("Record too large for log \"" + prefix_ + "\"");
+  if(segments_.back().byte_size + record_size > cSegmentSize)
+    new_segment();
+  SegmentType &segment = segments_.back();
+  if(segment.record_count % cSegmentIndexInterval == 0) {
+    uint32_t offset = segment.byte_size;
+    segment.sparse_offset.push_back(offset);
+    index_file_.seekp(0, std::ios::end);
+    index_file_.write(reinterpret_cast<const char *>(&offset), sizeof(uint32_t));
+    if(change_log.is_enabled())
+      change_log.record(index_filename(segments_.size() - 1),
+        sizeof(uint32_t) * (segment.sparse_offset.size() - 1), &offset, sizeof(uint32_t));
+  }
+  // length and body go out in one write.
+  std::string buffer(sizeof(uint32_t), '\0');
+  uint32_t len = record.size();
+  memcpy(buffer.data(), &len, sizeof(uint32_t));
+  buffer += record;
+  append_file_.seekp(segment.byte_size, std::ios::beg);
+  append_file_.write(buffer.data(), buffer.size());
+  if(change_log.is_enabled())
+    change_log.record(segment_filename(segments_.size() - 1), segment.byte_size, buffer.data(), buffer.size());
+  segment.byte_size += record_size;
+  ++segment.record_count;
+  is_read_valid = false; // let the reader seek (and flush) before reading again.
+  return segment.first_id + segment.record_count - 1;
+}
+
+size_t StarryPurple::Flog::size() const {
+  std::lock_guard lock(latch_);
+  return record_count();
+}
+
+size_t StarryPurple::Flog::record_count() const {
+  if(segments_.empty()) return 0;
+  return segments_.back().first_id + segments_.back().record_count - 1;
+}
+
+size_t StarryPurple::Flog::segment_of(size_t id) const {
+  size_t l = 0, r = segments_.size() - 1;
+  while(l < r) {
+    size_t mid = (l + r + 1) >> 1;
+    if(segments_[mid].first_id <= id) l = mid;
+    else r = mid - 1;
+  }
+  return l;
+}
+
+StarryPurple::Flog::LocationType StarryPurple::Flog::locate(size_t id) const {
+  const size_t segment = segment_of(id);
+  const size_t interval = (id - segments_[segment].first_id) / cSegmentIndexInterval;
+  return LocationType{segment, segments_[segment].first_id + interval * cSegmentIndexInterval,
+    segments_[segment].sparse_offset[interval]};
+}
+
+void StarryPurple::Flog::read_record(std::ifstream &file, std::string &record) const {
+  uint32_t len;
+  file.read(reinterpret_cast<char *>(&len), sizeof(uint32_t));
+  record.resize(len);
+  file.read(record.data(), len);
+  if(!file)
+    throw FileExceptions("Broken record in log \"" + prefix_ + "\"");
+}
+
+void StarryPurple::Flog::seek(size_t id) {
+  // make what has been appended visible to the reader.
+  append_file_.flush();
+  const LocationType location = locate(id);
+  if(!is_read_valid || location.segment != read_segment_) {
+    if(read_file_.is_open()) read_file_.close();
+    read_file_.open(segment_filename(location.segment), std::ios::binary);
+    read_segment_ = location.segment;
+  }
+  read_file_.clear();
+  read_file_.seekg(location.offset, std::ios::beg);
+  read_id_ = location.id;
+  is_read_valid = true;
+  uint32_t len;
+  while(read_id_ < id) {
+    read_file_.read(reinterpret_cast<char *>(&len), sizeof(uint32_t));
+    read_file_.seekg(len, std::ios::cur);
+    ++read_id_;
+  }
+}
+
+void StarryPurple::Flog::read_next(std::string &record) {
+  const SegmentType &segment = segments_[read_segment_];
+  if(read_id_ == segment.first_id + segment.record_count) {
+    // the reader goes across the end of a segment.
+    seek(read_id_);
+  }
+  read_record(read_file_, record);
+  ++read_id_;
+}
+
+void StarryPurple::Flog::prefetch(const std::vector<size_t> &ids) {
+  size_t segment = segments_.size(), range_begin = 0, range_end = 0;
+  int fd = -1;
+  auto advise = [&]() {
+    if(fd >= 0 && range_end > range_begin)
+      posix_fadvise(fd, static_cast<off_t>(range_begin), static_cast<off_t>(range_end - range_begin),
+        POSIX_FADV_WILLNEED);
+  };
+  for(const size_t id: ids) {
+    if(id == 0 || id > record_count()) break; // gather() will complain
+    const size_t k = segment_of(id);
+    const SegmentType &cur_segment = segments_[k];
+    const size_t interval = (id - cur_segment.first_id) / cSegmentIndexInterval;
+    const size_t begin = cur_segment.sparse_offset[interval];
+    const size_t end = interval + 1 < cur_segment.sparse_offset.size() ?
+      cur_segment.sparse_offset[interval + 1] : cur_segment.byte_size;
+    if(k == segment && begin <= range_end + cGatherPrefetchGap) {
+      range_end = std::max(range_end, end);
+      continue;
+    }
+    advise();
+    if(k != segment) {
+      if(fd >= 0) ::close(fd);
+      fd = ::open(segment_filename(k).c_str(), O_RDONLY);
+      segment = k;
+    }
+    range_begin = begin;
+    range_end = end;
+  }
+  advise();
+  if(fd >= 0) ::close(fd);
+}
+
+void StarryPurple::Flog::read(size_t id, std::string &record) {
+  std::lock_guard lock(latch_);
+  if(!is_open)
+    throw FileExceptions("Reading log while no log is open");
+  if(id == 0 || id > record_count())
+    throw FileExceptions("Invalid log id in log \"" + prefix_ + "\"");
+  if(!is_read_valid || id != read_id_ || segment_of(id) != read_segment_)
+    seek(id);
+  read_next(record);
+}
+
+void StarryPurple::Flog::snapshot_begin() {
+  std::lock_guard lock(latch_);
+  if(!is_open)
+    throw FileExceptions("Taking a snapshot while no log is open");
+  append_file_.flush();
+  index_file_.flush();
+  snapshot_sizes_.clear();
+  for(const SegmentType &segment: segments_)
+    snapshot_sizes_.emplace_back(segment.byte_size, segment.sparse_offset.size());
+}
+
+void StarryPurple::Flog::snapshot_write(const std::string &directory) {
+  // the segments are only appended to, and new ones come after these.
+  for(size_t k = 0; k < snapshot_sizes_.size(); ++k) {
+    copy_file_prefix(segment_filename(k), snapshot_filename(directory, segment_filename(k)),
+      snapshot_sizes_[k].first);
+    copy_file_prefix(index_filename(k), snapshot_filename(directory, index_filename(k)),
+      sizeof(uint32_t) * snapshot_sizes_[k].second);
+  }
+}
+
+void StarryPurple::Flog::snapshot_end() {
+  snapshot_sizes_.clear();
+}
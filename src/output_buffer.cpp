@@ -0,0 +1,65 @@
+#include "output_buffer.h"
+
+#include <cerrno>
+#include <charconv>
+
+#include <unistd.h>
+
+StarryPurple::OutputBuffer::OutputBuffer(std::ostream &sink) : sink_(&sink) {
+  buffer_.reserve(cOutputReserveSize);
+}
+
+StarryPurple::OutputBuffer::OutputBuffer(int fd) : fd_(fd) {
+  buffer_.reserve(cOutputReserveSize);
+}
+
+StarryPurple::OutputBuffer::~OutputBuffer() {
+  flush();
+}
+
+StarryPurple::OutputBuffer &StarryPurple::OutputBuffer::operator<<(char ch) {
+  buffer_ += ch;
+  return *this;
+}
+
+StarryPurple::OutputBuffer &StarryPurple::OutputBuffer::operator<<(std::string_view str) {
+  buffer_.append(str);
+  return *this;
+}
+
+StarryPurple::OutputBuffer &StarryPurple::OutputBuffer::write_price(double val, int digit) {
+  char str[400]; // enough for any double in fixed format
+  auto [end, ec] = std::to_chars(str, str + sizeof(str), val, std::chars_format::fixed, digit);
+  buffer_.append(str, end);
+  return *this;
+}
+
+StarryPurple::OutputBuffer &StarryPurple::OutputBuffer::write_int(long long val, int width) {
+  char str[24];
+  auto [end, ec] = std::to_chars(str, str + sizeof(str), val);
+  if(end - str < width)
+    buffer_.append(width - (end - str), ' ');
+  buffer_.append(str, end);
+  return *this;
+}
+
+size_t StarryPurple::OutputBuffer::size() const {
+  return buffer_.size();
+}
+
+void StarryPurple::OutputBuffer::flush() {
+  if(buffer_.empty()) return;
+  if(sink_ != nullptr) {
+    sink_->write(buffer_.data(), buffer_.size());
+    sink_->flush();
+  } else {
+    size_t written = 0;
+    while(written < buffer_.size()) {
+      const ssize_t res = ::write(fd_, buffer_.data() + written, buffer_.size() - written);
+      if(res < 0 && errno == EINTR) continue;
+      if(res <= 0) break;
+      written += res;
+    }
+  }
+  buffer_.clear();
+}
@@ -0,0 +1,102 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdio>
+
+size_t StarryPurple::LatencyHistogram::bucket_of(uint64_t ns) {
+  if(ns < 2 * cSubBucketCount) return ns;
+  const int msb = std::bit_width(ns) - 1; // >= cSubBucketBits + 1
+  const int shift = msb - cSubBucketBits;
+  // (ns >> shift) is in [cSubBucketCount, 2 * cSubBucketCount)
+  return 2 * cSubBucketCount + (shift - 1) * cSubBucketCount + ((ns >> shift) - cSubBucketCount);
+}
+
+uint64_t StarryPurple::LatencyHistogram::bucket_upper(size_t bucket) {
+  if(bucket < 2 * cSubBucketCount) return bucket;
+  const int shift = static_cast<int>((bucket - 2 * cSubBucketCount) / cSubBucketCount) + 1;
+  const uint64_t sub = (bucket - 2 * cSubBucketCount) % cSubBucketCount + cSubBucketCount;
+  return ((sub + 1) << shift) - 1;
+}
+
+void StarryPurple::LatencyHistogram::record(uint64_t ns) {
+  buckets_[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(ns, std::memory_order_relaxed);
+  uint64_t cur_max = max_.load(std::memory_order_relaxed);
+  while(ns > cur_max && !max_.compare_exchange_weak(cur_max, ns, std::memory_order_relaxed)) {}
+}
+
+uint64_t StarryPurple::LatencyHistogram::count() const {
+  return count_.load(std::memory_order_relaxed);
+}
+
+uint64_t StarryPurple::LatencyHistogram::max() const {
+  return max_.load(std::memory_order_relaxed);
+}
+
+double StarryPurple::LatencyHistogram::mean() const {
+  const uint64_t total = count();
+  return total == 0 ? 0.0 : static_cast<double>(sum_.load(std::memory_order_relaxed)) / total;
+}
+
+uint64_t StarryPurple::LatencyHistogram::percentile(double q) const {
+  const uint64_t total = count();
+  if(total == 0) return 0;
+  const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * total)));
+  uint64_t seen = 0;
+  for(size_t bucket = 0; bucket < cBucketCount; ++bucket) {
+    seen += buckets_[bucket].load(std::memory_order_relaxed);
+    if(seen >= rank)
+      return std::min(bucket_upper(bucket), max()); // no bucket bound above what was really seen
+  }
+  return max();
+}
+
+bool StarryPurple::Tracer::start(const std::string &path) {
+  std::FILE *file = std::fopen(path.c_str(), "w");
+  if(file == nullptr) return false;
+  std::fclose(file);
+  std::lock_guard lock(latch_);
+  path_ = path;
+  events_.clear();
+  origin_ = std::chrono::steady_clock::now();
+  enabled_.store(true, std::memory_order_relaxed);
+  return true;
+}
+
+void StarryPurple::Tracer::stop() {
+  std::lock_guard lock(latch_);
+  if(!enabled_.load(std::memory_order_relaxed)) return;
+  enabled_.store(false, std::memory_order_relaxed);
+  std::FILE *file = std::fopen(path_.c_str(), "w");
+  if(file == nullptr) return;
+  // ts and dur are in microseconds, with ns kept as decimals.
+  std::fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+  for(size_t i = 0; i < events_.size(); ++i) {
+    const EventType &event = events_[i];
+    std::fprintf(file,
+      "{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %u}%s\n",
+      event.name, event.category, event.start_ns / 1000.0, event.duration_ns / 1000.0,
+      event.thread_id, i + 1 < events_.size() ? "," : "");
+  }
+  std::fprintf(file, "]}\n");
+  std::fclose(file);
+  events_.clear();
+  events_.shrink_to_fit();
+}
+
+int64_t StarryPurple::Tracer::now_ns() const {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - origin_).count();
+}
+
+void StarryPurple::Tracer::record(const char *name, const char *category, int64_t start_ns, int64_t duration_ns) {
+  // small ids, one per thread, in the order threads first record something.
+  static std::atomic<uint32_t> thread_count{0};
+  thread_local const uint32_t thread_id = ++thread_count;
+  std::lock_guard lock(latch_);
+  if(!enabled_.load(std::memory_order_relaxed)) return; // stopped while the span was open
+  events_.push_back({name, category, start_ns, duration_ns, thread_id});
+}
@@ -0,0 +1,92 @@
+#include "thread_pool.h"
+
+#include <exception>
+
+StarryPurple::ThreadPool::~ThreadPool() {
+  stop();
+}
+
+void StarryPurple::ThreadPool::start(size_t worker_count) {
+  stop();
+  is_stopping_ = false;
+  for(size_t i = 0; i < worker_count; ++i)
+    workers_.emplace_back(&ThreadPool::worker_loop, this);
+}
+
+void StarryPurple::ThreadPool::stop() {
+  {
+    std::lock_guard lock(latch_);
+    is_stopping_ = true;
+  }
+  task_ready_.notify_all();
+  for(auto &worker: workers_)
+    worker.join();
+  workers_.clear();
+}
+
+void StarryPurple::ThreadPool::worker_loop() {
+  while(true) {
+    std::function<void()> task;
+    {
+      std::unique_lock lock(latch_);
+      task_ready_.wait(lock, [this]() { return is_stopping_ || !queue_.empty(); });
+      if(queue_.empty()) return; // stopping, and nothing left
+      task = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    task();
+  }
+}
+
+void StarryPurple::ThreadPool::run_all(std::span<std::function<void()>> tasks) {
+  if(tasks.empty()) return;
+  // what the tasks of this call share. It lives on this stack, so every task must end before we return.
+  std::mutex group_latch;
+  std::condition_variable group_done;
+  size_t remaining = tasks.size();
+  std::exception_ptr error;
+  auto run_one = [&](std::function<void()> &task) {
+    std::exception_ptr task_error;
+    try {
+      task();
+    } catch(...) {
+      task_error = std::current_exception();
+    }
+    std::lock_guard lock(group_latch);
+    if(task_error && !error) error = task_error;
+    if(--remaining == 0) group_done.notify_one();
+  };
+
+  bool has_workers;
+  {
+    std::lock_guard lock(latch_);
+    has_workers = !workers_.empty() && !is_stopping_;
+    // the first task is kept for this thread.
+    if(has_workers)
+      for(size_t i = 1; i < tasks.size(); ++i)
+        queue_.emplace_back([&run_one, &task = tasks[i]]() { run_one(task); });
+  }
+  if(has_workers) {
+    task_ready_.notify_all();
+    run_one(tasks[0]);
+    // then help with the queue, rather than wait for a worker still waking up.
+    while(true) {
+      std::function<void()> task;
+      {
+        std::lock_guard lock(latch_);
+        if(queue_.empty()) break;
+        task = std::move(queue_.front());
+        queue_.pop_front();
+      }
+      task();
+    }
+  } else {
+    for(auto &task: tasks)
+      run_one(task);
+  }
+  {
+    std::unique_lock lock(group_latch);
+    group_done.wait(lock, [&]() { return remaining == 0; });
+  }
+  if(error) std::rethrow_exception(error);
+}
@@ -1,7 +1,9 @@
 #include "utilities.h"
 
+#include <charconv>
+
 std::string StarryPurple::dtos(double val, int digit) {
-  std::stringstream ss;
-  ss << std::fixed << std::setprecision(digit) << val;
-  return ss.str();
+  char str[400]; // enough for any double in fixed format
+  auto [end, ec] = std::to_chars(str, str + sizeof(str), val, std::chars_format::fixed, digit);
+  return std::string(str, end);
 }
\ No newline at end of file
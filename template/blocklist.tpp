@@ -293,13 +293,13 @@ void BlockList<KeyType, ValueType, degree>::erase(const KeyType &key, const Valu
                 nxt_head_node.high_key_ = cur_body_node.key_; // still valid when body_len = 0
               --nxt_head_node.body_len_;
               headnode_fstream_.write(nxt_head_node, nxt_head_ptr);
-              if(nxt_head_node.body_len_ < degree / 2) {
+              if(nxt_head_node.body_len_ < static_cast<int>(degree / 2)) {
                 // merge if related head_nodes are small enough.
                 bool is_left_valid = false, is_right_valid = false;
                 if(cur_head_ptr != begin_head_ptr_) {
                   // left_ptr = cur_head_ptr valid
                   is_left_valid = true;
-                  if(cur_head_node.body_len_ + nxt_head_node.body_len_ < degree) {
+                  if(cur_head_node.body_len_ + nxt_head_node.body_len_ < static_cast<int>(degree)) {
                     merge(cur_head_ptr, cur_head_node, nxt_head_ptr, nxt_head_node);
                     return;
                   }
@@ -310,7 +310,7 @@ void BlockList<KeyType, ValueType, degree>::erase(const KeyType &key, const Valu
                   // right_ptr = nxt_head_node.nxt_ valid
                   is_right_valid = true;
                   headnode_fstream_.read(right_node, right_ptr);
-                  if(right_node.body_len_ + nxt_head_node.body_len_ > degree) {
+                  if(right_node.body_len_ + nxt_head_node.body_len_ > static_cast<int>(degree)) {
                     merge(nxt_head_ptr, nxt_head_node, right_ptr, right_node);
                     return;
                   }
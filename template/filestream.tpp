@@ -46,10 +46,13 @@ template<class StorageType, class InfoType, size_t capacity>
 StarryPurple::Fstream<StorageType, InfoType, capacity>::~Fstream() {
   if(file_.is_open())
     file_.close();
+  if(advise_fd_ >= 0)
+    ::close(advise_fd_);
 }
 
 template<class StorageType, class InfoType, size_t capacity>
 bool StarryPurple::Fstream<StorageType, InfoType, capacity>::open(const std::string &filename) {
+  std::lock_guard lock(latch_);
   filename_ = filename;
   if(file_.is_open())
     throw FileExceptions("Opening unclosed file \"" + filename + "\"" );
@@ -60,8 +63,7 @@ bool StarryPurple::Fstream<StorageType, InfoType, capacity>::open(const std::str
     file_.seekg(0, std::ios::beg);
     file_.read(reinterpret_cast<char *>(&extra_info_), cExtraInfoSize);
     file_.read(reinterpret_cast<char *>(&lru_loc_), sizeof(offsetType));
-    for(size_t i = 0; i < capacity; i++)
-      file_.read(reinterpret_cast<char *>(&bitmap_[i]), sizeof(bool));
+    file_.read(reinterpret_cast<char *>(bitmap_), sizeof(bitmap_)); // in one go
     return true;
   } else {
     // file doesn't initially exist.
@@ -69,15 +71,12 @@ bool StarryPurple::Fstream<StorageType, InfoType, capacity>::open(const std::str
     std::ofstream outfile(filename);
     outfile.close();
     file_.open(filename, std::ios::binary | std::ios::in | std::ios::out);
-    file_.seekp(0, std::ios::beg);
     extra_info_ = InfoType();
-    file_.write(reinterpret_cast<const char *>(&extra_info_), cExtraInfoSize);
     lru_loc_ = 0;
-    file_.write(reinterpret_cast<const char *>(&lru_loc_), sizeof(offsetType));
-    for(size_t i = 0; i < capacity; i++) {
-      bitmap_[i] = false;
-      file_.write(reinterpret_cast<const char *>(&bitmap_[i]), sizeof(bool));
-    }
+    std::fill(bitmap_, bitmap_ + capacity, false);
+    put(0, &extra_info_, cExtraInfoSize);
+    put(cLruOffset, &lru_loc_, sizeof(offsetType));
+    put(cBitmapOffset, bitmap_, sizeof(bitmap_));
     // no need to write that much at first.
     // since the lru_pos adds up 1 by 1, this write is unnecessary and much time_consuming.
     /*
@@ -91,36 +90,33 @@ bool StarryPurple::Fstream<StorageType, InfoType, capacity>::open(const std::str
 
 template<class StorageType, class InfoType, size_t capacity>
 void StarryPurple::Fstream<StorageType, InfoType, capacity>::close() {
+  std::lock_guard lock(latch_);
   if(!file_.is_open())
     throw FileExceptions("Closing file while no file is open");
-  file_.seekp(0, std::ios::beg);
-  file_.write(reinterpret_cast<const char *>(&extra_info_), cExtraInfoSize);
-  file_.write(reinterpret_cast<const char *>(&lru_loc_), sizeof(offsetType));
-  for(size_t i = 0; i < capacity; i++)
-    file_.write(reinterpret_cast<const char *>(&bitmap_[i]), sizeof(bool));
+  put(0, &extra_info_, cExtraInfoSize);
+  put(cLruOffset, &lru_loc_, sizeof(offsetType));
+  put(cBitmapOffset, bitmap_, sizeof(bitmap_));
+  is_header_unsaved_ = is_bitmap_unsaved_ = false;
+  unsaved_bitmap_.clear();
   file_.close();
+  if(advise_fd_ >= 0)
+    ::close(advise_fd_);
+  advise_fd_ = -1;
 }
 
 template<class StorageType, class InfoType, size_t capacity>
 StarryPurple::Fpointer<capacity>
 StarryPurple::Fstream<StorageType, InfoType, capacity>::allocate() {
+  std::lock_guard lock(latch_);
   if(!file_.is_open())
     throw FileExceptions("Allocating storage while no file is open");
-  offsetType loc = lru_loc_;
-  while(loc < capacity && bitmap_[loc]) loc++;
-  if(loc != capacity)
-    lru_loc_ = loc;
-  else {
-    loc = 0;
-    while(loc < lru_loc_ && bitmap_[loc]) loc++;
-    if(loc != capacity)
-      lru_loc_ = loc;
-    else throw FileExceptions("Storage is full in file \"" + filename_ + "\"");
-  }
+  lru_loc_ = find_free();
   StorageType placeholder{};
   fpointer ptr{lru_loc_};
-  bitmap_[lru_loc_] = true; // occupy the block before call of "write"
-  write(placeholder, ptr);
+  bitmap_[lru_loc_] = true;
+  if(in_transaction_) bitmap_changed_.push_back(lru_loc_);
+  else mark_unsaved(lru_loc_);
+  write_block(placeholder, lru_loc_);
   return ptr;
 }
 
@@ -128,28 +124,56 @@ StarryPurple::Fstream<StorageType, InfoType, capacity>::allocate() {
 template<class StorageType, class InfoType, size_t capacity>
 StarryPurple::Fpointer<capacity>
 StarryPurple::Fstream<StorageType, InfoType, capacity>::allocate(const StorageType &data) {
+  std::lock_guard lock(latch_);
   if(!file_.is_open())
     throw FileExceptions("Allocating storage while no file is open");
-  offsetType loc = lru_loc_;
-  while(loc < capacity && bitmap_[loc]) loc++;
-  if(loc != capacity)
-    lru_loc_ = loc;
-  else {
-    loc = 0;
-    while(loc < lru_loc_ && bitmap_[loc]) loc++;
-    if(loc != capacity)
-      lru_loc_ = loc;
-    else
-      throw FileExceptions("Storage is full in file \"" + filename_ + "\"");
-  }
+  lru_loc_ = find_free();
   fpointer ptr{lru_loc_};
-  bitmap_[lru_loc_] = true; // occupy the block before call of "write"
-  write(data, ptr);
+  bitmap_[lru_loc_] = true;
+  if(in_transaction_) bitmap_changed_.push_back(lru_loc_);
+  else mark_unsaved(lru_loc_);
+  write_block(data, lru_loc_);
+  return ptr;
+}
+
+template<class StorageType, class InfoType, size_t capacity>
+StarryPurple::Fpointer<capacity>
+StarryPurple::Fstream<StorageType, InfoType, capacity>::allocate(const StorageType &data, const fpointer &hint) {
+  std::lock_guard lock(latch_);
+  if(!file_.is_open())
+    throw FileExceptions("Allocating storage while no file is open");
+  offsetType loc = capacity;
+  if(hint.offset_ < static_cast<offsetType>(capacity)) {
+    const offsetType near_end = std::min<offsetType>(capacity, hint.offset_ + 1 + cAllocateNearDistance);
+    loc = hint.offset_ + 1;
+    while(loc < near_end && bitmap_[loc]) loc++;
+    if(loc == near_end) loc = capacity;
+  }
+  // lru_loc_ stays where it is: the blocks before it are still to be found by the others.
+  if(loc == capacity) loc = lru_loc_ = find_free();
+  fpointer ptr{loc};
+  bitmap_[loc] = true;
+  if(in_transaction_) bitmap_changed_.push_back(loc);
+  else mark_unsaved(loc);
+  write_block(data, loc);
   return ptr;
 }
 
+template<class StorageType, class InfoType, size_t capacity>
+StarryPurple::offsetType StarryPurple::Fstream<StorageType, InfoType, capacity>::find_free() {
+  offsetType loc = lru_loc_;
+  while(loc < capacity && bitmap_[loc]) loc++;
+  if(loc != capacity) return loc;
+  loc = 0;
+  while(loc < lru_loc_ && bitmap_[loc]) loc++;
+  if(loc == lru_loc_)
+    throw FileExceptions("Storage is full in file \"" + filename_ + "\"");
+  return loc;
+}
+
 template<class StorageType, class InfoType, size_t capacity>
 void StarryPurple::Fstream<StorageType, InfoType, capacity>::free(const fpointer &ptr) {
+  std::lock_guard lock(latch_);
   if(!file_.is_open())
     throw FileExceptions("Freeing storage while no file is open");
   const offsetType offset = ptr.offset_; // ??? why I can use it without friend class declaration?
@@ -158,10 +182,13 @@ void StarryPurple::Fstream<StorageType, InfoType, capacity>::free(const fpointer
   if(!bitmap_[offset])
     throw FileExceptions("Freeing unallocated storage in file \"" + filename_ + "\"");
   bitmap_[offset] = false;
+  if(in_transaction_) bitmap_changed_.push_back(offset);
+  else mark_unsaved(offset);
 }
 
 template<class StorageType, class InfoType, size_t capacity>
 void StarryPurple::Fstream<StorageType, InfoType, capacity>::read(StorageType &data, const fpointer &ptr) {
+  std::lock_guard lock(latch_);
   if(!file_.is_open())
     throw FileExceptions("Reading storage while no file is open");
   const offsetType offset = ptr.offset_;
@@ -169,12 +196,35 @@ void StarryPurple::Fstream<StorageType, InfoType, capacity>::read(StorageType &d
     throw FileExceptions("Invalid reference in file \"" + filename_ + "\"");
   if(!bitmap_[offset])
     throw FileExceptions("Reading unallocated storage in file \"" + filename_ + "\"");
-  file_.seekg(cInfoSize + cStorageSize * offset, std::ios::beg);
+  if(in_transaction_) {
+    auto it = dirty_.find(offset);
+    if(it != dirty_.end()) {
+      data = it->second;
+      return;
+    }
+  }
+  file_.seekg(block_pos(offset), std::ios::beg);
   file_.read(reinterpret_cast<char *>(&data), cStorageSize);
+  fstream_counters.read_count.fetch_add(1, std::memory_order_relaxed);
+  fstream_counters.read_bytes.fetch_add(cStorageSize, std::memory_order_relaxed);
+}
+
+template<class StorageType, class InfoType, size_t capacity>
+void StarryPurple::Fstream<StorageType, InfoType, capacity>::prefetch(const fpointer &ptr, size_t count) {
+  std::lock_guard lock(latch_);
+  if(!file_.is_open() || ptr.offset_ < 0 || ptr.offset_ >= static_cast<offsetType>(capacity) || count == 0) return;
+  // opened by the first prefetch, as most files never see one.
+  if(advise_fd_ < 0) advise_fd_ = ::open(filename_.c_str(), O_RDONLY);
+  if(advise_fd_ < 0) return; // only a hint anyway
+  count = std::min(count, capacity - ptr.offset_);
+  // blocks still in the filebuf or in dirty_ are read from memory anyway; the hint is harmless for them.
+  posix_fadvise(advise_fd_, static_cast<off_t>(block_pos(ptr.offset_)),
+    static_cast<off_t>(cBlockSize * count), POSIX_FADV_WILLNEED);
 }
 
 template<class StorageType, class InfoType, size_t capacity>
 void StarryPurple::Fstream<StorageType, InfoType, capacity>::write(const StorageType &data, const fpointer &ptr) {
+  std::lock_guard lock(latch_);
   if(!file_.is_open())
     throw FileExceptions("Writing on storage while no file is open");
   const offsetType offset = ptr.offset_;
@@ -182,12 +232,67 @@ void StarryPurple::Fstream<StorageType, InfoType, capacity>::write(const Storage
     throw FileExceptions("Invalid reference in file \"" + filename_ + "\"");
   if(!bitmap_[offset])
     throw FileExceptions("Writing unallocated storage in file \"" + filename_ + "\"");
-  file_.seekp(cInfoSize + cStorageSize * offset, std::ios::beg);
-  file_.write(reinterpret_cast<const char *>(&data), cStorageSize);
+  write_block(data, offset);
+}
+
+template<class StorageType, class InfoType, size_t capacity>
+void StarryPurple::Fstream<StorageType, InfoType, capacity>::write_block(
+  const StorageType &data, offsetType offset) {
+  if(in_transaction_) {
+    dirty_[offset] = data;
+    return;
+  }
+  if(in_snapshot_ && is_snapshot_used(offset) && !snapshot_blocks_.contains(offset)) {
+    // the first time since the snapshot. Keep what the snapshot has here.
+    StorageType &old_data = snapshot_blocks_[offset];
+    file_.seekg(block_pos(offset), std::ios::beg);
+    file_.read(reinterpret_cast<char *>(&old_data), cStorageSize);
+  }
+  put(block_pos(offset), &data, cStorageSize);
+  fstream_counters.write_count.fetch_add(1, std::memory_order_relaxed);
+  fstream_counters.write_bytes.fetch_add(cStorageSize, std::memory_order_relaxed);
+}
+
+template<class StorageType, class InfoType, size_t capacity>
+void StarryPurple::Fstream<StorageType, InfoType, capacity>::put(size_t pos, const void *data, size_t size) {
+  file_.seekp(pos, std::ios::beg);
+  file_.write(static_cast<const char *>(data), size);
+  change_log.record(filename_, pos, data, size);
+}
+
+template<class StorageType, class InfoType, size_t capacity>
+void StarryPurple::Fstream<StorageType, InfoType, capacity>::checkpoint() {
+  std::lock_guard lock(latch_);
+  if(!file_.is_open())
+    throw FileExceptions("Writing the header while no file is open");
+  if(in_transaction_)
+    throw FileExceptions("Writing the header in a transaction in file \"" + filename_ + "\"");
+  if(!is_header_unsaved_) return;
+  put(0, &extra_info_, cExtraInfoSize);
+  put(cLruOffset, &lru_loc_, sizeof(offsetType));
+  if(is_bitmap_unsaved_)
+    put(cBitmapOffset, bitmap_, sizeof(bitmap_));
+  else
+    for(const offsetType offset: unsaved_bitmap_)
+      put(cBitmapOffset + sizeof(bool) * offset, &bitmap_[offset], sizeof(bool));
+  is_header_unsaved_ = is_bitmap_unsaved_ = false;
+  unsaved_bitmap_.clear();
+}
+
+template<class StorageType, class InfoType, size_t capacity>
+void StarryPurple::Fstream<StorageType, InfoType, capacity>::mark_unsaved(offsetType offset) {
+  is_header_unsaved_ = true;
+  if(is_bitmap_unsaved_) return;
+  // with no checkpoint() for long, the list would only grow.
+  if(unsaved_bitmap_.size() * 16 >= capacity) {
+    is_bitmap_unsaved_ = true;
+    unsaved_bitmap_.clear();
+  } else unsaved_bitmap_.push_back(offset);
 }
 
 template<class StorageType, class InfoType, size_t capacity>
 void StarryPurple::Fstream<StorageType, InfoType, capacity>::read_info(InfoType &info) {
+  std::lock_guard lock(latch_);
   if(!file_.is_open())
     throw FileExceptions("Reading info while no file is open");
   info = extra_info_;
@@ -195,9 +300,149 @@ void StarryPurple::Fstream<StorageType, InfoType, capacity>::read_info(InfoType
 
 template<class StorageType, class InfoType, size_t capacity>
 void StarryPurple::Fstream<StorageType, InfoType, capacity>::write_info(const InfoType &info) {
+  std::lock_guard lock(latch_);
   if(!file_.is_open())
     throw FileExceptions("Writing on info while no file is open");
+  if(!in_transaction_ && std::memcmp(&extra_info_, &info, cExtraInfoSize) != 0)
+    is_header_unsaved_ = true;
   extra_info_ = info;
 }
 
+template<class StorageType, class InfoType, size_t capacity>
+void StarryPurple::Fstream<StorageType, InfoType, capacity>::begin() {
+  std::lock_guard lock(latch_);
+  if(in_transaction_)
+    throw FileExceptions("Nested transaction in file \"" + filename_ + "\"");
+  in_transaction_ = true;
+  saved_extra_info_ = extra_info_;
+  saved_lru_loc_ = lru_loc_;
+}
+
+template<class StorageType, class InfoType, size_t capacity>
+void StarryPurple::Fstream<StorageType, InfoType, capacity>::commit() {
+  std::lock_guard lock(latch_);
+  if(!in_transaction_)
+    throw FileExceptions("Committing without a transaction in file \"" + filename_ + "\"");
+  in_transaction_ = false;
+  const bool is_written = is_changed();
+  // std::map keeps them in offset order, so the file is written front to back.
+  for(const auto &[offset, data]: dirty_)
+    write_block(data, offset);
+  // the header too, or the blocks would be lost with the bitmap when we crash before close().
+  put(0, &extra_info_, cExtraInfoSize);
+  put(cLruOffset, &lru_loc_, sizeof(offsetType));
+  for(const offsetType offset: bitmap_changed_)
+    put(cBitmapOffset + sizeof(bool) * offset, &bitmap_[offset], sizeof(bool));
+  file_.flush();
+  // on the disk before the commit journal goes.
+  if(is_written) {
+    if(advise_fd_ < 0) advise_fd_ = ::open(filename_.c_str(), O_RDONLY);
+    if(advise_fd_ < 0 || ::fdatasync(advise_fd_) != 0)
+      throw FileExceptions("Syncing failed in file \"" + filename_ + "\"");
+  }
+  dirty_.clear();
+  bitmap_changed_.clear();
+}
+
+template<class StorageType, class InfoType, size_t capacity>
+void StarryPurple::Fstream<StorageType, InfoType, capacity>::prepare_commit(CommitJournal &journal) {
+  std::lock_guard lock(latch_);
+  if(!in_transaction_)
+    throw FileExceptions("Preparing a commit without a transaction in file \"" + filename_ + "\"");
+  if(!is_changed()) return;
+  // the same writes as commit().
+  for(const auto &[offset, data]: dirty_)
+    journal.record(filename_, block_pos(offset), &data, cStorageSize);
+  journal.record(filename_, 0, &extra_info_, cExtraInfoSize);
+  journal.record(filename_, cLruOffset, &lru_loc_, sizeof(offsetType));
+  for(const offsetType offset: bitmap_changed_)
+    journal.record(filename_, cBitmapOffset + sizeof(bool) * offset,
+      &bitmap_[offset], sizeof(bool));
+}
+
+template<class StorageType, class InfoType, size_t capacity>
+void StarryPurple::Fstream<StorageType, InfoType, capacity>::abort() {
+  std::lock_guard lock(latch_);
+  if(!in_transaction_)
+    throw FileExceptions("Aborting without a transaction in file \"" + filename_ + "\"");
+  in_transaction_ = false;
+  // every change in the transaction flips a bit. Flip them back.
+  for(auto it = bitmap_changed_.rbegin(); it != bitmap_changed_.rend(); ++it)
+    bitmap_[*it] = !bitmap_[*it];
+  extra_info_ = saved_extra_info_;
+  lru_loc_ = saved_lru_loc_;
+  dirty_.clear();
+  bitmap_changed_.clear();
+}
+
+template<class StorageType, class InfoType, size_t capacity>
+bool StarryPurple::Fstream<StorageType, InfoType, capacity>::is_changed() const {
+  return !dirty_.empty() || !bitmap_changed_.empty() || lru_loc_ != saved_lru_loc_ ||
+    std::memcmp(&extra_info_, &saved_extra_info_, cExtraInfoSize) != 0;
+}
+
+template<class StorageType, class InfoType, size_t capacity>
+void StarryPurple::Fstream<StorageType, InfoType, capacity>::snapshot_begin() {
+  std::lock_guard lock(latch_);
+  if(!file_.is_open())
+    throw FileExceptions("Taking a snapshot while no file is open");
+  if(in_transaction_ || in_snapshot_)
+    throw FileExceptions("Taking a snapshot in a transaction or another snapshot in file \"" + filename_ + "\"");
+  // what's on the disk from now on is either the snapshot or copied before it's changed.
+  file_.flush();
+  in_snapshot_ = true;
+  snapshot_header_.assign(cBodyOffset, 0);
+  std::memcpy(snapshot_header_.data(), &extra_info_, cExtraInfoSize);
+  std::memcpy(snapshot_header_.data() + cLruOffset, &lru_loc_, sizeof(offsetType));
+  std::memcpy(snapshot_header_.data() + cBitmapOffset, bitmap_, sizeof(bitmap_));
+}
+
+template<class StorageType, class InfoType, size_t capacity>
+void StarryPurple::Fstream<StorageType, InfoType, capacity>::snapshot_write(const std::string &directory) {
+  {
+    // in_snapshot_ is changed under the latch. snapshot_header_ is only changed by
+    // snapshot_begin() and snapshot_end(), which the caller runs around this.
+    std::lock_guard lock(latch_);
+    if(!in_snapshot_)
+      throw FileExceptions("Writing a snapshot not taken of file \"" + filename_ + "\"");
+  }
+  std::ofstream out(snapshot_filename(directory, filename_), std::ios::binary | std::ios::trunc);
+  if(!out.is_open())
+    throw FileExceptions("Cannot write the snapshot of file \"" + filename_ + "\"");
+  // the blocks start at cBodyOffset, on the page after the header. All of it goes in one write.
+  out.write(snapshot_header_.data(), cBodyOffset);
+  // every block up to the last one used has been written, so it's all in the file.
+  // The file ends right after the data of the last block, not at the end of its padding.
+  size_t block_count = capacity;
+  while(block_count > 0 && !is_snapshot_used(block_count - 1)) --block_count;
+  // a block read here may be newer than the snapshot only if it's been copied before,
+  // so looking the copies up after reading is enough.
+  std::ifstream in(filename_, std::ios::binary);
+  in.seekg(cBodyOffset, std::ios::beg);
+  const size_t chunk_block_count = std::max<size_t>(1, cSnapshotChunkSize / cBlockSize);
+  std::vector<char> buffer(cBlockSize * std::min(chunk_block_count, block_count));
+  for(size_t first = 0; first < block_count; first += chunk_block_count) {
+    const size_t count = std::min(chunk_block_count, block_count - first);
+    const size_t size = first + count == block_count ? cBlockSize * (count - 1) + cStorageSize : cBlockSize * count;
+    in.read(buffer.data(), size);
+    {
+      std::lock_guard lock(latch_);
+      for(auto it = snapshot_blocks_.lower_bound(first); it != snapshot_blocks_.end() && it->first < static_cast<offsetType>(first + count); ++it)
+        std::memcpy(buffer.data() + cBlockSize * (it->first - first), &it->second, cStorageSize);
+    }
+    out.write(buffer.data(), size);
+  }
+  if(!in || !out)
+    throw FileExceptions("Cannot write the snapshot of file \"" + filename_ + "\"");
+}
+
+template<class StorageType, class InfoType, size_t capacity>
+void StarryPurple::Fstream<StorageType, InfoType, capacity>::snapshot_end() {
+  std::lock_guard lock(latch_);
+  in_snapshot_ = false;
+  snapshot_header_.clear();
+  snapshot_header_.shrink_to_fit();
+  snapshot_blocks_.clear();
+}
+
 #endif // FILE_STREAM_TPP
\ No newline at end of file
@@ -0,0 +1,178 @@
+#ifndef LOG_STREAM_TPP
+#define LOG_STREAM_TPP
+
+#include "logstream.h"
+
+template<class Func>
+void StarryPurple::Flog::scan(size_t first_id, size_t last_id, Func func) {
+  // where reading starts in every segment in range.
+  std::vector<LocationType> starts;
+  {
+    std::lock_guard lock(latch_);
+    if(!is_open)
+      throw FileExceptions("Scanning log while no log is open");
+    if(first_id == 0) first_id = 1;
+    if(last_id > record_count()) last_id = record_count();
+    if(first_id > last_id) return;
+    append_file_.flush(); // so that our own file sees it all
+    starts.push_back(locate(first_id));
+    for(size_t k = starts[0].segment + 1; k < segments_.size() && segments_[k].first_id <= last_id; ++k)
+      starts.push_back(LocationType{k, segments_[k].first_id, 0});
+  }
+  std::ifstream file;
+  std::string record;
+  for(size_t i = 0; i < starts.size(); ++i) {
+    if(file.is_open()) file.close();
+    file.open(segment_filename(starts[i].segment), std::ios::binary);
+    file.seekg(starts[i].offset, std::ios::beg);
+    const size_t end_id = i + 1 < starts.size() ? starts[i + 1].id : last_id + 1;
+    for(size_t id = starts[i].id; id < end_id; ++id) {
+      read_record(file, record);
+      if(id >= first_id) func(id, record);
+    }
+  }
+}
+
+template<class Func>
+void StarryPurple::Flog::gather(const std::vector<size_t> &ids, Func func) {
+  std::vector<LocationType> locations;
+  {
+    std::lock_guard lock(latch_);
+    if(!is_open)
+      throw FileExceptions("Gathering log while no log is open");
+    if(ids.size() > 1) prefetch(ids);
+    append_file_.flush(); // so that our own file sees it all
+    locations.reserve(ids.size());
+    for(const size_t id: ids) {
+      if(id == 0 || id > record_count())
+        throw FileExceptions("Invalid log id in log \"" + prefix_ + "\"");
+      locations.push_back(locate(id));
+    }
+  }
+  std::ifstream file;
+  size_t segment = static_cast<size_t>(-1), next_id = 0; // no file open yet
+  std::string record;
+  for(size_t i = 0; i < ids.size(); ++i) {
+    const LocationType &location = locations[i];
+    // walk forward if we're in the interval already, or seek.
+    if(location.segment != segment || ids[i] < next_id || location.id > next_id) {
+      if(location.segment != segment) {
+        if(file.is_open()) file.close();
+        file.open(segment_filename(location.segment), std::ios::binary);
+        segment = location.segment;
+      }
+      file.seekg(location.offset, std::ios::beg);
+      next_id = location.id;
+    }
+    for(; next_id < ids[i]; ++next_id)
+      read_record(file, record);
+    read_record(file, record);
+    ++next_id;
+    func(ids[i], record);
+  }
+}
+
+
+template<class T>
+StarryPurple::Fvector<T>::~Fvector() {
+  if(is_open) close();
+}
+
+template<class T>
+bool StarryPurple::Fvector<T>::open(const std::string &filename) {
+  std::lock_guard lock(latch_);
+  if(is_open)
+    throw FileExceptions("Opening unclosed file \"" + filename + "\"");
+  filename_ = filename;
+  file_.open(filename, std::ios::binary | std::ios::in | std::ios::out);
+  bool is_exist = file_.is_open();
+  if(!is_exist) {
+    std::ofstream outfile(filename);
+    outfile.close();
+    file_.open(filename, std::ios::binary | std::ios::in | std::ios::out);
+  }
+  file_.seekg(0, std::ios::end);
+  size_ = static_cast<size_t>(file_.tellg()) / sizeof(T);
+  is_open = true;
+  return is_exist;
+}
+
+template<class T>
+void StarryPurple::Fvector<T>::close() {
+  std::lock_guard lock(latch_);
+  if(!is_open)
+    throw FileExceptions("Closing file while no file is open");
+  file_.close();
+  is_open = false;
+}
+
+template<class T>
+void StarryPurple::Fvector<T>::push_back(const T &value) {
+  std::lock_guard lock(latch_);
+  if(!is_open)
+    throw FileExceptions("Appending to file while no file is open");
+  file_.seekp(sizeof(T) * size_, std::ios::beg);
+  file_.write(reinterpret_cast<const char *>(&value), sizeof(T));
+  change_log.record(filename_, sizeof(T) * size_, &value, sizeof(T));
+  ++size_;
+}
+
+template<class T>
+size_t StarryPurple::Fvector<T>::size() const {
+  std::lock_guard lock(latch_);
+  return size_;
+}
+
+template<class T>
+bool StarryPurple::Fvector<T>::empty() const {
+  std::lock_guard lock(latch_);
+  return size_ == 0;
+}
+
+template<class T>
+T StarryPurple::Fvector<T>::operator[](size_t index) {
+  std::lock_guard lock(latch_);
+  if(!is_open)
+    throw FileExceptions("Reading file while no file is open");
+  if(index >= size_)
+    throw FileExceptions("Invalid index in file \"" + filename_ + "\"");
+  T value;
+  file_.seekg(sizeof(T) * index, std::ios::beg);
+  file_.read(reinterpret_cast<char *>(&value), sizeof(T));
+  return value;
+}
+
+template<class T>
+std::vector<T> StarryPurple::Fvector<T>::read_range(size_t first, size_t count) {
+  std::lock_guard lock(latch_);
+  if(!is_open)
+    throw FileExceptions("Reading file while no file is open");
+  if(first > size_ || count > size_ - first)
+    throw FileExceptions("Invalid index in file \"" + filename_ + "\"");
+  std::vector<T> res(count);
+  if(count == 0) return res;
+  file_.seekg(sizeof(T) * first, std::ios::beg);
+  file_.read(reinterpret_cast<char *>(res.data()), sizeof(T) * count);
+  return res;
+}
+
+template<class T>
+void StarryPurple::Fvector<T>::snapshot_begin() {
+  std::lock_guard lock(latch_);
+  if(!is_open)
+    throw FileExceptions("Taking a snapshot while no file is open");
+  file_.flush();
+  snapshot_size_ = size_;
+}
+
+template<class T>
+void StarryPurple::Fvector<T>::snapshot_write(const std::string &directory) {
+  copy_file_prefix(filename_, snapshot_filename(directory, filename_), sizeof(T) * snapshot_size_);
+}
+
+template<class T>
+void StarryPurple::Fvector<T>::snapshot_end() {
+  snapshot_size_ = 0;
+}
+
+#endif // LOG_STREAM_TPP
@@ -0,0 +1,56 @@
+#ifndef RING_BUFFER_TPP
+#define RING_BUFFER_TPP
+
+#include "ring_buffer.h"
+
+template<class T, size_t capacity>
+StarryPurple::RingBuffer<T, capacity>::RingBuffer() : buffer_(capacity) {}
+
+template<class T, size_t capacity>
+void StarryPurple::RingBuffer<T, capacity>::push(const T &value) {
+  const size_t tail = tail_.load(std::memory_order_relaxed);
+  size_t head = head_.load(std::memory_order_acquire);
+  while(tail - head == capacity) {
+    // full. wait for the consumer.
+    head_.wait(head, std::memory_order_acquire);
+    head = head_.load(std::memory_order_acquire);
+  }
+  buffer_[tail & (capacity - 1)] = value;
+  tail_.store(tail + 1, std::memory_order_release);
+  tail_.notify_one();
+}
+
+template<class T, size_t capacity>
+void StarryPurple::RingBuffer<T, capacity>::flush() {
+  const size_t target = tail_.load(std::memory_order_acquire);
+  size_t head = head_.load(std::memory_order_acquire);
+  while(head < target) {
+    head_.wait(head, std::memory_order_acquire);
+    head = head_.load(std::memory_order_acquire);
+  }
+}
+
+template<class T, size_t capacity>
+T &StarryPurple::RingBuffer<T, capacity>::front() {
+  const size_t head = head_.load(std::memory_order_relaxed);
+  size_t tail = tail_.load(std::memory_order_acquire);
+  while(tail == head) {
+    // empty. wait for the producer.
+    tail_.wait(tail, std::memory_order_acquire);
+    tail = tail_.load(std::memory_order_acquire);
+  }
+  return buffer_[head & (capacity - 1)];
+}
+
+template<class T, size_t capacity>
+void StarryPurple::RingBuffer<T, capacity>::pop() {
+  head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  head_.notify_all(); // both a blocked producer and flush() may be waiting
+}
+
+template<class T, size_t capacity>
+bool StarryPurple::RingBuffer<T, capacity>::empty() const {
+  return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+}
+
+#endif // RING_BUFFER_TPP
@@ -1,41 +1,227 @@
 #ifndef UTILITIES_TPP
 #define UTILITIES_TPP
 
+#include <algorithm>
+#include <bit>
+#include <iterator>
 #include <sstream>
 #include <iomanip>
+#include <type_traits>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 #include "utilities.h"
 
+namespace StarryPurple {
+
+// how many of the sorted keys[0, size) are less than key.
+template<class KeyType>
+size_t count_less(const KeyType *keys, size_t size, const KeyType &key) {
+  size_t count = 0, i = 0;
+#ifdef __AVX2__
+  if constexpr(sizeof(KeyType) == sizeof(int64_t)) {
+    // AVX2 only compares signed. For unsigned keys, flipping the sign bits on both sides keeps the order.
+    const __m256i flip = _mm256_set1_epi64x(std::is_signed_v<KeyType> ? 0 : INT64_MIN);
+    const __m256i key_vec = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<int64_t>(key)), flip);
+    for(; i + 4 <= size; i += 4) {
+      const __m256i keys_vec =
+        _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i)), flip);
+      const __m256i is_less = _mm256_cmpgt_epi64(key_vec, keys_vec);
+      count += std::popcount(static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(is_less))));
+    }
+  }
+#endif
+  for(; i < size; ++i)
+    count += keys[i] < key;
+  return count;
+}
+
+template<class KeyType>
+size_t node_lower_bound(const KeyType *keys, size_t size, const KeyType &key) {
+  if(size == 0) return 0;
+  // the answer is always in [base, base + n], and everything before base is less than key.
+  const KeyType *base = keys;
+  size_t n = size;
+  if constexpr(std::is_integral_v<KeyType>) {
+    while(n > cLinearSearchSize) {
+      const size_t half = n / 2;
+      base = base[half] < key ? base + half : base;
+      n -= half;
+    }
+    return (base - keys) + count_less(base, n, key);
+  } else {
+    while(n > 1) {
+      const size_t half = n / 2;
+      base = base[half] < key ? base + half : base;
+      n -= half;
+    }
+    return (base - keys) + (*base < key);
+  }
+}
+
+template<class KeyType>
+size_t node_lower_bound(const uint64_t *prefixes, const KeyType *keys, size_t size, const KeyType &key) {
+  // a smaller prefix means a smaller key, and a larger prefix a larger one. Only the ties need the keys.
+  const uint64_t key_prefix = KeyPrefix<KeyType>::of(key);
+  const size_t first = node_lower_bound(prefixes, size, key_prefix);
+  if(first == size || prefixes[first] != key_prefix) return first; // mostly so
+  const size_t last = key_prefix == UINT64_MAX ?
+    size : first + node_lower_bound(prefixes + first, size - first, key_prefix + 1);
+  return first + node_lower_bound(keys + first, last - first, key);
+}
+
+} // namespace StarryPurple
 
-template<class KeyType, class ValueType, size_t degree, size_t capacity>
-StarryPurple::Fmultimap<KeyType, ValueType, degree, capacity>::~Fmultimap() {
+
+template<class KeyType, class ValueType, size_t capacity>
+StarryPurple::Fmultimap<KeyType, ValueType, capacity>::~Fmultimap() {
   if(is_open)
     close();
 }
 
-template<class KeyType, class ValueType, size_t degree, size_t capacity>
-bool StarryPurple::Fmultimap<KeyType, ValueType, degree, capacity>::open(
-  const std::string &prefix) {
-  bool is_exist = inner_fstream.open(prefix + "_inner.bsdat");
-  vlist_fstream.open(prefix + "_vlist.bsdat");
-  is_open = true;
-  if(is_exist)
+template<class KeyType, class ValueType, size_t capacity>
+void StarryPurple::Fmultimap<KeyType, ValueType, capacity>::write_inner(
+  InnerNode &node, const InnerPtr &ptr) {
+  node.refresh_prefixes();
+  inner_fstream.write(node, ptr);
+}
+
+template<class KeyType, class ValueType, size_t capacity>
+typename StarryPurple::Fmultimap<KeyType, ValueType, capacity>::InnerPtr
+StarryPurple::Fmultimap<KeyType, ValueType, capacity>::allocate_inner(InnerNode &node) {
+  node.refresh_prefixes();
+  return inner_fstream.allocate(node);
+}
+
+template<class KeyType, class ValueType, size_t capacity>
+bool StarryPurple::Fmultimap<KeyType, ValueType, capacity>::load_files() {
+  TraceSpan span("Fmultimap::load", "index");
+  bool is_exist = inner_fstream.open(prefix_ + "_inner.bsdat");
+  vlist_fstream.open(prefix_ + "_vlist.bsdat");
+  if(is_exist) {
     inner_fstream.read_info(root_ptr);
-  else root_ptr.setnull();
+    vlist_fstream.read_info(entry_count);
+  } else {
+    root_ptr.setnull();
+    entry_count = 0;
+  }
+  is_loaded.store(true, std::memory_order_release);
   return is_exist;
 }
 
-template<class KeyType, class ValueType, size_t degree, size_t capacity>
-void StarryPurple::Fmultimap<KeyType, ValueType, degree, capacity>::close() {
-  inner_fstream.write_info(root_ptr);
-  inner_fstream.close();
-  vlist_fstream.close();
+template<class KeyType, class ValueType, size_t capacity>
+void StarryPurple::Fmultimap<KeyType, ValueType, capacity>::load() {
+  if(is_loaded.load(std::memory_order_acquire)) return;
+  std::lock_guard lock(load_latch);
+  if(!is_loaded.load(std::memory_order_relaxed))
+    load_files();
+}
+
+template<class KeyType, class ValueType, size_t capacity>
+bool StarryPurple::Fmultimap<KeyType, ValueType, capacity>::open(
+  const std::string &prefix) {
+  if(is_open) close();
+  std::lock_guard lock(load_latch);
+  prefix_ = prefix;
+  is_open = true;
+  return load_files();
+}
+
+template<class KeyType, class ValueType, size_t capacity>
+void StarryPurple::Fmultimap<KeyType, ValueType, capacity>::open_lazily(
+  const std::string &prefix) {
+  if(is_open) close();
+  prefix_ = prefix;
+  is_open = true;
+}
+
+template<class KeyType, class ValueType, size_t capacity>
+void StarryPurple::Fmultimap<KeyType, ValueType, capacity>::close() {
+  if(is_loaded.load(std::memory_order_relaxed)) {
+    inner_fstream.write_info(root_ptr);
+    vlist_fstream.write_info(entry_count);
+    inner_fstream.close();
+    vlist_fstream.close();
+    is_loaded.store(false, std::memory_order_relaxed);
+  }
   is_open = false;
 }
 
-template<class KeyType, class ValueType, size_t degree, size_t capacity>
-void StarryPurple::Fmultimap<KeyType, ValueType, degree, capacity>::insert(
+template<class KeyType, class ValueType, size_t capacity>
+void StarryPurple::Fmultimap<KeyType, ValueType, capacity>::begin() {
+  load();
+  saved_root_ptr = root_ptr;
+  saved_entry_count = entry_count;
+  inner_fstream.begin();
+  vlist_fstream.begin();
+}
+
+template<class KeyType, class ValueType, size_t capacity>
+void StarryPurple::Fmultimap<KeyType, ValueType, capacity>::prepare_commit(CommitJournal &journal) {
+  load();
+  inner_fstream.write_info(root_ptr);
+  vlist_fstream.write_info(entry_count);
+  inner_fstream.prepare_commit(journal);
+  vlist_fstream.prepare_commit(journal);
+}
+
+template<class KeyType, class ValueType, size_t capacity>
+void StarryPurple::Fmultimap<KeyType, ValueType, capacity>::commit() {
+  load();
+  inner_fstream.write_info(root_ptr);
+  vlist_fstream.write_info(entry_count);
+  inner_fstream.commit();
+  vlist_fstream.commit();
+}
+
+template<class KeyType, class ValueType, size_t capacity>
+void StarryPurple::Fmultimap<KeyType, ValueType, capacity>::abort() {
+  load();
+  root_ptr = saved_root_ptr;
+  entry_count = saved_entry_count;
+  inner_fstream.abort();
+  vlist_fstream.abort();
+}
+
+template<class KeyType, class ValueType, size_t capacity>
+void StarryPurple::Fmultimap<KeyType, ValueType, capacity>::snapshot_begin() {
+  load();
+  // the root is only written to the header at commit() / close(). The snapshot needs it now.
+  inner_fstream.write_info(root_ptr);
+  vlist_fstream.write_info(entry_count);
+  inner_fstream.snapshot_begin();
+  vlist_fstream.snapshot_begin();
+}
+
+template<class KeyType, class ValueType, size_t capacity>
+void StarryPurple::Fmultimap<KeyType, ValueType, capacity>::snapshot_write(
+  const std::string &directory) {
+  inner_fstream.snapshot_write(directory);
+  vlist_fstream.snapshot_write(directory);
+}
+
+template<class KeyType, class ValueType, size_t capacity>
+void StarryPurple::Fmultimap<KeyType, ValueType, capacity>::snapshot_end() {
+  inner_fstream.snapshot_end();
+  vlist_fstream.snapshot_end();
+}
+
+template<class KeyType, class ValueType, size_t capacity>
+void StarryPurple::Fmultimap<KeyType, ValueType, capacity>::checkpoint() {
+  if(!is_loaded.load(std::memory_order_acquire)) return; // nothing changed
+  inner_fstream.write_info(root_ptr);
+  vlist_fstream.write_info(entry_count);
+  inner_fstream.checkpoint();
+  vlist_fstream.checkpoint();
+}
+
+template<class KeyType, class ValueType, size_t capacity>
+void StarryPurple::Fmultimap<KeyType, ValueType, capacity>::insert(
   const KeyType &key, const ValueType &value) {
+  TraceSpan span("Fmultimap::insert", "index");
+  load();
   if(root_ptr.isnull()) {
     VlistNode vlist_node;
     vlist_node.node_size = 1; vlist_node.value[0] = value; vlist_node.nxt.setnull();
@@ -46,7 +232,8 @@ void StarryPurple::Fmultimap<KeyType, ValueType, degree, capacity>::insert(
     inner_root_node.parent_ptr.setnull();
     inner_root_node.is_leaf = true; inner_root_node.high_key = key; inner_root_node.node_size = 1;
     inner_root_node.keys[0] = key; inner_root_node.vlist_ptrs[0] = vlist_fstream.allocate(vlist_begin_node);
-    root_ptr = inner_fstream.allocate(inner_root_node);
+    root_ptr = allocate_inner(inner_root_node);
+    ++entry_count;
     // initialize requires no maintain_size.
     return;
   }
@@ -66,7 +253,8 @@ void StarryPurple::Fmultimap<KeyType, ValueType, degree, capacity>::insert(
       cur_inner_node.high_key = key;
       cur_inner_node.keys[cur_inner_node.node_size - 1] = key;
       cur_inner_node.vlist_ptrs[cur_inner_node.node_size - 1] = vlist_fstream.allocate(vlist_begin_node);
-      inner_fstream.write(cur_inner_node, cur_inner_ptr);
+      write_inner(cur_inner_node, cur_inner_ptr);
+      ++entry_count;
       // node_size modified. Start maintenance.
       maintain_size(cur_inner_ptr, cur_inner_node);
       return;
@@ -74,14 +262,9 @@ void StarryPurple::Fmultimap<KeyType, ValueType, degree, capacity>::insert(
     if(cur_inner_node.is_leaf) {
       if(cur_inner_node.parent_ptr != parent_ptr) {
         cur_inner_node.parent_ptr = parent_ptr;
-        inner_fstream.write(cur_inner_node, cur_inner_ptr);
-      }
-      size_t l = 0, r = cur_inner_node.node_size - 1;
-      while(l < r) {
-        size_t mid = (l + r) >> 1;
-        if(key > cur_inner_node.keys[mid]) l = mid + 1;
-        else r = mid;
+        write_inner(cur_inner_node, cur_inner_ptr);
       }
+      size_t l = cur_inner_node.search(key);
       pos = l;
       break;
     }
@@ -89,7 +272,7 @@ void StarryPurple::Fmultimap<KeyType, ValueType, degree, capacity>::insert(
       cur_inner_node.parent_ptr = parent_ptr;
       cur_inner_node.high_key = key;
       cur_inner_node.keys[cur_inner_node.node_size - 1] = key;
-      inner_fstream.write(cur_inner_node, cur_inner_ptr);
+      write_inner(cur_inner_node, cur_inner_ptr);
       parent_ptr = cur_inner_ptr;
       cur_inner_ptr = cur_inner_node.inner_ptrs[cur_inner_node.node_size - 1];
       inner_fstream.read(cur_inner_node, cur_inner_ptr);
@@ -97,14 +280,9 @@ void StarryPurple::Fmultimap<KeyType, ValueType, degree, capacity>::insert(
     }
     if(cur_inner_node.parent_ptr != parent_ptr) {
       cur_inner_node.parent_ptr = parent_ptr;
-      inner_fstream.write(cur_inner_node, cur_inner_ptr);
-    }
-    size_t l = 0, r = cur_inner_node.node_size - 1;
-    while(l < r) {
-      size_t mid = (l + r) >> 1;
-      if(key > cur_inner_node.keys[mid]) l = mid + 1;
-      else r = mid;
+      write_inner(cur_inner_node, cur_inner_ptr);
     }
+    size_t l = cur_inner_node.search(key);
     parent_ptr = cur_inner_ptr;
     cur_inner_ptr = cur_inner_node.inner_ptrs[l];
     inner_fstream.read(cur_inner_node, cur_inner_ptr);
@@ -122,35 +300,49 @@ void StarryPurple::Fmultimap<KeyType, ValueType, degree, capacity>::insert(
     }
     cur_inner_node.keys[pos] = key;
     cur_inner_node.vlist_ptrs[pos] = vlist_fstream.allocate(vlist_begin_node);
-    inner_fstream.write(cur_inner_node, cur_inner_ptr);
+    write_inner(cur_inner_node, cur_inner_ptr);
+    ++entry_count;
     // node_size modified. Start maintenance.
     maintain_size(cur_inner_ptr, cur_inner_node);
     return;
   }
   // assert(key == cur_inner_node.keys[pos]);
+  // the value list of a hot key can be long; this is the part that grows with it.
+  TraceSpan walk_span("Fmultimap::vlist_walk", "index");
   VlistPtr cur_vlist_ptr = cur_inner_node.vlist_ptrs[pos];
   VlistNode cur_vlist_node; vlist_fstream.read(cur_vlist_node, cur_vlist_ptr);
   VlistPtr nxt_vlist_ptr = cur_vlist_node.nxt;
   VlistNode nxt_vlist_node;
+  offsetType window_begin = 0, window_end = 0;
   while(!nxt_vlist_ptr.isnull()) {
+    prefetch_vlist(cur_vlist_ptr, nxt_vlist_ptr, window_begin, window_end);
     vlist_fstream.read(nxt_vlist_node, nxt_vlist_ptr);
 
+    if(nxt_vlist_node.node_size == 0) {
+      // left empty by an erase in older files. It's the only node of the list.
+      nxt_vlist_node.node_size = 1;
+      nxt_vlist_node.value[0] = value;
+      vlist_fstream.write(nxt_vlist_node, nxt_vlist_ptr);
+      ++entry_count;
+      return;
+    }
     if(value > nxt_vlist_node.value[nxt_vlist_node.node_size - 1] && nxt_vlist_node.nxt.isnull()) {
       ++nxt_vlist_node.node_size;
       nxt_vlist_node.value[nxt_vlist_node.node_size - 1] = value;
       vlist_fstream.write(nxt_vlist_node, nxt_vlist_ptr);
+      ++entry_count;
 
-      if(nxt_vlist_node.node_size == degree * 2) {
+      if(nxt_vlist_node.node_size == cVlistDegree * 2) {
         VlistNode new_vlist_node;
         int left_size = nxt_vlist_node.node_size / 2, right_size = nxt_vlist_node.node_size - left_size;
-        ValueType empty_value;
+        ValueType empty_value{};
         for(int i = 0; i < right_size; ++i) {
           new_vlist_node.value[i] = nxt_vlist_node.value[left_size + i];
           nxt_vlist_node.value[left_size + i] = empty_value;
         }
         nxt_vlist_node.node_size = left_size; new_vlist_node.node_size = right_size;
         new_vlist_node.nxt = nxt_vlist_node.nxt; // = "nullptr"
-        nxt_vlist_node.nxt = vlist_fstream.allocate(new_vlist_node);
+        nxt_vlist_node.nxt = vlist_fstream.allocate(new_vlist_node, nxt_vlist_ptr);
         vlist_fstream.write(nxt_vlist_node, nxt_vlist_ptr);
       }
 
@@ -164,30 +356,27 @@ void StarryPurple::Fmultimap<KeyType, ValueType, degree, capacity>::insert(
       continue;
     }
 
-    int l = 0, r = nxt_vlist_node.node_size - 1;
-    while(l < r) {
-      int mid = (l + r) >> 1;
-      if(value <= nxt_vlist_node.value[mid]) r = mid;
-      else l = mid + 1;
-    }
+    int l = std::min<int>(
+      node_lower_bound(nxt_vlist_node.value, nxt_vlist_node.node_size, value), nxt_vlist_node.node_size - 1);
     if(nxt_vlist_node.value[l] == value) return; // value already exists
     ++nxt_vlist_node.node_size;
     for(int i = nxt_vlist_node.node_size - 1; i > l; --i)
       nxt_vlist_node.value[i] = nxt_vlist_node.value[i - 1];
     nxt_vlist_node.value[l] = value;
     vlist_fstream.write(nxt_vlist_node, nxt_vlist_ptr);
+    ++entry_count;
 
-    if(nxt_vlist_node.node_size == degree * 2) {
+    if(nxt_vlist_node.node_size == cVlistDegree * 2) {
       VlistNode new_vlist_node;
       int left_size = nxt_vlist_node.node_size / 2, right_size = nxt_vlist_node.node_size - left_size;
-      ValueType empty_value;
+      ValueType empty_value{};
       for(int i = 0; i < right_size; ++i) {
         new_vlist_node.value[i] = nxt_vlist_node.value[left_size + i];
         nxt_vlist_node.value[left_size + i] = empty_value;
       }
       nxt_vlist_node.node_size = left_size; new_vlist_node.node_size = right_size;
       new_vlist_node.nxt = nxt_vlist_node.nxt;
-      nxt_vlist_node.nxt = vlist_fstream.allocate(new_vlist_node);
+      nxt_vlist_node.nxt = vlist_fstream.allocate(new_vlist_node, nxt_vlist_ptr);
       vlist_fstream.write(nxt_vlist_node, nxt_vlist_ptr);
     }
 
@@ -196,13 +385,16 @@ void StarryPurple::Fmultimap<KeyType, ValueType, degree, capacity>::insert(
   }
   VlistNode new_vlist_node;
   new_vlist_node.node_size = 1; new_vlist_node.value[0] = value; // new_vlist_node.nxt = nxt_vlist_ptr = "nullptr"
-  cur_vlist_node.nxt = vlist_fstream.allocate(new_vlist_node);
+  cur_vlist_node.nxt = vlist_fstream.allocate(new_vlist_node, cur_vlist_ptr);
   vlist_fstream.write(cur_vlist_node, cur_vlist_ptr);
+  ++entry_count;
 }
 
-template<class KeyType, class ValueType, size_t degree, size_t capacity>
-void StarryPurple::Fmultimap<KeyType, ValueType, degree, capacity>::erase(
+template<class KeyType, class ValueType, size_t capacity>
+void StarryPurple::Fmultimap<KeyType, ValueType, capacity>::erase(
   const KeyType &key, const ValueType &value) {
+  TraceSpan span("Fmultimap::erase", "index");
+  load();
   if(root_ptr.isnull()) return;
   InnerPtr cur_inner_ptr = root_ptr, parent_ptr; // parent_ptr = root_ptr.parent_ptr = "nullptr"
   InnerNode cur_inner_node; inner_fstream.read(cur_inner_node, cur_inner_ptr);
@@ -211,14 +403,9 @@ void StarryPurple::Fmultimap<KeyType, ValueType, degree, capacity>::erase(
   while(true) {
     if(cur_inner_node.parent_ptr != parent_ptr) {
       cur_inner_node.parent_ptr = parent_ptr;
-      inner_fstream.write(cur_inner_node, cur_inner_ptr);
-    }
-    size_t l = 0, r = cur_inner_node.node_size - 1;
-    while(l < r) {
-      size_t mid = (l + r) >> 1;
-      if(key > cur_inner_node.keys[mid]) l = mid + 1;
-      else r = mid;
+      write_inner(cur_inner_node, cur_inner_ptr);
     }
+    size_t l = cur_inner_node.search(key);
     if(cur_inner_node.is_leaf) {
       pos = l;
       break;
@@ -229,11 +416,15 @@ void StarryPurple::Fmultimap<KeyType, ValueType, degree, capacity>::erase(
   }
   if(key < cur_inner_node.keys[pos]) return; // key not exist
   // assert(key == cur_inner_node.keys[pos])
+  // the value list of a hot key can be long; this is the part that grows with it.
+  TraceSpan walk_span("Fmultimap::vlist_walk", "index");
   VlistPtr cur_vlist_ptr = cur_inner_node.vlist_ptrs[pos];
   VlistNode cur_vlist_node; vlist_fstream.read(cur_vlist_node, cur_vlist_ptr);
   VlistPtr nxt_vlist_ptr = cur_vlist_node.nxt;
   VlistNode nxt_vlist_node;
+  offsetType window_begin = 0, window_end = 0;
   while(!nxt_vlist_ptr.isnull()) {
+    prefetch_vlist(cur_vlist_ptr, nxt_vlist_ptr, window_begin, window_end);
     vlist_fstream.read(nxt_vlist_node, nxt_vlist_ptr);
 
     if(value > nxt_vlist_node.value[nxt_vlist_node.node_size - 1]) {
@@ -243,28 +434,36 @@ void StarryPurple::Fmultimap<KeyType, ValueType, degree, capacity>::erase(
       continue;
     }
 
-    int l = 0, r = nxt_vlist_node.node_size - 1;
-    while(l < r) {
-      int mid = (l + r) >> 1;
-      if(value <= nxt_vlist_node.value[mid]) r = mid;
-      else l = mid + 1;
-    }
+    int l = std::min<int>(
+      node_lower_bound(nxt_vlist_node.value, nxt_vlist_node.node_size, value), nxt_vlist_node.node_size - 1);
     if(nxt_vlist_node.value[l] != value) return; // value not exist
+    if(entry_count > 0) --entry_count; // files from before the count may hold more than it says
 
     --nxt_vlist_node.node_size;
     for(int i = l; i < nxt_vlist_node.node_size; ++i)
       nxt_vlist_node.value[i] = nxt_vlist_node.value[i + 1];
     nxt_vlist_node.value[nxt_vlist_node.node_size] = ValueType();
+    if(nxt_vlist_node.node_size == 0 && nxt_vlist_node.nxt.isnull()) {
+      // the last value of the list. An empty node would have no last value for insert to compare with.
+      cur_vlist_node.nxt.setnull();
+      vlist_fstream.write(cur_vlist_node, cur_vlist_ptr);
+      vlist_fstream.free(nxt_vlist_ptr);
+      return;
+    }
     vlist_fstream.write(nxt_vlist_node, nxt_vlist_ptr);
 
-    if(nxt_vlist_node.node_size < degree) {
+    if(nxt_vlist_node.node_size < static_cast<int>(cVlistDegree)) {
       if(cur_vlist_ptr != cur_inner_node.vlist_ptrs[pos]) {
-        if(cur_vlist_node.node_size > degree) {
+        if(cur_vlist_node.node_size > static_cast<int>(cVlistDegree)) {
           int total_size = cur_vlist_node.node_size + nxt_vlist_node.node_size;
           int left_size = total_size / 2, right_size = total_size - left_size;
-          ValueType empty_value;
-          for(int i = 0; i < right_size - nxt_vlist_node.node_size; ++i) {
-            nxt_vlist_node.value[nxt_vlist_node.node_size + i] = cur_vlist_node.value[left_size + i];
+          ValueType empty_value{};
+          // the values moved over are smaller, so they go in front.
+          const int moved_size = right_size - nxt_vlist_node.node_size;
+          for(int i = nxt_vlist_node.node_size - 1; i >= 0; --i)
+            nxt_vlist_node.value[i + moved_size] = nxt_vlist_node.value[i];
+          for(int i = 0; i < moved_size; ++i) {
+            nxt_vlist_node.value[i] = cur_vlist_node.value[left_size + i];
             cur_vlist_node.value[left_size + i] = empty_value;
           }
           cur_vlist_node.node_size = left_size;
@@ -288,10 +487,10 @@ void StarryPurple::Fmultimap<KeyType, ValueType, degree, capacity>::erase(
         cur_vlist_ptr = nxt_vlist_ptr;
         nxt_vlist_ptr = cur_vlist_node.nxt;
         vlist_fstream.read(nxt_vlist_node, nxt_vlist_ptr);
-        if(nxt_vlist_node.node_size > degree) {
+        if(nxt_vlist_node.node_size > static_cast<int>(cVlistDegree)) {
           int total_size = cur_vlist_node.node_size + nxt_vlist_node.node_size;
           int left_size = total_size / 2, right_size = total_size - left_size;
-          ValueType empty_value;
+          ValueType empty_value{};
           for(int i = 0; i < left_size - cur_vlist_node.node_size; ++i)
             cur_vlist_node.value[cur_vlist_node.node_size + i] = nxt_vlist_node.value[i];
           for(int i = 0, diff = left_size - cur_vlist_node.node_size; i < right_size; ++i)
@@ -321,26 +520,39 @@ void StarryPurple::Fmultimap<KeyType, ValueType, degree, capacity>::erase(
   // if code reaches here, it means: value too big.
 }
 
-template<class KeyType, class ValueType, size_t degree, size_t capacity>
-std::vector<ValueType> StarryPurple::Fmultimap<KeyType, ValueType, degree, capacity>::operator[](
+template<class KeyType, class ValueType, size_t capacity>
+std::vector<ValueType> StarryPurple::Fmultimap<KeyType, ValueType, capacity>::operator[](
   const KeyType &key) {
   std::vector<ValueType> res;
-  if(root_ptr.isnull()) return res;
+  find_into(key, res);
+  return res;
+}
+
+template<class KeyType, class ValueType, size_t capacity>
+std::pmr::vector<ValueType> StarryPurple::Fmultimap<KeyType, ValueType, capacity>::find(
+  const KeyType &key, std::pmr::memory_resource *resource) {
+  std::pmr::vector<ValueType> res(resource);
+  find_into(key, res);
+  return res;
+}
+
+template<class KeyType, class ValueType, size_t capacity>
+template<class Container>
+void StarryPurple::Fmultimap<KeyType, ValueType, capacity>::find_into(
+  const KeyType &key, Container &res) {
+  TraceSpan span("Fmultimap::find", "index");
+  load();
+  if(root_ptr.isnull()) return;
   InnerPtr cur_inner_ptr = root_ptr, parent_ptr; // parent_ptr = root_node.parent_ptr = "nullptr"
   InnerNode cur_inner_node; inner_fstream.read(cur_inner_node, cur_inner_ptr);
-  if(key > cur_inner_node.high_key) return res; // key too large
+  if(key > cur_inner_node.high_key) return; // key too large
   size_t pos;
   while(true) {
     if(cur_inner_node.parent_ptr != parent_ptr) {
       cur_inner_node.parent_ptr = parent_ptr;
-      inner_fstream.write(cur_inner_node, cur_inner_ptr);
-    }
-    size_t l = 0, r = cur_inner_node.node_size - 1;
-    while(l < r) {
-      size_t mid = (l + r) >> 1;
-      if(key > cur_inner_node.keys[mid]) l = mid + 1;
-      else r = mid;
+      write_inner(cur_inner_node, cur_inner_ptr);
     }
+    size_t l = cur_inner_node.search(key);
     if(cur_inner_node.is_leaf) {
       pos = l;
       break;
@@ -349,13 +561,17 @@ std::vector<ValueType> StarryPurple::Fmultimap<KeyType, ValueType, degree, capac
     cur_inner_ptr = cur_inner_node.inner_ptrs[l];
     inner_fstream.read(cur_inner_node, cur_inner_ptr);
   }
-  if(key < cur_inner_node.keys[pos]) return res; // key not exist
+  if(key < cur_inner_node.keys[pos]) return; // key not exist
   // assert(key == cur_inner_node.keys[pos])
+  // the value list of a hot key can be long; this is the part that grows with it.
+  TraceSpan walk_span("Fmultimap::vlist_walk", "index");
   VlistPtr cur_vlist_ptr = cur_inner_node.vlist_ptrs[pos];
   VlistNode cur_vlist_node; vlist_fstream.read(cur_vlist_node, cur_vlist_ptr);
   VlistPtr nxt_vlist_ptr = cur_vlist_node.nxt;
   VlistNode nxt_vlist_node;
+  offsetType window_begin = 0, window_end = 0;
   while(!nxt_vlist_ptr.isnull()) {
+    prefetch_vlist(cur_vlist_ptr, nxt_vlist_ptr, window_begin, window_end);
     vlist_fstream.read(nxt_vlist_node, nxt_vlist_ptr);
     for(int i = 0; i < nxt_vlist_node.node_size; ++i)
       res.push_back(nxt_vlist_node.value[i]);
@@ -363,14 +579,230 @@ std::vector<ValueType> StarryPurple::Fmultimap<KeyType, ValueType, degree, capac
     cur_vlist_ptr = nxt_vlist_ptr;
     nxt_vlist_ptr = cur_vlist_node.nxt;
   }
+}
+
+template<class KeyType, class ValueType, size_t capacity>
+std::pmr::vector<ValueType> StarryPurple::Fmultimap<KeyType, ValueType, capacity>::find_first(
+  size_t count, std::pmr::memory_resource *resource) {
+  TraceSpan span("Fmultimap::find_first", "index");
+  load();
+  std::pmr::vector<ValueType> res(resource);
+  if(root_ptr.isnull() || count == 0) return res;
+  find_first_into(root_ptr, count, res);
   return res;
 }
 
-template<class KeyType, class ValueType, size_t degree, size_t capacity>
-void StarryPurple::Fmultimap<KeyType, ValueType, degree, capacity>::maintain_size(
+template<class KeyType, class ValueType, size_t capacity>
+void StarryPurple::Fmultimap<KeyType, ValueType, capacity>::find_first_into(
+  const InnerPtr &ptr, size_t count, std::pmr::vector<ValueType> &res) {
+  InnerNode node; inner_fstream.read(node, ptr);
+  for(size_t i = 0; i < node.node_size && res.size() < count; ++i) {
+    if(!node.is_leaf) {
+      find_first_into(node.inner_ptrs[i], count, res);
+      continue;
+    }
+    VlistNode vlist_node; vlist_fstream.read(vlist_node, node.vlist_ptrs[i]);
+    while(!vlist_node.nxt.isnull() && res.size() < count) {
+      vlist_fstream.read(vlist_node, vlist_node.nxt);
+      for(int j = 0; j < vlist_node.node_size && res.size() < count; ++j)
+        res.push_back(vlist_node.value[j]);
+    }
+  }
+}
+
+template<class KeyType, class ValueType, size_t capacity>
+void StarryPurple::Fmultimap<KeyType, ValueType, capacity>::remove(const KeyType &key) {
+  TraceSpan span("Fmultimap::remove", "index");
+  load();
+  if(root_ptr.isnull()) return;
+  InnerPtr cur_inner_ptr = root_ptr, parent_ptr; // parent_ptr = root_ptr.parent_ptr = "nullptr"
+  InnerNode cur_inner_node; inner_fstream.read(cur_inner_node, cur_inner_ptr);
+  if(key > cur_inner_node.high_key) return; // key too large
+  size_t pos;
+  while(true) {
+    if(cur_inner_node.parent_ptr != parent_ptr) {
+      cur_inner_node.parent_ptr = parent_ptr;
+      write_inner(cur_inner_node, cur_inner_ptr);
+    }
+    size_t l = cur_inner_node.search(key);
+    if(cur_inner_node.is_leaf) {
+      pos = l;
+      break;
+    }
+    parent_ptr = cur_inner_ptr;
+    cur_inner_ptr = cur_inner_node.inner_ptrs[l];
+    inner_fstream.read(cur_inner_node, cur_inner_ptr);
+  }
+  if(key != cur_inner_node.keys[pos]) return; // key not exist
+  const VlistPtr head_ptr = cur_inner_node.vlist_ptrs[pos];
+  VlistNode head_node; vlist_fstream.read(head_node, head_ptr);
+  VlistNode vlist_node;
+  for(VlistPtr vlist_ptr = head_node.nxt; !vlist_ptr.isnull(); vlist_ptr = vlist_node.nxt) {
+    vlist_fstream.read(vlist_node, vlist_ptr);
+    vlist_fstream.free(vlist_ptr);
+    entry_count -= std::min<size_t>(entry_count, vlist_node.node_size);
+  }
+  if(cur_inner_node.node_size == 1) {
+    // a leaf is never left empty. The key stays, with no values.
+    head_node.nxt.setnull();
+    vlist_fstream.write(head_node, head_ptr);
+    return;
+  }
+  vlist_fstream.free(head_ptr);
+  --cur_inner_node.node_size;
+  for(size_t i = pos; i < cur_inner_node.node_size; ++i) {
+    cur_inner_node.keys[i] = cur_inner_node.keys[i + 1];
+    cur_inner_node.vlist_ptrs[i] = cur_inner_node.vlist_ptrs[i + 1];
+  }
+  cur_inner_node.keys[cur_inner_node.node_size] = KeyType();
+  cur_inner_node.vlist_ptrs[cur_inner_node.node_size].setnull();
+  // the keys of the parents stay as they are. They only have to be no less than the keys below them.
+  cur_inner_node.high_key = cur_inner_node.keys[cur_inner_node.node_size - 1];
+  write_inner(cur_inner_node, cur_inner_ptr);
+}
+
+template<class KeyType, class ValueType, size_t capacity>
+void StarryPurple::Fmultimap<KeyType, ValueType, capacity>::bulk_insert(
+  std::vector<std::pair<KeyType, ValueType>> entries) {
+  TraceSpan span("Fmultimap::bulk_insert", "index");
+  load();
+  if(entries.empty()) return;
+  std::sort(entries.begin(), entries.end());
+  entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+  if(!root_ptr.isnull()) {
+    // a rebuild rewrites every entry, so weigh the batch against the entries, not the keys:
+    // a map with everything under one key is as costly to rebuild as one with a key each.
+    // Files from before entry_count only give a lower bound of it. There the keys count too:
+    // every node below the root holds at least cInnerDegree / 2 of them.
+    InnerNode node; inner_fstream.read(node, root_ptr);
+    size_t least_size = node.node_size;
+    while(!node.is_leaf) {
+      least_size *= cInnerDegree / 2;
+      inner_fstream.read(node, node.inner_ptrs[0]);
+    }
+    least_size = std::max(least_size, entry_count);
+    if(entries.size() * 4 < least_size) {
+      // rebuilding would cost more than it saves. Sorted, the inserts still walk nearby paths.
+      for(const auto &[key, value]: entries)
+        insert(key, value);
+      return;
+    }
+    std::vector<std::pair<KeyType, ValueType>> existing;
+    collect_and_free(root_ptr, existing);
+    root_ptr.setnull();
+    std::vector<std::pair<KeyType, ValueType>> merged;
+    merged.reserve(existing.size() + entries.size());
+    std::merge(existing.begin(), existing.end(), entries.begin(), entries.end(), std::back_inserter(merged));
+    merged.erase(std::unique(merged.begin(), merged.end()), merged.end());
+    entries.swap(merged);
+  }
+  build(entries);
+  entry_count = entries.size();
+}
+
+template<class KeyType, class ValueType, size_t capacity>
+void StarryPurple::Fmultimap<KeyType, ValueType, capacity>::prefetch_vlist(
+  const VlistPtr &from, const VlistPtr &ptr, offsetType &window_begin, offsetType &window_end) {
+  constexpr offsetType block_count = std::max<size_t>(1, cVlistPrefetchSize / sizeof(VlistNode));
+  if(ptr.isnull() || (window_begin <= ptr.offset_ && ptr.offset_ < window_end)) return;
+  // build() lays a list out back to front, insert() front to back. Follow whichever it is.
+  if(!from.isnull() && ptr.offset_ < from.offset_) {
+    window_end = ptr.offset_ + 1;
+    window_begin = std::max<offsetType>(0, window_end - block_count);
+  } else {
+    window_begin = ptr.offset_;
+    window_end = std::min<offsetType>(capacity, window_begin + block_count);
+  }
+  vlist_fstream.prefetch(VlistPtr(window_begin), window_end - window_begin);
+}
+
+template<class KeyType, class ValueType, size_t capacity>
+void StarryPurple::Fmultimap<KeyType, ValueType, capacity>::collect_and_free(
+  const InnerPtr &ptr, std::vector<std::pair<KeyType, ValueType>> &entries) {
+  InnerNode node; inner_fstream.read(node, ptr);
+  for(size_t i = 0; i < node.node_size; ++i) {
+    if(!node.is_leaf) {
+      collect_and_free(node.inner_ptrs[i], entries);
+      continue;
+    }
+    VlistNode vlist_node; vlist_fstream.read(vlist_node, node.vlist_ptrs[i]);
+    vlist_fstream.free(node.vlist_ptrs[i]);
+    VlistPtr prev_vlist_ptr = node.vlist_ptrs[i], vlist_ptr = vlist_node.nxt;
+    offsetType window_begin = 0, window_end = 0;
+    while(!vlist_ptr.isnull()) {
+      prefetch_vlist(prev_vlist_ptr, vlist_ptr, window_begin, window_end);
+      vlist_fstream.read(vlist_node, vlist_ptr);
+      for(int j = 0; j < vlist_node.node_size; ++j)
+        entries.emplace_back(node.keys[i], vlist_node.value[j]);
+      vlist_fstream.free(vlist_ptr);
+      prev_vlist_ptr = vlist_ptr;
+      vlist_ptr = vlist_node.nxt;
+    }
+  }
+  inner_fstream.free(ptr);
+}
+
+template<class KeyType, class ValueType, size_t capacity>
+void StarryPurple::Fmultimap<KeyType, ValueType, capacity>::build(
+  const std::vector<std::pair<KeyType, ValueType>> &entries) {
+  // leave some room in every node, so that the next inserts don't split them all at once.
+  constexpr size_t node_fill = cInnerDegree * 3 / 4;
+  constexpr int vlist_fill = cVlistDegree + cVlistDegree / 2;
+  if(entries.empty()) return;
+  // the leaves, with a value list for each key.
+  std::vector<std::pair<KeyType, InnerPtr>> level; // (high_key, node) of the level just built
+  InnerNode node;
+  for(size_t first = 0; first < entries.size(); ) {
+    size_t last = first;
+    while(last < entries.size() && entries[last].first == entries[first].first) ++last;
+    // the value nodes from back to front, as each points to the next.
+    VlistNode vlist_node;
+    vlist_node.nxt.setnull();
+    for(size_t chunk = (last - first - 1) / vlist_fill + 1; chunk-- > 0; ) {
+      const size_t begin = first + chunk * vlist_fill, end = std::min(last, begin + vlist_fill);
+      VlistNode value_node;
+      value_node.node_size = end - begin;
+      for(size_t i = begin; i < end; ++i)
+        value_node.value[i - begin] = entries[i].second;
+      value_node.nxt = vlist_node.nxt;
+      vlist_node.nxt = vlist_fstream.allocate(value_node);
+    }
+    node.keys[node.node_size] = entries[first].first;
+    node.vlist_ptrs[node.node_size] = vlist_fstream.allocate(vlist_node); // the empty head
+    ++node.node_size;
+    if(node.node_size == node_fill || last == entries.size()) {
+      node.is_leaf = true;
+      node.high_key = node.keys[node.node_size - 1];
+      level.emplace_back(node.high_key, allocate_inner(node));
+      node = InnerNode();
+    }
+    first = last;
+  }
+  // then the inner levels up to the root.
+  // parent_ptr is left null. Like everywhere else, it's set by the first descent through the node.
+  while(level.size() > 1) {
+    std::vector<std::pair<KeyType, InnerPtr>> upper_level;
+    for(size_t first = 0; first < level.size(); first += node_fill) {
+      InnerNode inner_node;
+      inner_node.is_leaf = false;
+      inner_node.node_size = std::min(node_fill, level.size() - first);
+      for(size_t i = 0; i < inner_node.node_size; ++i) {
+        inner_node.keys[i] = level[first + i].first;
+        inner_node.inner_ptrs[i] = level[first + i].second;
+      }
+      inner_node.high_key = inner_node.keys[inner_node.node_size - 1];
+      upper_level.emplace_back(inner_node.high_key, allocate_inner(inner_node));
+    }
+    level.swap(upper_level);
+  }
+  root_ptr = level[0].second;
+}
+
+template<class KeyType, class ValueType, size_t capacity>
+void StarryPurple::Fmultimap<KeyType, ValueType, capacity>::maintain_size(
   InnerPtr &maintain_ptr, InnerNode &maintain_node) {
   while(true) {
-    if(maintain_node.node_size >= degree + 1) { // node_size upper limit
+    if(maintain_node.node_size >= cInnerDegree + 1) { // node_size upper limit
       // here maintain_ptr = root_ptr, maintain_node is the root node.
       if(maintain_ptr == root_ptr) {
         // create a new root.
@@ -382,30 +814,25 @@ void StarryPurple::Fmultimap<KeyType, ValueType, degree, capacity>::maintain_siz
         new_root.inner_ptrs[0] = maintain_ptr;
         // You can do the split completely here to reduce two file operations.
         // But I'm lazy now. or to say crazy? So I refuse.
-        root_ptr = maintain_node.parent_ptr = inner_fstream.allocate(new_root);
-        inner_fstream.write(maintain_node, maintain_ptr);
+        root_ptr = maintain_node.parent_ptr = allocate_inner(new_root);
+        write_inner(maintain_node, maintain_ptr);
         split(0, maintain_ptr, maintain_node);
         return;
       }
       // find the split_pos.
       InnerNode parent_node; inner_fstream.read(parent_node, maintain_node.parent_ptr);
-      size_t l = 0, r = parent_node.node_size - 1;
-      while(l < r) {
-        size_t mid = (l + r) >> 1;
-        if(maintain_node.high_key > parent_node.keys[mid]) l = mid + 1;
-        else r = mid;
-      }
+      size_t l = parent_node.search(maintain_node.high_key);
       // assert(maintain_node.high_key == parent_node.keys[l]);
       split(l, maintain_ptr, maintain_node);
       continue;
     }
-    // if(maintain_node.node_size < degree / 2) {...}
+    // if(maintain_node.node_size < cInnerDegree / 2) {...}
     return;
   }
 }
 
-template<class KeyType, class ValueType, size_t degree, size_t capacity>
-void StarryPurple::Fmultimap<KeyType, ValueType, degree, capacity>::split(
+template<class KeyType, class ValueType, size_t capacity>
+void StarryPurple::Fmultimap<KeyType, ValueType, capacity>::split(
   const size_t split_pos, InnerPtr &split_ptr, InnerNode &split_node) {
   // split a new node and insert it into the right pos.
   size_t left_size = split_node.node_size / 2, right_size = split_node.node_size - left_size;
@@ -413,7 +840,7 @@ void StarryPurple::Fmultimap<KeyType, ValueType, degree, capacity>::split(
   InnerNode right_node;
   right_node.is_leaf = split_node.is_leaf; right_node.high_key = split_node.high_key;
   right_node.parent_ptr = split_node.parent_ptr; right_node.node_size = right_size;
-  KeyType empty_key;
+  KeyType empty_key{};
   for(size_t i = 0; i < right_size; ++i) {
     right_node.keys[i] = split_node.keys[left_size + i];
     right_node.inner_ptrs[i] = split_node.inner_ptrs[left_size + i];
@@ -422,10 +849,10 @@ void StarryPurple::Fmultimap<KeyType, ValueType, degree, capacity>::split(
     split_node.inner_ptrs[left_size + i].setnull();
     split_node.vlist_ptrs[left_size + i].setnull();
   }
-  InnerPtr right_ptr = inner_fstream.allocate(right_node);
+  InnerPtr right_ptr = allocate_inner(right_node);
 
   split_node.node_size = left_size; split_node.high_key = split_node.keys[split_node.node_size - 1];
-  inner_fstream.write(split_node, split_ptr);
+  write_inner(split_node, split_ptr);
 
   // yeah, you can use inner_fstream.read(split_node, split_node.parent_ptr) here.
   // to reduce a copy construction.
@@ -441,7 +868,7 @@ void StarryPurple::Fmultimap<KeyType, ValueType, degree, capacity>::split(
   parent_node.keys[split_pos + 1] = right_node.high_key;
   // assert(parent_node.inner_ptrs[split_pos] == split_ptr);
   parent_node.inner_ptrs[split_pos + 1] = right_ptr;
-  inner_fstream.write(parent_node, split_node.parent_ptr);
+  write_inner(parent_node, split_node.parent_ptr);
 
   split_ptr = split_node.parent_ptr; split_node = parent_node;
 }
@@ -539,6 +966,14 @@ StarryPurple::ConstStr<capacity>::ConstStr(const std::string &str) {
   strcpy(storage, str.c_str()); // for '\0'
 }
 
+template<int capacity>
+StarryPurple::ConstStr<capacity>::ConstStr(const char *str, int length) {
+  expect(length).lesserEqual(capacity);
+  len = length;
+  memcpy(storage, str, length);
+  storage[length] = '\0';
+}
+
 template<int capacity>
 StarryPurple::ConstStr<capacity>::ConstStr(const ConstStr &other) {
   len = other.len;
@@ -599,10 +1034,28 @@ int StarryPurple::ConstStr<capacity>::length() const {
   return len;
 }
 
+template<int capacity>
+const char *StarryPurple::ConstStr<capacity>::c_str() const {
+  return storage;
+}
+
 template<int capacity>
 const char StarryPurple::ConstStr<capacity>::operator[](int index) const {
   return storage[index];
 }
 
+template<int capacity>
+uint64_t StarryPurple::ConstStr<capacity>::prefix() const {
+  uint64_t res = 0;
+  for(int i = 0; i < 8; ++i) {
+    // chars compare as char does. If that's signed, flipping the sign bit gives the same order unsigned.
+    // A shorter string is padded with 0, no more than any char.
+    unsigned char byte = 0;
+    if(i < len) byte = static_cast<unsigned char>(storage[i]) ^ (std::is_signed_v<char> ? 0x80 : 0);
+    res = res << 8 | byte;
+  }
+  return res;
+}
+
 
 #endif // UTILITIES_TPP
\ No newline at end of file
@@ -8,12 +8,32 @@
 
 template<class T>
 StarryPurple::Validator<T> StarryPurple::expect(const T &val) {
-  return Validator<T>(val);
+  return Validator<T>(val, true);
 }
 
 template<class T>
-StarryPurple::Validator<T>::Validator(const T &val) {
+StarryPurple::Validator<T> StarryPurple::check(const T &val) {
+  return Validator<T>(val, false);
+}
+
+template<class T>
+StarryPurple::Validator<T>::Validator(const T &val, bool throwing) {
   v = val;
+  is_throwing = throwing;
+}
+
+template<class T>
+StarryPurple::Validator<T>
+&StarryPurple::Validator<T>::fail() {
+  if(is_throwing)
+    throw ValidatorException();
+  is_valid = false;
+  return *this;
+}
+
+template<class T>
+StarryPurple::Validator<T>::operator bool() const {
+  return is_valid;
 }
 
 template<class T>
@@ -26,16 +46,18 @@ StarryPurple::Validator<T>
 template<class T>
 StarryPurple::Validator<T>
 &StarryPurple::Validator<T>::toBe(const T &other) {
+  if(!is_valid) return *this;
   bool res = (v == other);
   if(res ^ is_rev)
     return *this;
-  throw ValidatorException();
+  return fail();
 }
 
 template<class T>
 template<class U, class... Args>
 StarryPurple::Validator<T>
 &StarryPurple::Validator<T>::toBeOneOf(const U &other, const Args &... args) {
+  if(!is_valid) return *this;
   bool res = (v == other);
   if(res ^ is_rev)
     return *this;
@@ -46,41 +68,42 @@ template<class T>
 template<class U>
 StarryPurple::Validator<T>
 &StarryPurple::Validator<T>::toBeOneOf(const U &other) {
+  if(!is_valid) return *this;
   bool res = (v == other);
   if(res ^ is_rev)
     return *this;
-  throw ValidatorException();
+  return fail();
 }
 
 template<class T>
 StarryPurple::Validator<T>
 &StarryPurple::Validator<T>::lesserEqual(const T &other) {
+  if(!is_valid) return *this;
   bool res = (v <= other);
   if(res ^ is_rev)
     return *this;
-  throw ValidatorException();
+  return fail();
 }
 
 template<class T>
 StarryPurple::Validator<T>
 &StarryPurple::Validator<T>::greaterEqual(const T &other) {
+  if(!is_valid) return *this;
   bool res = (v >= other);
   if(res ^ is_rev)
     return *this;
-  throw ValidatorException();
+  return fail();
 }
 
 template<class T>
-template<class CharT>
 StarryPurple::Validator<T>
-&StarryPurple::Validator<T>::toBeConsistedOf(const std::basic_string<CharT> &str) {
-  static_assert(std::is_same_v<T, std::basic_string<CharT>>);
-  typename std::basic_string<CharT>::size_type n;
-  for(CharT ch: v) {
-    n = str.find(ch);
-    if(n == std::basic_string<CharT>::npos)
-      throw ValidatorException();
-  }
+&StarryPurple::Validator<T>::toBeConsistedOf(const Charset &charset) {
+  // both std::string and std::string_view are welcomed.
+  static_assert(std::is_convertible_v<const T &, std::string_view>);
+  if(!is_valid) return *this;
+  for(const char ch: std::string_view(v))
+    if(!charset.contains(ch))
+      return fail();
   return *this;
 }
 
@@ -89,11 +112,12 @@ template<class CharT>
 StarryPurple::Validator<T>
 &StarryPurple::Validator<T>::toMatch(const std::basic_string<CharT> &str) {
   static_assert(std::is_same_v<T, std::basic_string<CharT>>);
+  if(!is_valid) return *this;
   std::basic_regex<CharT> regex(str);
   bool res = std::regex_match(v, regex);
   if(res ^ is_rev)
     return *this;
-  throw ValidatorException();
+  return fail();
 }
 
 #endif // VALIDATOR_TPP
\ No newline at end of file
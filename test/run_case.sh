@@ -0,0 +1,23 @@
+#!/bin/sh
+# run_case.sh BOOKSTORE CASE [--batch]
+# Runs CASE.in on fresh data files, then CASE.restart.in (if there is one) on the same files,
+# and compares all they print with CASE.out. With --batch, the scripts go through "bookstore --batch".
+bookstore=$1
+case_path=$2
+mode=$3
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+
+run() {
+  if [ "$mode" = "--batch" ]; then
+    (cd "$work" && "$bookstore" --batch "$1")
+  else
+    (cd "$work" && "$bookstore" < "$1")
+  fi
+}
+
+run "$case_path.in" > "$work/output" || exit 1
+if [ -f "$case_path.restart.in" ]; then
+  run "$case_path.restart.in" >> "$work/output" || exit 1
+fi
+diff "$case_path.out" "$work/output"
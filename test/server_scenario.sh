@@ -0,0 +1,107 @@
+#!/bin/sh
+# server_scenario.sh BOOKSTORE EXPECTED
+# Runs "bookstore --server" on fresh data files and talks to it through "bookstore --client":
+#   four terminals selling the same books at once,
+#   a transaction renaming a book another session has selected, then aborted,
+#   a transaction left idle till the server aborts it,
+#   and a last look at the books and the finance.
+# What the terminals get back, in a fixed order, is compared with EXPECTED.
+bookstore=$1
+expected=$2
+work=$(mktemp -d) || exit 1
+server_pid=
+cleanup() {
+  [ -n "$server_pid" ] && kill "$server_pid" 2>/dev/null
+  exec 3>&- 4>&- 5>&-
+  rm -rf "$work"
+}
+trap cleanup EXIT
+cd "$work" || exit 1
+
+"$bookstore" --server sock &
+server_pid=$!
+tries=0
+while [ ! -S sock ]; do
+  tries=$((tries + 1))
+  [ $tries -gt 100 ] && { echo "server did not start"; exit 1; }
+  sleep 0.05
+done
+
+client() {
+  "$bookstore" --client sock
+}
+# wait till @1 has @2 lines, that is, till the commands before are answered.
+wait_lines() {
+  tries=0
+  while [ "$(wc -l < "$1")" -lt "$2" ]; do
+    tries=$((tries + 1))
+    [ $tries -gt 400 ] && { echo "no answer in $1"; exit 1; }
+    sleep 0.05
+  done
+}
+
+# four books with 1000 copies each, and a customer.
+{
+  echo "su root sjtu"
+  for book in s0 s1 s2 s3; do
+    echo "select $book"
+    echo "modify -name=\"$book\" -price=2"
+    echo "import 1000 100"
+  done
+  echo "useradd customer pw 1 customer"
+  echo "show"
+} | client > setup.out
+
+# each terminal buys 100 of each book, one at a time.
+sale_pids=
+for terminal in 1 2 3 4; do
+  {
+    echo "su customer pw"
+    i=0
+    while [ $i -lt 100 ]; do
+      echo "buy s$(( (i + terminal) % 4 )) $terminal"
+      i=$((i + 1))
+    done
+  } | client > "sale$terminal.out" &
+  sale_pids="$sale_pids $!"
+done
+wait $sale_pids
+
+# B has s0 selected while A renames it in a transaction. A aborts: B still has s0.
+mkfifo a.in b.in
+client < a.in > a.out &
+a_pid=$!
+exec 3> a.in
+client < b.in > b.out &
+b_pid=$!
+exec 4> b.in
+printf 'su root sjtu\nselect s0\nshow -ISBN=s0\n' >&4
+wait_lines b.out 1
+printf 'su root sjtu\nbegin\nselect s0\nmodify -ISBN=s0x\nshow -ISBN=s0x\nabort\nshow -ISBN=s0x\n' >&3
+wait_lines a.out 2
+printf 'import 1 1\nshow -ISBN=s0\n' >&4
+exec 3>&- 4>&-
+wait $a_pid $b_pid
+
+# C goes quiet in a transaction. D waits for the lock till the server drops C's transaction.
+mkfifo c.in
+client < c.in > c.out &
+c_pid=$!
+exec 5> c.in
+printf 'su root sjtu\nbegin\nselect idle\nimport 5 5\nshow -ISBN=idle\n' >&5
+wait_lines c.out 1
+printf 'su root sjtu\nshow -ISBN=idle\n' | client > d.out
+printf 'commit\nshow -ISBN=idle\n' >&5
+exec 5>&-
+wait $c_pid
+
+printf 'su root sjtu\nshow\nshow finance\n' | client > final.out
+kill "$server_pid"
+wait "$server_pid" || { echo "server did not stop cleanly"; exit 1; }
+server_pid=
+
+for part in setup sale1 sale2 sale3 sale4 a b c d final; do
+  echo "== $part"
+  cat "$part.out"
+done > all.out
+diff "$expected" all.out
@@ -0,0 +1,49 @@
+#!/bin/sh
+# standby_replay.sh BOOKSTORE SCRIPT...
+# A standby follows a primary started with "--ship" from fresh data files. The primary runs each SCRIPT
+# in turn (restarting in between), then the standby must catch up with the whole ship file.
+# It must then have the same data files as the primary, byte for byte,
+# and answer the read-only queries the same as the primary does.
+bookstore=$1
+shift
+work=$(mktemp -d) || exit 1
+standby_pid=
+cleanup() {
+  [ -n "$standby_pid" ] && kill "$standby_pid" 2>/dev/null
+  rm -rf "$work"
+}
+trap cleanup EXIT
+mkdir "$work/primary" "$work/standby"
+
+(cd "$work/standby" && exec "$bookstore" --standby ../changes.bin sock) &
+standby_pid=$!
+for script in "$@"; do
+  (cd "$work/primary" && "$bookstore" --ship ../changes.bin < "$script" > /dev/null) || exit 1
+done
+
+size=$(wc -c < "$work/changes.bin")
+tries=0
+while [ "$(cat "$work/standby/Test_standby_position" 2>/dev/null)" != "$size" ]; do
+  tries=$((tries + 1))
+  [ $tries -gt 600 ] && { echo "the standby did not catch up"; exit 1; }
+  sleep 0.05
+done
+
+queries='su root sjtu
+show
+show finance
+report bestsellers
+'
+printf '%s' "$queries" | "$bookstore" --client "$work/standby/sock" > "$work/standby.out"
+kill "$standby_pid"
+wait "$standby_pid" || { echo "the standby did not stop cleanly"; exit 1; }
+standby_pid=
+
+status=0
+for file in "$work"/primary/*.bsdat; do
+  name=$(basename "$file")
+  cmp -s "$file" "$work/standby/$name" || { echo "differs: $name"; status=1; }
+done
+printf '%s' "$queries" | (cd "$work/primary" && "$bookstore") > "$work/primary.out"
+diff "$work/primary.out" "$work/standby.out" || status=1
+exit $status